@@ -0,0 +1,842 @@
+///////////////////////////////////////////////////////////////////////////////
+// armorarrow.hh
+//
+// Save and load armor catalogs (or solver outputs) in the Arrow IPC file
+// format, so analytics tools can read them without reparsing text.
+//
+// Only the subset of the format we produce is supported: one record batch with
+// non-nullable "cost" (int32), "defense" (float64) and "description" (utf8)
+// columns, uncompressed, little-endian, metadata version V5. The FlatBuffers
+// metadata is encoded and decoded by hand, so there is no external dependency.
+//
+// Loading maps the file into memory and points an ArmorColumns straight at the
+// column buffers; nothing is copied or parsed per row.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "maxdefense.hh"
+
+
+// Arrow enum values used in the metadata.
+namespace arrow_ipc
+{
+	const char file_magic[] = "ARROW1";
+	const uint32_t continuation_marker = 0xFFFFFFFF;
+	const int16_t metadata_version_v5 = 4;
+
+	const uint8_t message_header_schema = 1;
+	const uint8_t message_header_record_batch = 3;
+
+	const uint8_t type_int = 2;
+	const uint8_t type_floating_point = 3;
+	const uint8_t type_utf8 = 5;
+
+	const int16_t precision_double = 2;
+
+	// Body buffers are padded to this many bytes, as the format recommends.
+	const size_t buffer_alignment = 64;
+}
+
+
+// Minimal forward FlatBuffers encoder.
+// A message is described as a tree of nodes and serialized in one pass; every
+// child is written after its parent, so all offsets are positive as required.
+class ArrowFlatNode
+{
+	//
+	public:
+
+		enum Kind { table, string, struct_vector, table_vector };
+
+		//
+		static std::shared_ptr<ArrowFlatNode> make_table()
+		{
+			return std::shared_ptr<ArrowFlatNode>(new ArrowFlatNode(table));
+		}
+
+		static std::shared_ptr<ArrowFlatNode> make_string(const std::string& value)
+		{
+			auto node = std::shared_ptr<ArrowFlatNode>(new ArrowFlatNode(string));
+			node->_bytes.assign(value.begin(), value.end());
+			return node;
+		}
+
+		// raw holds count structs laid out back to back, each aligned to 8 bytes.
+		static std::shared_ptr<ArrowFlatNode> make_struct_vector(const std::vector<uint8_t>& raw, uint32_t count)
+		{
+			auto node = std::shared_ptr<ArrowFlatNode>(new ArrowFlatNode(struct_vector));
+			node->_bytes = raw;
+			node->_count = count;
+			return node;
+		}
+
+		static std::shared_ptr<ArrowFlatNode> make_table_vector(const std::vector<std::shared_ptr<ArrowFlatNode>>& elements)
+		{
+			auto node = std::shared_ptr<ArrowFlatNode>(new ArrowFlatNode(table_vector));
+			node->_children = elements;
+			return node;
+		}
+
+		// Table fields. slot is the field's index in the .fbs schema.
+		template <typename T>
+		void scalar(int slot, T value)
+		{
+			assert(_kind == table);
+			Field field;
+			field.slot = slot;
+			field.bytes.resize(sizeof(T));
+			std::memcpy(field.bytes.data(), &value, sizeof(T));
+			_fields.push_back(field);
+		}
+
+		void child(int slot, std::shared_ptr<ArrowFlatNode> node)
+		{
+			assert(_kind == table);
+			Field field;
+			field.slot = slot;
+			field.child = node;
+			_fields.push_back(field);
+		}
+
+		// Serialize this node as the root of a complete buffer, padded to 8 bytes.
+		std::vector<uint8_t> finish() const
+		{
+			std::vector<uint8_t> out(4, 0);
+			size_t root = write(out);
+			patch_offset(out, 0, root);
+			out.resize(align(out.size(), 8), 0);
+			return out;
+		}
+
+	//
+	private:
+
+		struct Field
+		{
+			int slot;
+			std::vector<uint8_t> bytes;
+			std::shared_ptr<ArrowFlatNode> child;
+		};
+
+		explicit ArrowFlatNode(Kind kind) : _kind(kind), _count(0) {}
+
+		static size_t align(size_t n, size_t alignment)
+		{
+			return (n + alignment - 1) / alignment * alignment;
+		}
+
+		template <typename T>
+		static void put(std::vector<uint8_t>& out, size_t at, T value)
+		{
+			std::memcpy(out.data() + at, &value, sizeof(T));
+		}
+
+		// uoffset_t fields hold the distance from the field to its target.
+		static void patch_offset(std::vector<uint8_t>& out, size_t field, size_t target)
+		{
+			assert(target > field);
+			put<uint32_t>(out, field, target - field);
+		}
+
+		// Append this node to out and return its position.
+		size_t write(std::vector<uint8_t>& out) const
+		{
+			switch (_kind)
+			{
+				case string:
+				{
+					size_t at = align(out.size(), 4);
+					out.resize(at + 4 + _bytes.size() + 1, 0);
+					put<uint32_t>(out, at, _bytes.size());
+					std::memcpy(out.data() + at + 4, _bytes.data(), _bytes.size());
+					return at;
+				}
+
+				case struct_vector:
+				{
+					// The elements, not the length prefix, must be 8-byte aligned.
+					size_t at = align(out.size() + 4, 8) - 4;
+					out.resize(at + 4 + _bytes.size(), 0);
+					put<uint32_t>(out, at, _count);
+					std::memcpy(out.data() + at + 4, _bytes.data(), _bytes.size());
+					return at;
+				}
+
+				case table_vector:
+				{
+					size_t at = align(out.size(), 4);
+					out.resize(at + 4 + 4 * _children.size(), 0);
+					put<uint32_t>(out, at, _children.size());
+					for (size_t i = 0; i < _children.size(); i++)
+					{
+						size_t element = _children[i]->write(out);
+						patch_offset(out, at + 4 + 4 * i, element);
+					}
+					return at;
+				}
+
+				case table:
+				default:
+					return write_table(out);
+			}
+		}
+
+		size_t write_table(std::vector<uint8_t>& out) const
+		{
+			int slots = 0;
+			for (auto& field : _fields)
+			{
+				slots = std::max(slots, field.slot + 1);
+			}
+
+			// The vtable goes first, so the table's soffset to it is positive.
+			size_t vtable = align(out.size(), 2);
+			size_t vtable_size = 4 + 2 * slots;
+			out.resize(vtable + vtable_size, 0);
+
+			// Lay out the fields largest first, each aligned to its own size.
+			std::vector<const Field*> ordered;
+			for (auto& field : _fields)
+			{
+				ordered.push_back(&field);
+			}
+			std::stable_sort(ordered.begin(), ordered.end(), [](const Field* a, const Field* b)
+			{
+				size_t size_a = a->child ? 4 : a->bytes.size();
+				size_t size_b = b->child ? 4 : b->bytes.size();
+				return size_a > size_b;
+			});
+
+			size_t start = align(out.size(), 4);
+			size_t cursor = start + 4;
+			std::vector<size_t> positions;
+			for (auto field : ordered)
+			{
+				size_t size = field->child ? 4 : field->bytes.size();
+				cursor = align(cursor, size);
+				positions.push_back(cursor);
+				cursor += size;
+			}
+			size_t table_size = cursor - start;
+			out.resize(cursor, 0);
+
+			put<uint16_t>(out, vtable, vtable_size);
+			put<uint16_t>(out, vtable + 2, table_size);
+			put<int32_t>(out, start, start - vtable);
+			for (size_t i = 0; i < ordered.size(); i++)
+			{
+				put<uint16_t>(out, vtable + 4 + 2 * ordered[i]->slot, positions[i] - start);
+				if (!ordered[i]->child)
+				{
+					std::memcpy(out.data() + positions[i], ordered[i]->bytes.data(), ordered[i]->bytes.size());
+				}
+			}
+
+			for (size_t i = 0; i < ordered.size(); i++)
+			{
+				if (ordered[i]->child)
+				{
+					size_t target = ordered[i]->child->write(out);
+					patch_offset(out, positions[i], target);
+				}
+			}
+
+			return start;
+		}
+
+		Kind _kind;
+		uint32_t _count;
+		std::vector<uint8_t> _bytes;
+		std::vector<Field> _fields;
+		std::vector<std::shared_ptr<ArrowFlatNode>> _children;
+};
+
+
+// Bounds-checked reader over a FlatBuffers table inside [data, data + size).
+// Any malformed offset makes valid() false instead of reading out of range.
+class ArrowFlatTable
+{
+	//
+	public:
+
+		ArrowFlatTable() : _data(nullptr), _size(0), _pos(0), _valid(false) {}
+
+		// The root table of the buffer.
+		static ArrowFlatTable root(const uint8_t* data, size_t size)
+		{
+			ArrowFlatTable result;
+			result._data = data;
+			result._size = size;
+			uint32_t offset;
+			if (result.read(0, offset))
+			{
+				result.enter(offset);
+			}
+			return result;
+		}
+
+		bool valid() const { return _valid; }
+
+		// Scalar field, or fallback when absent.
+		template <typename T>
+		T scalar(int slot, T fallback) const
+		{
+			size_t at;
+			T value;
+			if (field(slot, at) && read(at, value))
+			{
+				return value;
+			}
+			return fallback;
+		}
+
+		// Table-valued field.
+		ArrowFlatTable table(int slot) const
+		{
+			ArrowFlatTable result;
+			size_t at;
+			uint32_t offset;
+			if (field(slot, at) && read(at, offset))
+			{
+				result = *this;
+				result._valid = false;
+				result.enter(at + offset);
+			}
+			return result;
+		}
+
+		// String-valued field; false when absent or malformed.
+		bool string(int slot, std::string& output) const
+		{
+			size_t begin;
+			uint32_t length;
+			if (!vector(slot, begin, length) || begin + length > _size)
+			{
+				return false;
+			}
+			output.assign(reinterpret_cast<const char*>(_data + begin), length);
+			return true;
+		}
+
+		// Vector-valued field: begin is the position of the first element.
+		bool vector(int slot, size_t& begin, uint32_t& length) const
+		{
+			size_t at;
+			uint32_t offset;
+			if (!field(slot, at) || !read(at, offset) || !read(at + offset, length))
+			{
+				return false;
+			}
+			begin = at + offset + 4;
+			return begin <= _size;
+		}
+
+		// Element index of a vector of tables.
+		ArrowFlatTable vector_table(size_t begin, uint32_t index) const
+		{
+			ArrowFlatTable result = *this;
+			result._valid = false;
+			uint32_t offset;
+			size_t at = begin + 4 * size_t(index);
+			if (read(at, offset))
+			{
+				result.enter(at + offset);
+			}
+			return result;
+		}
+
+		// Raw scalar at an absolute position, e.g. inside a vector of structs.
+		template <typename T>
+		bool read(size_t at, T& value) const
+		{
+			if (at + sizeof(T) > _size || at + sizeof(T) < at)
+			{
+				return false;
+			}
+			std::memcpy(&value, _data + at, sizeof(T));
+			return true;
+		}
+
+	//
+	private:
+
+		void enter(size_t pos)
+		{
+			int32_t vtable_offset;
+			uint16_t vtable_size;
+			_valid = false;
+			if (!read(pos, vtable_offset))
+			{
+				return;
+			}
+			int64_t vtable = int64_t(pos) - vtable_offset;
+			if (vtable < 0 || !read(vtable, vtable_size) || vtable + vtable_size > int64_t(_size))
+			{
+				return;
+			}
+			_pos = pos;
+			_vtable = vtable;
+			_vtable_size = vtable_size;
+			_valid = true;
+		}
+
+		// Absolute position of a present field.
+		bool field(int slot, size_t& at) const
+		{
+			if (!_valid || size_t(4 + 2 * slot + 2) > _vtable_size)
+			{
+				return false;
+			}
+			uint16_t offset;
+			if (!read(_vtable + 4 + 2 * slot, offset) || offset == 0)
+			{
+				return false;
+			}
+			at = _pos + offset;
+			return true;
+		}
+
+		const uint8_t* _data;
+		size_t _size;
+		size_t _pos;
+		size_t _vtable = 0;
+		uint16_t _vtable_size = 0;
+		bool _valid;
+};
+
+
+// Write columns to path in the Arrow IPC file format.
+// Returns false on I/O error.
+bool save_armor_arrow(const std::string& path, const ArmorColumns& catalog)
+{
+	using namespace arrow_ipc;
+
+	// Lazily loaded descriptions are decoded here; Arrow needs them packed.
+	ArmorColumns columns = catalog.packed();
+
+	auto pad = [](std::vector<uint8_t>& out, size_t alignment)
+	{
+		out.resize((out.size() + alignment - 1) / alignment * alignment, 0);
+	};
+
+	// Schema: cost, defense, description; all non-nullable.
+	auto make_field = [](const std::string& name, uint8_t type_type, std::shared_ptr<ArrowFlatNode> type)
+	{
+		auto field = ArrowFlatNode::make_table();
+		field->child(0, ArrowFlatNode::make_string(name));
+		field->scalar<uint8_t>(1, 0);
+		field->scalar<uint8_t>(2, type_type);
+		field->child(3, type);
+		field->child(5, ArrowFlatNode::make_table_vector({}));
+		return field;
+	};
+
+	auto int32_type = ArrowFlatNode::make_table();
+	int32_type->scalar<int32_t>(0, 32);
+	int32_type->scalar<uint8_t>(1, 1);
+
+	auto double_type = ArrowFlatNode::make_table();
+	double_type->scalar<int16_t>(0, precision_double);
+
+	auto schema = ArrowFlatNode::make_table();
+	schema->scalar<int16_t>(0, 0);
+	schema->child(1, ArrowFlatNode::make_table_vector({
+		make_field("cost", type_int, int32_type),
+		make_field("defense", type_floating_point, double_type),
+		make_field("description", type_utf8, ArrowFlatNode::make_table())
+	}));
+
+	// Record batch body: each column's buffers, in schema order, padded.
+	size_t n = columns.size();
+	int32_t description_length = n ? columns.description_offsets()[n] - columns.description_offsets()[0] : 0;
+	std::vector<int32_t> rebased_offsets(n + 1, 0);
+	for (size_t i = 0; i <= n && n; i++)
+	{
+		rebased_offsets[i] = columns.description_offsets()[i] - columns.description_offsets()[0];
+	}
+
+	std::vector<uint8_t> body;
+	std::vector<int64_t> buffer_layout;
+	auto add_buffer = [&](const void* data, size_t length)
+	{
+		pad(body, buffer_alignment);
+		buffer_layout.push_back(body.size());
+		buffer_layout.push_back(length);
+		if (length)
+		{
+			body.insert(body.end(), (const uint8_t*) data, (const uint8_t*) data + length);
+		}
+	};
+	add_buffer(nullptr, 0);
+	add_buffer(columns.costs(), n * sizeof(int32_t));
+	add_buffer(nullptr, 0);
+	add_buffer(columns.defenses(), n * sizeof(double));
+	add_buffer(nullptr, 0);
+	add_buffer(rebased_offsets.data(), (n + 1) * sizeof(int32_t));
+	add_buffer(n ? columns.description_bytes() + columns.description_offsets()[0] : nullptr, description_length);
+	pad(body, buffer_alignment);
+
+	std::vector<int64_t> node_layout;
+	for (int field = 0; field < 3; field++)
+	{
+		node_layout.push_back(n);
+		node_layout.push_back(0);
+	}
+
+	auto to_bytes = [](const std::vector<int64_t>& values)
+	{
+		std::vector<uint8_t> raw(values.size() * sizeof(int64_t));
+		std::memcpy(raw.data(), values.data(), raw.size());
+		return raw;
+	};
+
+	auto record_batch = ArrowFlatNode::make_table();
+	record_batch->scalar<int64_t>(0, n);
+	record_batch->child(1, ArrowFlatNode::make_struct_vector(to_bytes(node_layout), 3));
+	record_batch->child(2, ArrowFlatNode::make_struct_vector(to_bytes(buffer_layout), buffer_layout.size() / 2));
+
+	auto make_message = [&](uint8_t header_type, std::shared_ptr<ArrowFlatNode> header, int64_t body_length)
+	{
+		auto message = ArrowFlatNode::make_table();
+		message->scalar<int16_t>(0, metadata_version_v5);
+		message->scalar<uint8_t>(1, header_type);
+		message->child(2, header);
+		message->scalar<int64_t>(3, body_length);
+		return message->finish();
+	};
+
+	// Encapsulated message: continuation marker, metadata length, metadata, body.
+	std::vector<uint8_t> file(file_magic, file_magic + 6);
+	pad(file, 8);
+	auto append_message = [&](const std::vector<uint8_t>& metadata, const std::vector<uint8_t>& message_body)
+	{
+		size_t offset = file.size();
+		std::vector<uint8_t> prefix(8);
+		uint32_t metadata_size = metadata.size();
+		std::memcpy(prefix.data(), &continuation_marker, 4);
+		std::memcpy(prefix.data() + 4, &metadata_size, 4);
+		file.insert(file.end(), prefix.begin(), prefix.end());
+		file.insert(file.end(), metadata.begin(), metadata.end());
+		file.insert(file.end(), message_body.begin(), message_body.end());
+		return offset;
+	};
+
+	append_message(make_message(message_header_schema, schema, 0), {});
+	auto batch_metadata = make_message(message_header_record_batch, record_batch, body.size());
+	int64_t batch_offset = append_message(batch_metadata, body);
+
+	// End-of-stream marker, then the footer that indexes the record batch.
+	std::vector<uint8_t> end_of_stream(8, 0);
+	std::memcpy(end_of_stream.data(), &continuation_marker, 4);
+	file.insert(file.end(), end_of_stream.begin(), end_of_stream.end());
+
+	std::vector<uint8_t> block(24, 0);
+	int64_t body_length = body.size();
+	int32_t metadata_length = 8 + batch_metadata.size();
+	std::memcpy(block.data(), &batch_offset, 8);
+	std::memcpy(block.data() + 8, &metadata_length, 4);
+	std::memcpy(block.data() + 16, &body_length, 8);
+
+	auto footer = ArrowFlatNode::make_table();
+	footer->scalar<int16_t>(0, metadata_version_v5);
+	footer->child(1, schema);
+	footer->child(2, ArrowFlatNode::make_struct_vector({}, 0));
+	footer->child(3, ArrowFlatNode::make_struct_vector(block, 1));
+	auto footer_bytes = footer->finish();
+	int32_t footer_size = footer_bytes.size();
+
+	file.insert(file.end(), footer_bytes.begin(), footer_bytes.end());
+	file.insert(file.end(), (const uint8_t*) &footer_size, (const uint8_t*) &footer_size + 4);
+	file.insert(file.end(), file_magic, file_magic + 6);
+
+	// Write a temporary file beside path and rename it over path, so readers
+	// that still map the old file keep its contents instead of getting SIGBUS.
+	static std::atomic<uint64_t> saves{0};
+	std::string temporary = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(saves++);
+	{
+		std::ofstream f(temporary, std::ios::binary | std::ios::trunc);
+		if (!f)
+		{
+			std::cout << "Failed to save armor arrow file; Cannot open file: " << temporary << std::endl;
+			return false;
+		}
+		f.write((const char*) file.data(), file.size());
+		f.close();
+		if (!f)
+		{
+			std::cout << "Failed to save armor arrow file; Cannot write file: " << temporary << std::endl;
+			std::remove(temporary.c_str());
+			return false;
+		}
+	}
+	if (std::rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		std::cout << "Failed to save armor arrow file; Cannot replace file: " << path << std::endl;
+		std::remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+// Convenience overload for solver outputs and other ArmorVectors.
+bool save_armor_arrow(const std::string& path, const ArmorVector& armors)
+{
+	return save_armor_arrow(path, ArmorColumns(armors));
+}
+
+
+// Memory-map an Arrow IPC file written by save_armor_arrow (or any writer
+// producing the same schema) and return columns that point into the mapping.
+// Returns nullptr, after printing the reason, on I/O error or unsupported contents.
+std::unique_ptr<ArmorColumns> load_armor_arrow(const std::string& path)
+{
+	using namespace arrow_ipc;
+
+	auto fail = [&](const std::string& reason)
+	{
+		std::cout << "Failed to load armor arrow file " << path << ": " << reason << std::endl;
+		return std::unique_ptr<ArmorColumns>(nullptr);
+	};
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return fail("cannot open file");
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < 8 + 6 + 4)
+	{
+		close(fd);
+		return fail("file too small");
+	}
+	size_t size = info.st_size;
+	void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		return fail("mmap failed");
+	}
+
+	// The mapping lives as long as the columns that point into it.
+	std::shared_ptr<const void> storage(mapped, [size](const void* p) { munmap(const_cast<void*>(p), size); });
+	const uint8_t* data = static_cast<const uint8_t*>(mapped);
+
+	if (std::memcmp(data, file_magic, 6) != 0 || std::memcmp(data + size - 6, file_magic, 6) != 0)
+	{
+		return fail("missing ARROW1 magic");
+	}
+
+	int32_t footer_size;
+	std::memcpy(&footer_size, data + size - 10, 4);
+	if (footer_size <= 0 || size_t(footer_size) > size - 10 - 8)
+	{
+		return fail("bad footer length");
+	}
+	const uint8_t* footer_data = data + size - 10 - footer_size;
+	auto footer = ArrowFlatTable::root(footer_data, footer_size);
+	auto schema = footer.table(1);
+	if (!footer.valid() || !schema.valid())
+	{
+		return fail("malformed footer");
+	}
+
+	// Locate our three columns by name; order is free.
+	size_t fields_begin;
+	uint32_t field_count;
+	if (!schema.vector(1, fields_begin, field_count) || field_count != 3)
+	{
+		return fail("expected exactly 3 columns");
+	}
+	int cost_buffer = -1, defense_buffer = -1, description_buffer = -1;
+	int buffer_index = 0;
+	for (uint32_t i = 0; i < field_count; i++)
+	{
+		auto field = schema.vector_table(fields_begin, i);
+		auto type = field.table(3);
+		std::string name;
+		if (!field.valid() || !field.string(0, name))
+		{
+			return fail("malformed field");
+		}
+		uint8_t type_type = field.scalar<uint8_t>(2, 0);
+		if (name == "cost" && type_type == type_int
+			&& type.scalar<int32_t>(0, 0) == 32 && type.scalar<uint8_t>(1, 0) == 1)
+		{
+			cost_buffer = buffer_index;
+			buffer_index += 2;
+		}
+		else if (name == "defense" && type_type == type_floating_point
+			&& type.scalar<int16_t>(0, 0) == precision_double)
+		{
+			defense_buffer = buffer_index;
+			buffer_index += 2;
+		}
+		else if (name == "description" && type_type == type_utf8)
+		{
+			description_buffer = buffer_index;
+			buffer_index += 3;
+		}
+		else
+		{
+			return fail("unsupported column " + name);
+		}
+	}
+	if (cost_buffer < 0 || defense_buffer < 0 || description_buffer < 0)
+	{
+		return fail("missing cost, defense or description column");
+	}
+
+	size_t blocks_begin;
+	uint32_t block_count;
+	if (!footer.vector(3, blocks_begin, block_count) || block_count > 1)
+	{
+		return fail("expected at most one record batch");
+	}
+	if (block_count == 0)
+	{
+		return std::unique_ptr<ArmorColumns>(new ArmorColumns());
+	}
+
+	int64_t block_offset, block_body_length;
+	int32_t block_metadata_length;
+	if (
+		!footer.read(blocks_begin, block_offset)
+		|| !footer.read(blocks_begin + 8, block_metadata_length)
+		|| !footer.read(blocks_begin + 16, block_body_length)
+		|| block_offset < 8
+		|| block_metadata_length < 8
+		|| block_body_length < 0
+		|| uint64_t(block_offset) + block_metadata_length + block_body_length > size
+	)
+	{
+		return fail("bad record batch block");
+	}
+
+	// Metadata prefix is the continuation marker and the flatbuffer size.
+	const uint8_t* message_data = data + block_offset;
+	uint32_t marker;
+	std::memcpy(&marker, message_data, 4);
+	size_t flatbuffer_offset = marker == continuation_marker ? 8 : 4;
+	auto message = ArrowFlatTable::root(message_data + flatbuffer_offset, block_metadata_length - flatbuffer_offset);
+	auto batch = message.table(2);
+	if (!message.valid() || message.scalar<uint8_t>(1, 0) != message_header_record_batch || !batch.valid())
+	{
+		return fail("malformed record batch message");
+	}
+	if (batch.table(3).valid())
+	{
+		return fail("compressed record batches are not supported");
+	}
+
+	int64_t length = batch.scalar<int64_t>(0, -1);
+	size_t nodes_begin, buffers_begin;
+	uint32_t node_count, buffer_count;
+	if (
+		length < 0
+		|| !batch.vector(1, nodes_begin, node_count) || node_count != 3
+		|| !batch.vector(2, buffers_begin, buffer_count) || buffer_count != 7
+	)
+	{
+		return fail("unexpected record batch layout");
+	}
+	for (uint32_t i = 0; i < node_count; i++)
+	{
+		int64_t node_length, null_count;
+		if (
+			!batch.read(nodes_begin + 16 * i, node_length)
+			|| !batch.read(nodes_begin + 16 * i + 8, null_count)
+			|| node_length != length
+			|| null_count != 0
+		)
+		{
+			return fail("columns must be non-null and of equal length");
+		}
+	}
+
+	const uint8_t* body = message_data + block_metadata_length;
+	std::vector<const uint8_t*> buffers(buffer_count);
+	std::vector<int64_t> buffer_lengths(buffer_count);
+	for (uint32_t i = 0; i < buffer_count; i++)
+	{
+		int64_t offset;
+		if (
+			!batch.read(buffers_begin + 16 * i, offset)
+			|| !batch.read(buffers_begin + 16 * i + 8, buffer_lengths[i])
+			|| offset < 0 || buffer_lengths[i] < 0
+			|| offset + buffer_lengths[i] > block_body_length
+			|| offset % 8 != 0
+		)
+		{
+			return fail("bad buffer");
+		}
+		buffers[i] = body + offset;
+	}
+
+	size_t n = length;
+	const uint8_t* offsets_buffer = buffers[description_buffer + 1];
+	if (
+		size_t(buffer_lengths[cost_buffer + 1]) < n * sizeof(int32_t)
+		|| size_t(buffer_lengths[defense_buffer + 1]) < n * sizeof(double)
+		|| size_t(buffer_lengths[description_buffer + 1]) < (n + 1) * sizeof(int32_t)
+		|| reinterpret_cast<uintptr_t>(body) % 8 != 0
+	)
+	{
+		return fail("column buffers too short or misaligned");
+	}
+
+	// Validate the offsets once, so description() never reads out of range.
+	const int32_t* description_offsets = reinterpret_cast<const int32_t*>(offsets_buffer);
+	const int32_t* costs = reinterpret_cast<const int32_t*>(buffers[cost_buffer + 1]);
+	for (size_t i = 0; i < n; i++)
+	{
+		if (
+			description_offsets[i] < 0
+			|| description_offsets[i + 1] <= description_offsets[i]
+			|| costs[i] <= 0
+		)
+		{
+			return fail("invalid cost or description at row " + std::to_string(i));
+		}
+	}
+	if (n && description_offsets[n] > buffer_lengths[description_buffer + 2])
+	{
+		return fail("description offsets out of range");
+	}
+
+	return std::unique_ptr<ArmorColumns>(
+		new ArmorColumns(
+			storage,
+			n,
+			costs,
+			reinterpret_cast<const double*>(buffers[defense_buffer + 1]),
+			description_offsets,
+			reinterpret_cast<const char*>(buffers[description_buffer + 2])
+		)
+	);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// armorarrow.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,272 @@
+///////////////////////////////////////////////////////////////////////////////
+// armorshm.hh
+//
+// Share one parsed catalog between the solver processes on a host. One
+// process publishes its ArmorColumns into a named POSIX shared-memory segment;
+// the others attach read-only and get columns that point straight into it, so
+// there is one physical copy and nothing to parse at startup.
+//
+// The segment starts with a header giving the layout version, the catalog
+// version chosen by the publisher, and where each column lives. Publishing
+// again fills a fresh segment under a temporary name and renames it over the
+// old one, so the name always refers to a complete catalog; processes already
+// attached keep reading the old one until they attach again.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "maxdefense.hh"
+
+
+namespace armor_shm
+{
+	const char magic[8] = { 'M', 'D', 'S', 'H', 'M', 'C', 'A', 'T' };
+	const uint32_t layout_version = 1;
+
+	// Column offsets are rounded up to this many bytes.
+	const size_t alignment = 64;
+
+	// Start of every segment. ready is set last, so an attacher never sees a
+	// half-written catalog.
+	struct Header
+	{
+		char magic[8];
+		uint32_t layout_version;
+		uint32_t header_size;
+		uint64_t catalog_version;
+		uint64_t size;
+		uint64_t segment_bytes;
+		uint64_t costs_offset;
+		uint64_t defenses_offset;
+		uint64_t description_offsets_offset;
+		uint64_t description_bytes_offset;
+		std::atomic<uint32_t> ready;
+	};
+
+	//
+	size_t align(size_t offset)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	// shm_open wants names of the form "/name".
+	std::string segment_name(const std::string& name)
+	{
+		return name.empty() || name[0] != '/' ? "/" + name : name;
+	}
+
+	// Where Linux keeps shm_open's objects as files, so rename() can swap
+	// one name for another atomically.
+	const char directory[] = "/dev/shm";
+}
+
+
+// Copy catalog into the shared-memory segment called name, tagged with
+// catalog_version, replacing any segment already published under that name.
+// Returns false, after printing the reason, on failure.
+bool publish_armor_shm(const std::string& name, const ArmorColumns& catalog, uint64_t catalog_version)
+{
+	using namespace armor_shm;
+
+	ArmorColumns packed = catalog.packed();
+	size_t size = packed.size();
+	size_t description_bytes = size ? packed.description_offsets()[size] : 0;
+
+	Header layout;
+	layout.costs_offset = align(sizeof(Header));
+	layout.defenses_offset = align(layout.costs_offset + size * sizeof(int32_t));
+	layout.description_offsets_offset = align(layout.defenses_offset + size * sizeof(double));
+	layout.description_bytes_offset = align(layout.description_offsets_offset + (size + 1) * sizeof(int32_t));
+	layout.segment_bytes = layout.description_bytes_offset + description_bytes;
+
+	// Fill a segment under a temporary name and rename it over the real one
+	// once ready: attachers never find the name missing or half-written, and
+	// attached processes keep their mapping of the old segment.
+	static std::atomic<uint64_t> publishes{0};
+	std::string segment = segment_name(name);
+	std::string temporary = segment + ".tmp." + std::to_string(getpid()) + "." + std::to_string(publishes++);
+	int fd = shm_open(temporary.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		std::cout << "Failed to create shared catalog " << temporary << std::endl;
+		return false;
+	}
+	if (ftruncate(fd, layout.segment_bytes) != 0)
+	{
+		std::cout << "Failed to size shared catalog " << temporary << std::endl;
+		close(fd);
+		shm_unlink(temporary.c_str());
+		return false;
+	}
+	void* mapped = mmap(nullptr, layout.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		std::cout << "Failed to map shared catalog " << temporary << std::endl;
+		shm_unlink(temporary.c_str());
+		return false;
+	}
+
+	char* base = static_cast<char*>(mapped);
+	Header* header = new (base) Header;
+	std::memcpy(header->magic, magic, sizeof(magic));
+	header->layout_version = layout_version;
+	header->header_size = sizeof(Header);
+	header->catalog_version = catalog_version;
+	header->size = size;
+	header->segment_bytes = layout.segment_bytes;
+	header->costs_offset = layout.costs_offset;
+	header->defenses_offset = layout.defenses_offset;
+	header->description_offsets_offset = layout.description_offsets_offset;
+	header->description_bytes_offset = layout.description_bytes_offset;
+
+	int32_t no_descriptions = 0;
+	std::memcpy(base + layout.costs_offset, packed.costs(), size * sizeof(int32_t));
+	std::memcpy(base + layout.defenses_offset, packed.defenses(), size * sizeof(double));
+	std::memcpy(base + layout.description_offsets_offset, size ? packed.description_offsets() : &no_descriptions, (size + 1) * sizeof(int32_t));
+	std::memcpy(base + layout.description_bytes_offset, packed.description_bytes(), description_bytes);
+	header->ready.store(1, std::memory_order_release);
+	munmap(mapped, layout.segment_bytes);
+
+	if (std::rename((directory + temporary).c_str(), (directory + segment).c_str()) != 0)
+	{
+		std::cout << "Failed to replace shared catalog " << segment << std::endl;
+		shm_unlink(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+//
+bool publish_armor_shm(const std::string& name, const ArmorVector& catalog, uint64_t catalog_version)
+{
+	return publish_armor_shm(name, ArmorColumns(catalog), catalog_version);
+}
+
+
+// Attach read-only to the catalog published under name; the columns keep the
+// mapping alive. Stores the publisher's catalog version in *catalog_version
+// when given. Returns nullptr, after printing the reason, if there is no
+// complete catalog of this layout version under that name.
+std::unique_ptr<ArmorColumns> attach_armor_shm(const std::string& name, uint64_t* catalog_version = nullptr)
+{
+	using namespace armor_shm;
+
+	std::string segment = segment_name(name);
+	auto fail = [&](const std::string& reason)
+	{
+		std::cout << "Failed to attach shared catalog " << segment << ": " << reason << std::endl;
+		return std::unique_ptr<ArmorColumns>(nullptr);
+	};
+
+	int fd = shm_open(segment.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return fail("no such segment");
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(Header))
+	{
+		close(fd);
+		return fail("segment too small");
+	}
+	size_t bytes = info.st_size;
+	void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		return fail("mmap failed");
+	}
+	std::shared_ptr<const void> storage(mapped, [bytes](const void* p) { munmap(const_cast<void*>(p), bytes); });
+
+	const char* base = static_cast<const char*>(mapped);
+	const Header* header = reinterpret_cast<const Header*>(base);
+	if (std::memcmp(header->magic, magic, sizeof(magic)) != 0)
+	{
+		return fail("not a shared catalog");
+	}
+	if (header->layout_version != layout_version || header->header_size != sizeof(Header))
+	{
+		return fail("unsupported layout version");
+	}
+	if ( ! header->ready.load(std::memory_order_acquire) )
+	{
+		return fail("still being published");
+	}
+	if (header->segment_bytes != bytes || header->description_bytes_offset > bytes)
+	{
+		return fail("truncated segment");
+	}
+
+	// Trust nothing else in the header either: every column must lie inside
+	// the segment, aligned for its type, with sizes checked before they can
+	// overflow.
+	uint64_t size = header->size;
+	auto fits = [&](uint64_t offset, uint64_t element, uint64_t count, size_t align)
+	{
+		return offset % align == 0 && offset <= bytes && count <= (bytes - offset) / element;
+	};
+	if (size >= uint64_t(INT32_MAX)
+		|| ! fits(header->costs_offset, sizeof(int32_t), size, alignof(int32_t))
+		|| ! fits(header->defenses_offset, sizeof(double), size, alignof(double))
+		|| ! fits(header->description_offsets_offset, sizeof(int32_t), size + 1, alignof(int32_t)))
+	{
+		return fail("column outside segment");
+	}
+	const int32_t* offsets = reinterpret_cast<const int32_t*>(base + header->description_offsets_offset);
+	uint64_t description_bytes = bytes - header->description_bytes_offset;
+	if (offsets[0] != 0 || uint64_t(offsets[size]) > description_bytes)
+	{
+		return fail("bad description offsets");
+	}
+	for (uint64_t i = 0; i < size; i++)
+	{
+		if (offsets[i + 1] < offsets[i])
+		{
+			return fail("bad description offsets");
+		}
+	}
+
+	if (catalog_version)
+	{
+		*catalog_version = header->catalog_version;
+	}
+	return std::unique_ptr<ArmorColumns>(new ArmorColumns(
+		storage,
+		header->size,
+		reinterpret_cast<const int32_t*>(base + header->costs_offset),
+		reinterpret_cast<const double*>(base + header->defenses_offset),
+		reinterpret_cast<const int32_t*>(base + header->description_offsets_offset),
+		base + header->description_bytes_offset
+	));
+}
+
+
+// Remove the name; attached processes keep their mapping. False if there was none.
+bool unpublish_armor_shm(const std::string& name)
+{
+	return shm_unlink(armor_shm::segment_name(name).c_str()) == 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// armorshm.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,177 @@
+///////////////////////////////////////////////////////////////////////////////
+// embedcatalog_main.cc
+//
+// Build step for fixed-catalog builds: turns an armor CSV into a header of
+// constexpr column arrays, so a solver can run against static data with no
+// load time at all.
+//
+//    embedcatalog armor.csv armor_embedded.hh
+//
+// The generated header defines, in namespace embedded_armor, the item count,
+// the cost and defense columns, and the packed description pool with its
+// offsets, plus embedded_armor_columns() wrapping them in an ArmorColumns.
+// Defenses are written as hexadecimal floats so they round-trip exactly.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+
+#include "maxdefense.hh"
+
+
+// Write bytes as a C++ string literal, escaping anything that is not plain text.
+void write_literal(std::ostream& out, const char* bytes, size_t size)
+{
+	out << '"';
+	for (size_t i = 0; i < size; i++)
+	{
+		unsigned char c = bytes[i];
+		if (c == '"' || c == '\\')
+		{
+			out << '\\' << c;
+		}
+		else if (c < 0x20 || c >= 0x7f)
+		{
+			// Always three octal digits, so a following digit is not swallowed.
+			char escaped[5];
+			std::snprintf(escaped, sizeof(escaped), "\\%03o", c);
+			out << escaped;
+		}
+		else
+		{
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+
+// Write a comma-separated array body, a fixed number of values per line.
+template <typename Format>
+void write_values(std::ostream& out, size_t count, size_t per_line, Format format)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		out << (i % per_line == 0 ? "\t" : " ");
+		format(i);
+		out << (i + 1 < count ? "," : "");
+		if (i % per_line == per_line - 1 || i + 1 == count)
+		{
+			out << "\n";
+		}
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (argc != 3)
+	{
+		std::cout << "usage: " << argv[0] << " CATALOG.csv OUTPUT.hh" << std::endl;
+		return 1;
+	}
+
+	auto loaded = load_armor_columns(argv[1], DescriptionLoading::eager);
+	if ( ! loaded )
+	{
+		return 1;
+	}
+	ArmorColumns catalog = loaded->packed();
+	size_t size = catalog.size();
+	size_t pool = size ? catalog.description_offsets()[size] : 0;
+
+	std::ofstream out(argv[2]);
+	if ( ! out )
+	{
+		std::cout << "Failed to open " << argv[2] << std::endl;
+		return 1;
+	}
+
+	out
+		<< "// Generated by embedcatalog from " << argv[1] << "; do not edit.\n"
+		<< "\n"
+		<< "\n"
+		<< "#pragma once\n"
+		<< "\n"
+		<< "\n"
+		<< "#include \"maxdefense.hh\"\n"
+		<< "\n"
+		<< "\n"
+		<< "namespace embedded_armor\n"
+		<< "{\n"
+		<< "\n"
+		<< "inline constexpr size_t size = " << size << ";\n"
+		<< "\n"
+		<< "inline constexpr int32_t costs[" << std::max<size_t>(size, 1) << "] =\n"
+		<< "{\n"
+		;
+	write_values(out, size, 16, [&](size_t i) { out << catalog.cost(i); });
+	out
+		<< "};\n"
+		<< "\n"
+		<< "inline constexpr double defenses[" << std::max<size_t>(size, 1) << "] =\n"
+		<< "{\n"
+		;
+	write_values(out, size, 4, [&](size_t i)
+	{
+		char hex[32];
+		std::snprintf(hex, sizeof(hex), "%a", catalog.defense(i));
+		out << hex;
+	});
+	out
+		<< "};\n"
+		<< "\n"
+		<< "inline constexpr int32_t description_offsets[" << size + 1 << "] =\n"
+		<< "{\n"
+		;
+	if (size)
+	{
+		write_values(out, size + 1, 16, [&](size_t i) { out << catalog.description_offsets()[i]; });
+	}
+	else
+	{
+		out << "\t0\n";
+	}
+	out
+		<< "};\n"
+		<< "\n"
+		<< "inline constexpr char description_bytes[] =\n"
+		;
+	const size_t chunk = 96;
+	for (size_t at = 0; at < pool || at == 0; at += chunk)
+	{
+		out << "\t";
+		write_literal(out, catalog.description_bytes() + at, std::min(chunk, pool - at));
+		out << (at + chunk >= pool ? ";\n" : "\n");
+	}
+	out
+		<< "\n"
+		<< "}\n"
+		<< "\n"
+		<< "\n"
+		<< "// The embedded catalog as columns; nothing is copied.\n"
+		<< "inline ArmorColumns embedded_armor_columns()\n"
+		<< "{\n"
+		<< "\treturn ArmorColumns(\n"
+		<< "\t\tnullptr,\n"
+		<< "\t\tembedded_armor::size,\n"
+		<< "\t\tembedded_armor::costs,\n"
+		<< "\t\tembedded_armor::defenses,\n"
+		<< "\t\tembedded_armor::description_offsets,\n"
+		<< "\t\tembedded_armor::description_bytes\n"
+		<< "\t);\n"
+		<< "}\n"
+		;
+
+	if ( ! out )
+	{
+		std::cout << "Failed to write " << argv[2] << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,291 @@
+///////////////////////////////////////////////////////////////////////////////
+// loadgen_main.cc
+//
+// Open-loop load generator: replays a query capture (see querycapture.hh), or
+// synthesizes one, against armor.csv and reports throughput and tail latency.
+//
+// A dispatcher thread issues each query at its arrival time whether or not
+// earlier ones have finished: it hands the query to an idle solver thread, or
+// starts a new one when all are busy, so the number in flight is never capped.
+// Latency counts from the scheduled arrival, so a stalled solver shows up as
+// queueing delay instead of a quietly lowered request rate.
+//
+//    loadgen [--capture FILE] [--synthesize N] [--save FILE]
+//            [--rate QPS] [--poisson] [--concurrency K] [--catalog CSV]
+//
+// --rate 0 (the default with --capture) keeps the captured arrival times.
+// --concurrency is the number of solver threads started up front.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <deque>
+#include <thread>
+#include <vector>
+
+
+#include "maxdefense.hh"
+#include "metrics.hh"
+#include "querycapture.hh"
+
+
+// Random queries shaped like the ones the experiment driver runs.
+std::vector<CapturedQuery> synthesize_queries(size_t count, const ArmorVector& catalog)
+{
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> min_defense(0, 10), max_defense(1000, 2500);
+	std::uniform_int_distribution<int32_t> total_size(20, std::max<int32_t>(20, std::min<size_t>(500, catalog.size())));
+	std::uniform_int_distribution<int32_t> budget(100, 1500);
+
+	uint64_t fingerprint = catalog_fingerprint(catalog);
+	std::vector<CapturedQuery> records(count);
+	for (auto& record : records)
+	{
+		record.query.min_defense = min_defense(random);
+		record.query.max_defense = max_defense(random);
+		record.query.total_size = total_size(random);
+		record.query.budget = budget(random);
+		record.fingerprint = fingerprint;
+	}
+	return records;
+}
+
+
+// Overwrite arrival times with a fixed rate, evenly spaced or as a Poisson process.
+void schedule_arrivals(std::vector<CapturedQuery>& records, double rate, bool poisson)
+{
+	std::mt19937 random(2);
+	std::exponential_distribution<double> gap(rate);
+	double at = 0;
+	for (auto& record : records)
+	{
+		record.arrival_ns = uint64_t(at * 1e9);
+		at += poisson ? gap(random) : 1 / rate;
+	}
+}
+
+
+//
+void print_percentiles(const char* label, const LatencyHistogram& histogram)
+{
+	std::cout
+		<< label
+		<< "  p50 " << std::setw(9) << histogram.percentile(0.5) / 1e3
+		<< "  p99 " << std::setw(9) << histogram.percentile(0.99) / 1e3
+		<< "  p99.9 " << std::setw(9) << histogram.percentile(0.999) / 1e3
+		<< "  max " << std::setw(9) << histogram.percentile(1) / 1e3
+		<< "  us" << std::endl
+		;
+}
+
+
+int main(int argc, char* argv[])
+{
+	std::string capture_path, save_path, catalog_path = "armor.csv";
+	size_t synthesize = 0;
+	double rate = -1;
+	bool poisson = false;
+	unsigned concurrency = 4;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (std::strcmp(argv[i], "--capture") == 0 && has_value)
+		{
+			capture_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--synthesize") == 0 && has_value)
+		{
+			synthesize = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--save") == 0 && has_value)
+		{
+			save_path = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--rate") == 0 && has_value)
+		{
+			rate = std::strtod(argv[++i], nullptr);
+		}
+		else if (std::strcmp(argv[i], "--poisson") == 0)
+		{
+			poisson = true;
+		}
+		else if (std::strcmp(argv[i], "--concurrency") == 0 && has_value)
+		{
+			concurrency = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--catalog") == 0 && has_value)
+		{
+			catalog_path = argv[++i];
+		}
+		else
+		{
+			std::cout
+				<< "usage: " << argv[0] << " [--capture FILE] [--synthesize N] [--save FILE]" << std::endl
+				<< "       [--rate QPS] [--poisson] [--concurrency K] [--catalog CSV]" << std::endl
+				;
+			return 1;
+		}
+	}
+
+	auto catalog = load_armor_database(catalog_path);
+	if ( ! catalog )
+	{
+		return 1;
+	}
+
+	// The queries to replay, and when each one arrives.
+	std::vector<CapturedQuery> records;
+	if ( ! capture_path.empty() )
+	{
+		auto loaded = load_query_capture(capture_path);
+		if ( ! loaded )
+		{
+			return 1;
+		}
+		records = std::move(*loaded);
+	}
+	else
+	{
+		records = synthesize_queries(synthesize ? synthesize : 2000, *catalog);
+		if (rate < 0)
+		{
+			rate = 100;
+		}
+	}
+	if (rate > 0)
+	{
+		schedule_arrivals(records, rate, poisson);
+	}
+	if ( ! save_path.empty() && ! save_query_capture(save_path, records) )
+	{
+		return 1;
+	}
+	if (records.empty())
+	{
+		std::cout << "No queries to replay" << std::endl;
+		return 0;
+	}
+
+	// Captures are written as queries finish, so concurrent ones can be out of
+	// arrival order; the dispatcher issues them in arrival order.
+	std::stable_sort(records.begin(), records.end(), [](const CapturedQuery& a, const CapturedQuery& b)
+	{
+		return a.arrival_ns < b.arrival_ns;
+	});
+
+	uint64_t fingerprint = catalog_fingerprint(*catalog);
+	size_t mismatched = 0;
+	for (auto& record : records)
+	{
+		mismatched += record.fingerprint != fingerprint;
+	}
+	if (mismatched)
+	{
+		std::cout << "warning: " << mismatched << " queries were captured against a different catalog" << std::endl;
+	}
+
+	// Solver threads answer issued queries; one more starts whenever a query
+	// is issued while every thread is busy.
+	LatencyHistogram latency, service, issue_lag;
+	std::mutex mutex;
+	std::condition_variable issued;
+	std::deque<size_t> pending;
+	size_t idle = 0;
+	bool dispatched = false;
+	std::vector<std::thread> workers;
+	auto start = std::chrono::steady_clock::now();
+	auto solver = [&]()
+	{
+		DynamicOptions options;
+		options.workspace = &SolverWorkspace::this_thread();
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			idle++;
+			issued.wait(lock, [&]() { return ! pending.empty() || dispatched; });
+			idle--;
+			if (pending.empty())
+			{
+				return;
+			}
+			size_t i = pending.front();
+			pending.pop_front();
+			lock.unlock();
+
+			auto arrival = start + std::chrono::nanoseconds(records[i].arrival_ns);
+			auto begun = std::chrono::steady_clock::now();
+			answer_defense_query(*catalog, records[i].query, options);
+			latency.record_since(arrival);
+			service.record_since(begun);
+			lock.lock();
+		}
+	};
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (unsigned w = 0; w < concurrency; w++)
+		{
+			workers.emplace_back(solver);
+		}
+	}
+
+	// Dispatcher: this thread, sleeping until each arrival.
+	size_t late = 0;
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		auto arrival = start + std::chrono::nanoseconds(records[i].arrival_ns);
+		std::this_thread::sleep_until(arrival);
+		issue_lag.record_since(arrival);
+		if (std::chrono::steady_clock::now() - arrival > std::chrono::milliseconds(1))
+		{
+			late++;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back(i);
+		if (pending.size() > idle)
+		{
+			workers.emplace_back(solver);
+		}
+		else
+		{
+			issued.notify_one();
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		dispatched = true;
+	}
+	issued.notify_all();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	// Sorted, so the last arrival is the latest.
+	double offered = records.back().arrival_ns ? records.size() / (records.back().arrival_ns * 1e-9) : 0;
+
+	std::cout
+		<< "*** Open-loop replay, " << records.size() << " queries, " << workers.size() << " solver threads ***" << std::endl
+		<< "offered rate          " << std::fixed << std::setprecision(1) << offered << " queries/s" << std::endl
+		<< "throughput            " << records.size() / elapsed << " queries/s" << std::endl
+		<< "elapsed               " << std::setprecision(3) << elapsed << " s" << std::endl
+		<< std::setprecision(1)
+		;
+	print_percentiles("latency (from arrival)", latency);
+	print_percentiles("service time          ", service);
+	print_percentiles("issue lag             ", issue_lag);
+	std::cout << "issued over 1 ms late " << late << std::endl;
+
+	return 0;
+}
@@ -10,17 +10,38 @@
 #pragma once
 
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "metrics.hh"
+#include "singleflight.hh"
+
 
 // One armor item available for purchase.
 class ArmorItem
@@ -67,6 +88,212 @@ class ArmorItem
 typedef std::vector<std::shared_ptr<ArmorItem>> ArmorVector;
 
 
+// How ArmorColumns' description_offsets index its description_bytes.
+enum class DescriptionLayout
+{
+	// Arrow string layout: n + 1 offsets, description i is the bytes
+	// [description_offsets[i], description_offsets[i + 1]).
+	packed,
+
+	// n offsets into raw CSV text: description i starts at description_offsets[i]
+	// and runs up to the next '^' field separator. Decoded only on demand.
+	delimited
+};
+
+
+// Column-oriented, read-only copy of an armor catalog.
+// Costs and defenses are each one contiguous array, which is all the solvers need to scan.
+// Descriptions are laid out as described by DescriptionLayout.
+// The arrays either live in buffers owned by this object, or in external memory
+// (e.g. a memory-mapped file) that the storage handle keeps alive.
+class ArmorColumns
+{
+	//
+	public:
+
+		// Empty catalog.
+		ArmorColumns()
+			:
+			_size(0),
+			_costs(nullptr),
+			_defenses(nullptr),
+			_description_offsets(nullptr),
+			_description_bytes(nullptr),
+			_layout(DescriptionLayout::packed),
+			_version(next_version())
+		{}
+
+		// Copy every item of armors into freshly allocated columns.
+		explicit ArmorColumns(const ArmorVector& armors)
+			:
+			ArmorColumns()
+		{
+			auto buffers = std::make_shared<OwnedBuffers>();
+			buffers->costs.reserve(armors.size());
+			buffers->defenses.reserve(armors.size());
+			buffers->description_offsets.reserve(armors.size() + 1);
+			buffers->description_offsets.push_back(0);
+
+			for (auto& armor : armors)
+			{
+				buffers->costs.push_back(armor->cost());
+				buffers->defenses.push_back(armor->defense());
+				buffers->description_bytes += armor->description();
+				buffers->description_offsets.push_back(buffers->description_bytes.size());
+			}
+
+			_size = armors.size();
+			_costs = buffers->costs.data();
+			_defenses = buffers->defenses.data();
+			_description_offsets = buffers->description_offsets.data();
+			_description_bytes = buffers->description_bytes.data();
+			_storage = buffers;
+		}
+
+		// Wrap columns that live in external memory; storage is held for as long as
+		// this object (or any copy of it) is alive. No data is copied.
+		ArmorColumns
+		(
+			std::shared_ptr<const void> storage,
+			size_t size,
+			const int32_t* costs,
+			const double* defenses,
+			const int32_t* description_offsets,
+			const char* description_bytes,
+			DescriptionLayout layout = DescriptionLayout::packed
+		)
+			:
+			_storage(storage),
+			_size(size),
+			_costs(costs),
+			_defenses(defenses),
+			_description_offsets(description_offsets),
+			_description_bytes(description_bytes),
+			_layout(layout),
+			_version(next_version())
+		{
+			assert(size == 0 || (costs && defenses && description_offsets && description_bytes));
+		}
+
+		//
+		size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+		const int32_t* costs() const { return _costs; }
+		const double* defenses() const { return _defenses; }
+		const int32_t* description_offsets() const { return _description_offsets; }
+		const char* description_bytes() const { return _description_bytes; }
+		DescriptionLayout layout() const { return _layout; }
+
+		// Identifies these costs and defenses for caches such as CatalogOrderCache.
+		// Every constructed catalog gets a new version, unique in the process;
+		// copies, and packed(), keep it. Columns never change in place, so a
+		// changed catalog is a new object with a new version.
+		uint64_t version() const { return _version; }
+
+		//
+		int cost(size_t i) const { assert(i < _size); return _costs[i]; }
+		double defense(size_t i) const { assert(i < _size); return _defenses[i]; }
+		std::string description(size_t i) const
+		{
+			assert(i < _size);
+			const char* begin = _description_bytes + _description_offsets[i];
+			if (_layout == DescriptionLayout::delimited)
+			{
+				return std::string(begin, static_cast<const char*>(std::strchr(begin, '^')));
+			}
+			return std::string(begin, _description_offsets[i + 1] - _description_offsets[i]);
+		}
+
+		// Materialize row i as a standalone ArmorItem.
+		std::shared_ptr<ArmorItem> item(size_t i) const
+		{
+			return std::shared_ptr<ArmorItem>(new ArmorItem(description(i), cost(i), defense(i)));
+		}
+
+		// Materialize the given rows, in the given order.
+		std::unique_ptr<ArmorVector> select(const std::vector<size_t>& indices) const
+		{
+			std::unique_ptr<ArmorVector> result(new ArmorVector);
+			result->reserve(indices.size());
+			for (size_t i : indices)
+			{
+				result->push_back(item(i));
+			}
+			return result;
+		}
+
+		// These columns with descriptions in the packed layout; decodes every
+		// description if they are delimited, otherwise shares the same storage.
+		ArmorColumns packed() const
+		{
+			if (_layout == DescriptionLayout::packed)
+			{
+				return *this;
+			}
+
+			auto buffers = std::make_shared<OwnedBuffers>();
+			buffers->description_offsets.reserve(_size + 1);
+			buffers->description_offsets.push_back(0);
+			for (size_t i = 0; i < _size; i++)
+			{
+				buffers->description_bytes += description(i);
+				buffers->description_offsets.push_back(buffers->description_bytes.size());
+			}
+
+			// Costs and defenses stay where they are; keep their storage alive too.
+			buffers->parent = _storage;
+			ArmorColumns result(*this);
+			result._description_offsets = buffers->description_offsets.data();
+			result._description_bytes = buffers->description_bytes.data();
+			result._layout = DescriptionLayout::packed;
+			result._storage = buffers;
+			return result;
+		}
+
+		// Materialize every row.
+		std::unique_ptr<ArmorVector> to_armor_vector() const
+		{
+			std::vector<size_t> all(_size);
+			for (size_t i = 0; i < _size; i++)
+			{
+				all[i] = i;
+			}
+			return select(all);
+		}
+
+	//
+	private:
+
+		// Column buffers for catalogs built in memory.
+		struct OwnedBuffers
+		{
+			std::vector<int32_t> costs;
+			std::vector<double> defenses;
+			std::vector<int32_t> description_offsets;
+			std::string description_bytes;
+			std::shared_ptr<const void> parent;
+		};
+
+		// Keeps whatever backs the column pointers alive.
+		std::shared_ptr<const void> _storage;
+
+		size_t _size;
+		const int32_t* _costs;
+		const double* _defenses;
+		const int32_t* _description_offsets;
+		const char* _description_bytes;
+		DescriptionLayout _layout;
+		uint64_t _version;
+
+		//
+		static uint64_t next_version()
+		{
+			static std::atomic<uint64_t> counter(0);
+			return ++counter;
+		}
+};
+
+
 // Load all the valid armor items from the CSV database
 // Armor items that are missing fields, or have invalid values, are skipped.
 // Returns nullptr on I/O error.
@@ -155,6 +382,199 @@ std::unique_ptr<ArmorVector> load_armor_database(const std::string& path)
 }
 
 
+// Whether load_armor_columns decodes descriptions up front.
+enum class DescriptionLoading
+{
+	// Copy every description into packed columns while loading.
+	eager,
+
+	// Keep the file memory-mapped and record where each description starts;
+	// a description is only decoded when an item is printed or returned.
+	lazy
+};
+
+
+// A whole file mapped read-only; unmapped when the last reference goes.
+struct MappedFile
+{
+	const char* data = nullptr;
+	size_t size = 0;
+
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		if (size)
+		{
+			munmap(const_cast<char*>(data), size);
+		}
+	}
+};
+
+
+// Map the file at path; nullptr if it cannot be opened or mapped. An empty
+// file gives an empty mapping.
+std::shared_ptr<MappedFile> map_file(const std::string& path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+	struct stat info;
+	auto mapped = std::make_shared<MappedFile>();
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	if (info.st_size > 0)
+	{
+		void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			return nullptr;
+		}
+		mapped->data = static_cast<const char*>(data);
+		mapped->size = info.st_size;
+	}
+	close(fd);
+	return mapped;
+}
+
+
+// strtod on the field [begin, end); true if it starts with a number, and
+// value 0 otherwise. The field is copied out first, since a mapped file has no
+// terminating NUL.
+bool parse_csv_number(const char* begin, const char* end, double& value)
+{
+	char field[64];
+	size_t length = std::min<size_t>(end - begin, sizeof(field) - 1);
+	std::memcpy(field, begin, length);
+	field[length] = 0;
+	char* parsed;
+	value = std::strtod(field, &parsed);
+	return parsed != field;
+}
+
+
+// Load the CSV database straight into columns, parsing only the cost and defense
+// fields of each row; descriptions are handled according to loading. The file
+// is memory-mapped rather than read: eager mode copies only the descriptions
+// out of it, and lazy mode keeps the mapping as the description buffer.
+// Follows load_armor_database: nullptr on I/O error or on a row with the wrong
+// field count, and a number that does not parse reads as 0. One difference:
+// rows with an empty description or costing less than 1 gold are skipped,
+// where load_armor_database builds an ArmorItem that asserts on them.
+std::unique_ptr<ArmorColumns> load_armor_columns
+(
+	const std::string& path,
+	DescriptionLoading loading = DescriptionLoading::lazy
+)
+{
+	std::unique_ptr<ArmorColumns> failure(nullptr);
+
+	std::shared_ptr<MappedFile> file = map_file(path);
+	if (!file)
+	{
+		std::cout << "Failed to load armor database; Cannot open file: " << path << std::endl;
+		return failure;
+	}
+	if (file->size > size_t(INT32_MAX))
+	{
+		std::cout << "Failed to load armor database; File too large: " << path << std::endl;
+		return failure;
+	}
+
+	struct Buffers
+	{
+		std::shared_ptr<MappedFile> file;
+		std::vector<int32_t> costs;
+		std::vector<double> defenses;
+		std::vector<int32_t> description_offsets;
+		std::string description_bytes;
+	};
+	auto buffers = std::make_shared<Buffers>();
+
+	bool lazy = loading == DescriptionLoading::lazy;
+	if (!lazy)
+	{
+		buffers->description_offsets.push_back(0);
+	}
+
+	const char* text = file->data;
+	const char* text_end = text + file->size;
+	size_t line_number = 0;
+	for (const char* line = text; line < text_end; )
+	{
+		const char* line_end = static_cast<const char*>(std::memchr(line, '\n', text_end - line));
+		if (!line_end)
+		{
+			line_end = text_end;
+		}
+		line_number++;
+
+		// First line is a header row
+		if (line_number > 1)
+		{
+			const char* first_caret = static_cast<const char*>(std::memchr(line, '^', line_end - line));
+			const char* second_caret = first_caret ? static_cast<const char*>(std::memchr(first_caret + 1, '^', line_end - first_caret - 1)) : nullptr;
+			const char* third_caret = second_caret ? static_cast<const char*>(std::memchr(second_caret + 1, '^', line_end - second_caret - 1)) : nullptr;
+			if (!second_caret || third_caret)
+			{
+				std::cout
+					<< "Failed to load armor database: Invalid field count at line " << line_number << "; Want 3" << std::endl
+					<< "Line: " << std::string(line, line_end) << std::endl
+					;
+				return failure;
+			}
+
+			double cost_gold, defense_points;
+			parse_csv_number(first_caret + 1, second_caret, cost_gold);
+			parse_csv_number(second_caret + 1, line_end, defense_points);
+			if (first_caret > line && cost_gold >= 1)
+			{
+				buffers->costs.push_back(cost_gold);
+				buffers->defenses.push_back(defense_points);
+				if (lazy)
+				{
+					buffers->description_offsets.push_back(line - text);
+				}
+				else
+				{
+					buffers->description_bytes.append(line, first_caret);
+					buffers->description_offsets.push_back(buffers->description_bytes.size());
+				}
+			}
+		}
+
+		line = line_end + 1;
+	}
+
+	// Lazy mode reads descriptions back from the mapping on demand; eager
+	// mode is done with it.
+	if (lazy)
+	{
+		buffers->file = file;
+	}
+
+	return std::unique_ptr<ArmorColumns>(
+		new ArmorColumns(
+			buffers,
+			buffers->costs.size(),
+			buffers->costs.data(),
+			buffers->defenses.data(),
+			buffers->description_offsets.data(),
+			lazy ? text : buffers->description_bytes.data(),
+			lazy ? DescriptionLayout::delimited : DescriptionLayout::packed
+		)
+	);
+}
+
+
 // Convenience function to compute the total cost and defense in an ArmorVector.
 // Provide the ArmorVector as the first argument
 // The next two arguments will return the cost and defense back to the caller.
@@ -283,120 +703,1745 @@ double max(double a, double b)
 }
 
 
-// Compute the optimal set of armor items with a dynamic algorithm.
-// Specifically, among the armor items that fit within a total_cost gold budget,
-// choose the selection of armors whose defense is greatest.
-// Repeat until no more armor items can be chosen, either because we've run out of armor items,
-// or run out of gold.
-std::unique_ptr<ArmorVector> dynamic_max_defense
-(
-	const ArmorVector& armors,
-	int total_cost
-)
+// Scratch memory for the DP engines, kept between calls so a stream of queries
+// does not allocate and zero a fresh table each time. Buffers only grow and are
+// handed out uninitialized; each engine writes every cell before reading it.
+// A workspace serves one call at a time, so give each thread its own.
+class SolverWorkspace
 {
-	//double value_above, value_offset;
-	int total_size = armors.size();
+	//
+	public:
 
-	//Use to set default value of matrix of
-	std::vector<double> itemSub(total_cost + 1, 0);
+		//
+		SolverWorkspace() {}
 
-	//Fill constructor to initialize 2-D vector with given value
-	std::vector<std::vector<double>> table(total_size + 1, itemSub);
+		SolverWorkspace(const SolverWorkspace&) = delete;
+		SolverWorkspace& operator=(const SolverWorkspace&) = delete;
 
-	//set initials past row 0, col 0 to negative infinity
-	for (int i = 1; i <= total_size; i++)
-	{
-		for (int j = 1; j <= total_cost; j++)
+		// DP table cells: the whole table, or the checkpoints.
+		double* table(size_t count) { return reserve(_table, _table_capacity, count); }
+
+		// Working DP rows.
+		double* rows(size_t count) { return reserve(_rows, _rows_capacity, count); }
+
+		// Item costs and defenses gathered out of an ArmorVector.
+		int32_t* costs(size_t count) { return reserve(_costs, _costs_capacity, count); }
+		double* defenses(size_t count) { return reserve(_defenses, _defenses_capacity, count); }
+
+		// Item indices, for engines that permute items instead of DP cells.
+		uint32_t* indices(size_t count) { return reserve(_indices, _indices_capacity, count); }
+
+		// Bytes currently held.
+		size_t capacity_bytes() const
 		{
-			table[i][j] = -999999;		
+			return (_table_capacity + _rows_capacity + _defenses_capacity) * sizeof(double)
+				+ _costs_capacity * sizeof(int32_t) + _indices_capacity * sizeof(uint32_t);
 		}
-	}
 
-	//Enter Armor values into Table
-	for (int i = 1; i <= total_size; i++) 
-	{
-		for (int j = 1; j <= total_cost; j++) 
+		// Hand all buffers back to the allocator.
+		void release()
 		{
-			
-			//With max funct: implement psuedocode, X and V subscript i needs offset -1 for correct input
-			//Check J-1 != negative if negative set to above value
+			_table.reset();
+			_rows.reset();
+			_costs.reset();
+			_defenses.reset();
+			_indices.reset();
+			_table_capacity = _rows_capacity = _costs_capacity = _defenses_capacity = _indices_capacity = 0;
+		}
 
-			if (j - armors.at(i - 1)->cost() > 0) {
-				table[i][j] = max(table[i - 1][j], table[i - 1][j - armors.at(i - 1)->cost()] + armors.at(i - 1)->defense());
-			}
-			else
+		// The calling thread's own workspace, for callers without one to hand.
+		static SolverWorkspace& this_thread()
+		{
+			static thread_local SolverWorkspace workspace;
+			return workspace;
+		}
+
+	//
+	private:
+
+		// Grow buf to at least count elements; old contents are not kept.
+		template <typename T>
+		static T* reserve(std::unique_ptr<T[]>& buf, size_t& capacity, size_t count)
+		{
+			if (count > capacity)
 			{
-				table[i][j] = table[i - 1][j];
+				// Grow geometrically so a slowly rising query size reallocates rarely.
+				capacity = std::max(count, capacity + capacity / 2);
+				buf.reset(new T[capacity]);
 			}
-
+			return buf.get();
 		}
-	}
 
+		std::unique_ptr<double[]> _table, _rows, _defenses;
+		std::unique_ptr<int32_t[]> _costs;
+		std::unique_ptr<uint32_t[]> _indices;
+		size_t _table_capacity = 0, _rows_capacity = 0, _costs_capacity = 0, _defenses_capacity = 0, _indices_capacity = 0;
+};
 
 
-	//Vector to hold Chosen subset
-	std::unique_ptr<ArmorVector> choice(new ArmorVector);
+// How dynamic_max_defense recovers the chosen items once the best defense is known.
+enum class ReconstructionStrategy
+{
+	// Keep every DP row and backtrack through them; (n + 1) * (B + 1) cells of memory.
+	full_table,
 
-	int horz = total_cost;
+	// Keep only every sqrt(n)-th row during the forward pass, then recompute one
+	// segment of rows at a time while backtracking; O(sqrt(n) * B) memory and
+	// about twice the row updates. Picks exactly the same items as full_table.
+	checkpointed,
 
-	for (int i = armors.size(); i > 0; i--)
-	{
-		//tablevalue!=0
-		if (table[i][horz] !=0) {
-			//Value is either from Above or Above&C squares to the left
-			//IF checks if NOT above which assumes is Above&C squares to the left
-			if (table[i][horz] != table[i - 1][horz]) {
+	// Split the items in half, find the budget split from a forward and a
+	// backward row, and recurse; O(B) memory and about twice the row updates.
+	divide_and_conquer
+};
 
-				//Change Value of columns to C squares to the left
-				horz -= armors.at(i - 1)->cost();
-				choice->push_back(armors.at(i - 1));
-			}
 
-		}
+// Counters filled in by dynamic_max_defense when DynamicOptions::stats is set.
+struct DynamicStats
+{
+	// Peak number of DP rows (of total_cost + 1 cells each) held at once.
+	size_t rows_stored = 0;
+
+	// Number of DP cells computed, including recomputation.
+	size_t cells_computed = 0;
+
+	// Cells in the classic n x total_cost table, for comparison.
+	size_t cells_full_table = 0;
+
+	// Share of the classic table's cells that were actually computed.
+	double fraction_computed() const
+	{
+		return cells_full_table ? double(cells_computed) / cells_full_table : 0;
 	}
+};
 
-	return choice;
+
+// Tuning knobs for dynamic_max_defense; the defaults reproduce the classic algorithm.
+struct DynamicOptions
+{
+	ReconstructionStrategy reconstruction = ReconstructionStrategy::full_table;
+
+	// Only compute the columns of each row that can matter: row i never needs
+	// budgets above the first i items' total cost (all of them fit there), and
+	// backtracking never visits budgets below total_cost minus the later items'
+	// total cost. Picks exactly the same items. Applies to full_table only.
+	// Pays off when the windows are narrow (few items or large budgets); on
+	// the whole catalog they skip only a few percent of cells, and it runs
+	// within about 10% of the plain table.
+	bool bound_columns = false;
+
+	// With bound_columns, reorder the items cheapest-at-both-ends so the windows
+	// stay narrow at the start and the end of the table. The chosen set may then
+	// differ on ties, and comes back in the new order.
+	bool order_for_windows = false;
+
+	// Optional; receives counters for this call.
+	DynamicStats* stats = nullptr;
+
+	// Optional; scratch buffers reused across calls. Without one, each call
+	// allocates its own and frees them on return.
+	SolverWorkspace* workspace = nullptr;
+
+	// Optional; receives the solve latency, labelled with dynamic_engine_name,
+	// which also counts the query, and the cells computed.
+	SolverMetrics* metrics = nullptr;
+
+	// With metrics, also time the gather and select phases around the solve.
+	// Off by default: each timed phase costs two clock reads per query.
+	bool phase_metrics = false;
+};
+
+
+// Timed phases of dynamic_max_defense.
+enum class DynamicPhase
+{
+	solve,
+	gather,
+	select,
+};
+
+
+// Engine of a dynamic_max_defense call with these options, numbered from 0.
+size_t dynamic_engine_index(const DynamicOptions& options)
+{
+	switch (options.reconstruction)
+	{
+		case ReconstructionStrategy::checkpointed:
+			return 2;
+		case ReconstructionStrategy::divide_and_conquer:
+			return 3;
+		case ReconstructionStrategy::full_table:
+		default:
+			return options.bound_columns ? 1 : 0;
+	}
 }
 
 
+// Engine label for the metrics of a dynamic_max_defense call with these options.
+const char* dynamic_engine_name(const DynamicOptions& options)
+{
+	static const char* const names[] = { "full_table", "windowed_table", "checkpointed", "divide_and_conquer" };
+	return names[dynamic_engine_index(options)];
+}
 
 
+// Histogram for one phase of a call with these options, or nullptr when the
+// phase is not recorded. Each (engine, phase) pair has its own metrics slot,
+// so this costs no string comparisons.
+LatencyHistogram* dynamic_phase_histogram(const DynamicOptions& options, DynamicPhase phase)
+{
+	if ( ! options.metrics || (phase != DynamicPhase::solve && ! options.phase_metrics) )
+	{
+		return nullptr;
+	}
+	static const char* const names[] = { "solve", "gather", "select" };
+	size_t slot = dynamic_engine_index(options) * 3 + size_t(phase);
+	return &options.metrics->histogram(slot, dynamic_engine_name(options), names[size_t(phase)]);
+}
 
-   //print_2d_cache(table);
-   //std::cout<<"\nlast val:"<<table[total_size][total_cost]<<std::endl;
 
+// Compute one DP row from the row above it, for an item of the given cost and defense.
+// row[j] is the best defense reachable with a budget of j gold.
+void dynamic_fill_row
+(
+	const double* above,
+	double* row,
+	int total_cost,
+	int cost,
+	double defense
+)
+{
+	row[0] = above[0];
+	for (int j = 1; j <= total_cost; j++)
+	{
+		//Item fits when it costs no more than column j; otherwise take the value above
+		if (j - cost >= 0) {
+			row[j] = max(above[j], above[j - cost] + defense);
+		}
+		else
+		{
+			row[j] = above[j];
+		}
+	}
+}
 
 
-// Compute the optimal set of armor items with an exhaustive search algorithm.
-// Specifically, among all subsets of armor items,
-// return the subset whose gold cost fits within the total_cost budget,
-// and whose total defense is greatest.
-// To avoid overflow, the size of the armor items vector must be less than 64.
-std::unique_ptr<ArmorVector> exhaustive_max_defense
+// Backtrack from row last down to row first of a table whose row r holds DP row
+// (first + r), width cells per row, appending chosen item indices and moving
+// horz left past each one.
+void dynamic_backtrack
 (
-	const ArmorVector& armors,
-	double total_cost
+	const double* rows,
+	size_t width,
+	const int32_t* costs,
+	size_t first,
+	size_t last,
+	int& horz,
+	std::vector<size_t>& choice
 )
 {
-	std::unique_ptr<ArmorVector> bestset(new ArmorVector());
+	for (size_t i = last; i > first; i--)
+	{
+		const double* row = rows + (i - first) * width;
+		const double* above = row - width;
 
-     int budget = 0;
-     double cdefense = 0;
-     double bestdefense = 0;
+		//tablevalue!=0
+		if (row[horz] != 0) {
+			//Value is either from Above or Above&C squares to the left
+			//IF checks if NOT above which assumes is Above&C squares to the left
+			if (row[horz] != above[horz]) {
 
-     const int n = armors.size();
+				//Change Value of columns to C squares to the left
+				horz -= costs[i - 1];
+				choice.push_back(i - 1);
+			}
 
-     assert(n < 64);
+		}
+	}
+}
 
-     // the size of a power set is 2^amount of items in the list
-     int subsetAmt = pow(2, n);
 
-     //Outer For loop runs for Amount of subsets being made
+// ReconstructionStrategy::full_table
+std::vector<size_t> dynamic_full_table
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t n,
+	int total_cost,
+	SolverWorkspace& workspace,
+	DynamicStats& stats
+)
+{
+	size_t width = std::max(total_cost, 0) + 1;
 
-     //First Inner forloop runs for the amount of objects in each set
-     for (int index = 0; index < subsetAmt; index++)
-     {
-         std::unique_ptr<ArmorVector> candidate(new ArmorVector());
+	// One block of (n + 1) rows; only row 0 needs initializing, every later
+	// row is written in full from the one above it.
+	double* table = workspace.table((n + 1) * width);
+	std::fill(table, table + width, 0.0);
+
+	//Enter Armor values into Table; X and V subscript i needs offset -1 for correct input
+	for (size_t i = 1; i <= n; i++)
+	{
+		dynamic_fill_row(table + (i - 1) * width, table + i * width, total_cost, costs[i - 1], defenses[i - 1]);
+	}
+
+	stats.rows_stored = n + 1;
+	stats.cells_computed += n * total_cost;
+
+	//Indices of the chosen subset
+	std::vector<size_t> choice;
+	int horz = total_cost;
+	dynamic_backtrack(table, width, costs, 0, n, horz, choice);
+	return choice;
+}
+
+
+// ReconstructionStrategy::full_table with DynamicOptions::bound_columns.
+// Row i only stores columns [low[i], high[i]]; columns above high[i] read as
+// high[i], which holds the same value since every item so far fits there.
+std::vector<size_t> dynamic_windowed_table
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t n,
+	int total_cost,
+	bool order_for_windows,
+	SolverWorkspace& workspace,
+	DynamicStats& stats
+)
+{
+	// order[i] is the item processed as row i + 1.
+	std::vector<size_t> order(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		order[i] = i;
+	}
+	if (order_for_windows)
+	{
+		std::vector<size_t> by_cost(order);
+		std::stable_sort(by_cost.begin(), by_cost.end(), [&](size_t a, size_t b) { return costs[a] < costs[b]; });
+		size_t front = 0, back = n;
+		for (size_t k = 0; k < n; k++)
+		{
+			if (k % 2 == 0)
+			{
+				order[front++] = by_cost[k];
+			}
+			else
+			{
+				order[--back] = by_cost[k];
+			}
+		}
+	}
+
+	// prefix[i]: cost of rows 1..i; suffix: cost of rows i+1..n.
+	std::vector<int64_t> prefix(n + 1, 0);
+	for (size_t i = 1; i <= n; i++)
+	{
+		prefix[i] = prefix[i - 1] + costs[order[i - 1]];
+	}
+
+	// Row i's window starts at start[i] in one block of all windows.
+	std::vector<int> low(n + 1), high(n + 1);
+	std::vector<size_t> start(n + 2, 0);
+	for (size_t i = 0; i <= n; i++)
+	{
+		int64_t suffix = prefix[n] - prefix[i];
+		high[i] = std::min<int64_t>(total_cost, prefix[i]);
+		low[i] = std::min<int64_t>(std::max<int64_t>(0, total_cost - suffix), high[i]);
+		start[i + 1] = start[i] + (high[i] - low[i] + 1);
+	}
+
+	double* table = workspace.table(start[n + 1]);
+	auto value = [&](size_t i, int j)
+	{
+		return table[start[i] + std::min(j, high[i]) - low[i]];
+	};
+
+	std::fill(table, table + start[1], 0.0);
+	for (size_t i = 1; i <= n; i++)
+	{
+		int cost = costs[order[i - 1]];
+		double defense = defenses[order[i - 1]];
+
+		// Both rows indexed by column. Row i's window never starts left of
+		// row i - 1's, and j - cost never lands right of it, so only reads
+		// of j itself above the previous window need clamping, and those
+		// all see its last cell.
+		const double* above = table + start[i - 1] - low[i - 1];
+		double* row = table + start[i] - low[i];
+		double top = above[high[i - 1]];
+		int first = std::max(low[i], 1);
+		int last = high[i];
+		int direct = std::min(last, high[i - 1]);
+		int fits = std::max(first, cost);
+		if (low[i] == 0)
+		{
+			row[0] = 0;
+		}
+
+		// Columns the item does not fit in.
+		for (int j = first; j <= std::min(fits - 1, direct); j++)
+		{
+			row[j] = above[j];
+		}
+		for (int j = std::max(first, direct + 1); j <= std::min(fits - 1, last); j++)
+		{
+			row[j] = top;
+		}
+
+		// Columns it fits in.
+		for (int j = fits; j <= direct; j++)
+		{
+			row[j] = max(above[j], above[j - cost] + defense);
+		}
+		for (int j = std::max(fits, direct + 1); j <= last; j++)
+		{
+			row[j] = max(top, above[j - cost] + defense);
+		}
+		stats.cells_computed += high[i] - std::max(low[i], 1) + 1;
+	}
+	stats.rows_stored = n + 1;
+
+	// Same rule as dynamic_backtrack, through the windows.
+	std::vector<size_t> choice;
+	int horz = total_cost;
+	for (size_t i = n; i > 0; i--)
+	{
+		double row = value(i, horz);
+		if (row != 0 && row != value(i - 1, horz))
+		{
+			horz -= costs[order[i - 1]];
+			choice.push_back(order[i - 1]);
+		}
+	}
+	return choice;
+}
+
+
+// ReconstructionStrategy::checkpointed
+std::vector<size_t> dynamic_checkpointed
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t n,
+	int total_cost,
+	SolverWorkspace& workspace,
+	DynamicStats& stats
+)
+{
+	size_t width = std::max(total_cost, 0) + 1;
+	size_t segment = std::max<size_t>(1, std::ceil(std::sqrt(double(n))));
+	size_t segments = (n + segment - 1) / segment;
+
+	// Checkpoint s is DP row s * segment, kept in the table buffer; the
+	// forward pass rolls through the first two working rows.
+	double* checkpoints = workspace.table(segments * width);
+	double* rows = workspace.rows(std::max<size_t>(2, segment + 1) * width);
+	double* row = rows;
+	double* next = rows + width;
+	std::fill(row, row + width, 0.0);
+	for (size_t i = 1; i <= n; i++)
+	{
+		if ((i - 1) % segment == 0)
+		{
+			std::copy(row, row + width, checkpoints + (i - 1) / segment * width);
+		}
+		dynamic_fill_row(row, next, total_cost, costs[i - 1], defenses[i - 1]);
+		std::swap(row, next);
+	}
+	stats.cells_computed += n * total_cost;
+
+	// Backward pass: rebuild each segment from its checkpoint, last segment first.
+	stats.rows_stored = segments + segment + 1;
+
+	std::vector<size_t> choice;
+	int horz = total_cost;
+	for (size_t s = segments; s > 0; s--)
+	{
+		size_t first = (s - 1) * segment;
+		size_t last = std::min(n, first + segment);
+
+		std::copy(checkpoints + (s - 1) * width, checkpoints + s * width, rows);
+		for (size_t i = first + 1; i <= last; i++)
+		{
+			dynamic_fill_row(rows + (i - first - 1) * width, rows + (i - first) * width, total_cost, costs[i - 1], defenses[i - 1]);
+		}
+		stats.cells_computed += (last - first) * total_cost;
+
+		dynamic_backtrack(rows, width, costs, first, last, horz, choice);
+	}
+	return choice;
+}
+
+
+// ReconstructionStrategy::divide_and_conquer, over items [first, last) and the given budget.
+// scratch holds at least 3 * (budget + 1) cells; the recursion reuses it since
+// each level is done with its rows before descending.
+void dynamic_divide_and_conquer
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t first,
+	size_t last,
+	int budget,
+	double* scratch,
+	DynamicStats& stats,
+	std::vector<size_t>& choice
+)
+{
+	if (first >= last || budget <= 0)
+	{
+		return;
+	}
+	if (last - first == 1)
+	{
+		if (costs[first] <= budget && defenses[first] > 0)
+		{
+			choice.push_back(first);
+		}
+		return;
+	}
+
+	size_t mid = first + (last - first) / 2;
+
+	// forward[k]: best of [first, mid) within k gold; backward[k]: best of [mid, last) within k gold.
+	double* forward = scratch;
+	double* backward = scratch + (budget + 1);
+	double* spare = scratch + 2 * (budget + 1);
+	std::fill(forward, forward + budget + 1, 0.0);
+	std::fill(backward, backward + budget + 1, 0.0);
+	for (size_t i = first; i < mid; i++)
+	{
+		dynamic_fill_row(forward, spare, budget, costs[i], defenses[i]);
+		std::swap(forward, spare);
+	}
+	for (size_t i = mid; i < last; i++)
+	{
+		dynamic_fill_row(backward, spare, budget, costs[i], defenses[i]);
+		std::swap(backward, spare);
+	}
+	stats.cells_computed += (last - first) * budget;
+
+	int split = 0;
+	for (int k = 1; k <= budget; k++)
+	{
+		if (forward[k] + backward[budget - k] > forward[split] + backward[budget - split])
+		{
+			split = k;
+		}
+	}
+
+	// Upper half first, so indices come out highest first like the other strategies.
+	dynamic_divide_and_conquer(costs, defenses, mid, last, budget - split, scratch, stats, choice);
+	dynamic_divide_and_conquer(costs, defenses, first, mid, split, scratch, stats, choice);
+}
+
+
+// Dynamic programming core shared by the ArmorVector and ArmorColumns front ends.
+// costs and defenses describe n armor items; returns the indices of the chosen
+// items in the order backtracking finds them (highest index first).
+std::vector<size_t> dynamic_max_defense_indices
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t n,
+	int total_cost,
+	const DynamicOptions& options = DynamicOptions()
+)
+{
+	DynamicStats stats;
+	std::vector<size_t> choice;
+
+	ScopedLatency latency(dynamic_phase_histogram(options, DynamicPhase::solve));
+
+	SolverWorkspace local;
+	SolverWorkspace& workspace = options.workspace ? *options.workspace : local;
+
+	switch (options.reconstruction)
+	{
+		case ReconstructionStrategy::checkpointed:
+			choice = dynamic_checkpointed(costs, defenses, n, total_cost, workspace, stats);
+			break;
+
+		case ReconstructionStrategy::divide_and_conquer:
+			if (total_cost > 0)
+			{
+				double* scratch = workspace.rows(3 * size_t(total_cost + 1));
+				dynamic_divide_and_conquer(costs, defenses, 0, n, total_cost, scratch, stats, choice);
+			}
+			stats.rows_stored = 3;
+			break;
+
+		case ReconstructionStrategy::full_table:
+		default:
+			if (options.bound_columns)
+			{
+				choice = dynamic_windowed_table(costs, defenses, n, total_cost, options.order_for_windows, workspace, stats);
+			}
+			else
+			{
+				choice = dynamic_full_table(costs, defenses, n, total_cost, workspace, stats);
+			}
+			break;
+	}
+	stats.cells_full_table = n * std::max(total_cost, 0);
+
+	if (options.stats)
+	{
+		*options.stats = stats;
+	}
+	if (options.metrics)
+	{
+		options.metrics->cells_computed.add(stats.cells_computed);
+	}
+	return choice;
+}
+
+
+// Compute the optimal set of armor items with a dynamic algorithm.
+// Specifically, among the armor items that fit within a total_cost gold budget,
+// choose the selection of armors whose defense is greatest.
+// Repeat until no more armor items can be chosen, either because we've run out of armor items,
+// or run out of gold.
+std::unique_ptr<ArmorVector> dynamic_max_defense
+(
+	const ArmorVector& armors,
+	int total_cost,
+	const DynamicOptions& options = DynamicOptions()
+)
+{
+	SolverWorkspace local;
+	DynamicOptions inner = options;
+	if ( ! inner.workspace )
+	{
+		inner.workspace = &local;
+	}
+
+	int32_t* costs = inner.workspace->costs(armors.size());
+	double* defenses = inner.workspace->defenses(armors.size());
+	{
+		ScopedLatency latency(dynamic_phase_histogram(options, DynamicPhase::gather));
+		for (size_t i = 0; i < armors.size(); i++)
+		{
+			costs[i] = armors[i]->cost();
+			defenses[i] = armors[i]->defense();
+		}
+	}
+
+	std::vector<size_t> indices = dynamic_max_defense_indices(costs, defenses, armors.size(), total_cost, inner);
+
+	//Vector to hold Chosen subset
+	ScopedLatency latency(dynamic_phase_histogram(options, DynamicPhase::select));
+	std::unique_ptr<ArmorVector> choice(new ArmorVector);
+	for (size_t i : indices)
+	{
+		choice->push_back(armors[i]);
+	}
+
+	return choice;
+}
+
+
+// Same as above, for a columnar catalog; only the chosen rows are materialized.
+std::unique_ptr<ArmorVector> dynamic_max_defense
+(
+	const ArmorColumns& armors,
+	int total_cost,
+	const DynamicOptions& options = DynamicOptions()
+)
+{
+	std::vector<size_t> indices = dynamic_max_defense_indices(armors.costs(), armors.defenses(), armors.size(), total_cost, options);
+
+	ScopedLatency latency(dynamic_phase_histogram(options, DynamicPhase::select));
+	return armors.select(indices);
+}
+
+
+// Number of catalogs batch_dynamic_max_defense advances together, one per SIMD lane.
+const size_t batch_lanes = 8;
+
+
+// Advance columns [from, to] of one interleaved DP row for every lane.
+// above and row hold batch_lanes cells per budget, lane l at offset l;
+// lane l's item costs costs[l] gold and adds defenses[l] defense.
+void batch_fill_row_portable
+(
+	const double* above,
+	double* row,
+	int from,
+	int to,
+	const int32_t* costs,
+	const double* defenses
+)
+{
+	for (int j = from; j <= to; j++)
+	{
+		for (size_t l = 0; l < batch_lanes; l++)
+		{
+			if (j - costs[l] >= 0)
+			{
+				row[j * batch_lanes + l] = max(above[j * batch_lanes + l], above[(j - costs[l]) * batch_lanes + l] + defenses[l]);
+			}
+			else
+			{
+				row[j * batch_lanes + l] = above[j * batch_lanes + l];
+			}
+		}
+	}
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+// AVX2 version of batch_fill_row_portable. Each column is two 4-wide vectors;
+// the per-lane "j - cost" cells are gathered, masked off in lanes whose item
+// does not fit yet.
+__attribute__((target("avx2")))
+void batch_fill_row_avx2
+(
+	const double* above,
+	double* row,
+	int from,
+	int to,
+	const int32_t* costs,
+	const double* defenses
+)
+{
+	// Offsets, in doubles, from column j's first lane to lane l of column j - costs[l].
+	__m128i offsets_low = _mm_setr_epi32(
+		0 - costs[0] * int(batch_lanes), 1 - costs[1] * int(batch_lanes),
+		2 - costs[2] * int(batch_lanes), 3 - costs[3] * int(batch_lanes)
+	);
+	__m128i offsets_high = _mm_setr_epi32(
+		0 - costs[4] * int(batch_lanes), 1 - costs[5] * int(batch_lanes),
+		2 - costs[6] * int(batch_lanes), 3 - costs[7] * int(batch_lanes)
+	);
+	__m256i costs_low = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) costs));
+	__m256i costs_high = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*) (costs + 4)));
+	__m256d defense_low = _mm256_loadu_pd(defenses);
+	__m256d defense_high = _mm256_loadu_pd(defenses + 4);
+	__m256d unreachable = _mm256_set1_pd(-INFINITY);
+
+	for (int j = from; j <= to; j++)
+	{
+		const double* cell = above + j * batch_lanes;
+		__m256i budget = _mm256_set1_epi64x(j + 1);
+		__m256d fits_low = _mm256_castsi256_pd(_mm256_cmpgt_epi64(budget, costs_low));
+		__m256d fits_high = _mm256_castsi256_pd(_mm256_cmpgt_epi64(budget, costs_high));
+
+		__m256d skip_low = _mm256_loadu_pd(cell);
+		__m256d skip_high = _mm256_loadu_pd(cell + 4);
+		__m256d take_low = _mm256_add_pd(_mm256_mask_i32gather_pd(unreachable, cell, offsets_low, fits_low, 8), defense_low);
+		__m256d take_high = _mm256_add_pd(_mm256_mask_i32gather_pd(unreachable, cell + 4, offsets_high, fits_high, 8), defense_high);
+
+		// max(take, skip) keeps skip on ties, like max(skip, take) in the scalar code.
+		_mm256_storeu_pd(row + j * batch_lanes, _mm256_max_pd(take_low, skip_low));
+		_mm256_storeu_pd(row + j * batch_lanes + 4, _mm256_max_pd(take_high, skip_high));
+	}
+}
+#endif
+
+
+// Advance one interleaved DP row for every lane, using AVX2 when the CPU has it.
+void batch_fill_row
+(
+	const double* above,
+	double* row,
+	int total_cost,
+	const int32_t* costs,
+	const double* defenses
+)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	if (has_avx2)
+	{
+		batch_fill_row_avx2(above, row, 0, total_cost, costs, defenses);
+		return;
+	}
+#endif
+	batch_fill_row_portable(above, row, 0, total_cost, costs, defenses);
+}
+
+
+// Solve the same total_cost budget for many small catalogs at once.
+// Catalogs are packed batch_lanes at a time into the lanes of one interleaved
+// DP table, so each row update advances all of them together; shorter catalogs
+// are padded with zero-defense items that are never chosen.
+// Returns one solution per catalog, in order, identical to what
+// dynamic_max_defense would return for that catalog alone.
+// This is about 1.8x faster than one call per catalog, well short of the lane
+// count: each lane's item has a different cost, so every column of the AVX2
+// path needs two gathers, and those gathers dominate the row update.
+std::vector<std::unique_ptr<ArmorVector>> batch_dynamic_max_defense
+(
+	const std::vector<const ArmorVector*>& catalogs,
+	int total_cost
+)
+{
+	std::vector<std::unique_ptr<ArmorVector>> solutions;
+	std::vector<double> table;
+	size_t row_size = (total_cost + 1) * batch_lanes;
+
+	for (size_t group = 0; group < catalogs.size(); group += batch_lanes)
+	{
+		size_t lanes = std::min(batch_lanes, catalogs.size() - group);
+
+		size_t rows = 0;
+		for (size_t l = 0; l < lanes; l++)
+		{
+			rows = std::max(rows, catalogs[group + l]->size());
+		}
+
+		// Row 0 is all zeros; every later cell is written before it is read.
+		table.resize((rows + 1) * row_size);
+		std::fill(table.begin(), table.begin() + row_size, 0.0);
+
+		int32_t costs[batch_lanes];
+		double defenses[batch_lanes];
+		for (size_t i = 1; i <= rows; i++)
+		{
+			for (size_t l = 0; l < batch_lanes; l++)
+			{
+				bool real = l < lanes && i <= catalogs[group + l]->size();
+				costs[l] = real ? (*catalogs[group + l])[i - 1]->cost() : 1;
+				defenses[l] = real ? (*catalogs[group + l])[i - 1]->defense() : 0;
+			}
+			batch_fill_row(&table[(i - 1) * row_size], &table[i * row_size], total_cost, costs, defenses);
+		}
+
+		// Backtrack each lane exactly as dynamic_backtrack does.
+		for (size_t l = 0; l < lanes; l++)
+		{
+			const ArmorVector& armors = *catalogs[group + l];
+			std::unique_ptr<ArmorVector> choice(new ArmorVector);
+			int horz = total_cost;
+			for (size_t i = armors.size(); i > 0; i--)
+			{
+				double value = table[i * row_size + horz * batch_lanes + l];
+				double above = table[(i - 1) * row_size + horz * batch_lanes + l];
+				if (value != 0 && value != above)
+				{
+					horz -= armors[i - 1]->cost();
+					choice->push_back(armors[i - 1]);
+				}
+			}
+			solutions.push_back(std::move(choice));
+		}
+	}
+
+	return solutions;
+}
+
+
+// Max-plus convolution of line with a concave gain curve, for rows [lo, hi] of
+// the implicit matrix M[t][s] = line[s] + gain[t - s] (0 <= t - s < gain.size()).
+// Because gain is concave, some best s for row t is nondecreasing in t, so each
+// row only searches between the best columns of its neighbours.
+// best[t] receives the row maximum and taken[t] its t - s.
+void concave_max_plus
+(
+	const std::vector<double>& line,
+	const std::vector<double>& gain,
+	long lo,
+	long hi,
+	long opt_lo,
+	long opt_hi,
+	std::vector<double>& best,
+	std::vector<int>& taken,
+	size_t& cells
+)
+{
+	if (lo > hi)
+	{
+		return;
+	}
+
+	long mid = lo + (hi - lo) / 2;
+	long first = std::max(opt_lo, mid - long(gain.size()) + 1);
+	long last = std::min(opt_hi, mid);
+
+	// Prefer the largest s on ties, i.e. the fewest items.
+	long best_s = last;
+	double best_value = line[last] + gain[mid - last];
+	for (long s = last - 1; s >= first; s--)
+	{
+		double value = line[s] + gain[mid - s];
+		if (value > best_value)
+		{
+			best_value = value;
+			best_s = s;
+		}
+	}
+	cells += last - first + 1;
+	best[mid] = best_value;
+	taken[mid] = mid - best_s;
+
+	concave_max_plus(line, gain, lo, mid - 1, opt_lo, best_s, best, taken, cells);
+	concave_max_plus(line, gain, mid + 1, hi, best_s, opt_hi, best, taken, cells);
+}
+
+
+// Compute the optimal set of armor items by cost class rather than item by item.
+// All items of one cost, best defense first, give a concave gain curve
+// (gain[k] = defense of the k best), so one class updates the DP row with a
+// concave max-plus convolution along each residue class of the budget modulo
+// that cost. That is O(B log B) per distinct cost instead of O(B) per item,
+// which pays off when a catalog has far fewer distinct costs than items,
+// as armor.csv does. Returns chosen indices, costliest class first.
+std::vector<size_t> cost_class_max_defense_indices
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t n,
+	int total_cost,
+	DynamicStats* stats = nullptr
+)
+{
+	// Group useful items by cost; each class sorted by descending defense.
+	std::vector<size_t> order;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (defenses[i] > 0 && costs[i] <= total_cost)
+		{
+			order.push_back(i);
+		}
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+	{
+		if (costs[a] != costs[b])
+		{
+			return costs[a] < costs[b];
+		}
+		return defenses[a] > defenses[b];
+	});
+
+	std::vector<size_t> class_begin;
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		if (i == 0 || costs[order[i]] != costs[order[i - 1]])
+		{
+			class_begin.push_back(i);
+		}
+	}
+	class_begin.push_back(order.size());
+	size_t classes = class_begin.size() - 1;
+
+	// row[j]: best defense within j gold so far; taken[q][j]: items of class q used at j.
+	std::vector<double> row(total_cost + 1, 0), next(total_cost + 1);
+	std::vector<std::vector<int>> taken(classes, std::vector<int>(total_cost + 1));
+	std::vector<double> gain, line, best;
+	std::vector<int> line_taken;
+	size_t cells = 0;
+
+	for (size_t q = 0; q < classes; q++)
+	{
+		int cost = costs[order[class_begin[q]]];
+
+		// Taking more than total_cost / cost items of this class never fits.
+		size_t count = std::min<size_t>(class_begin[q + 1] - class_begin[q], total_cost / cost);
+		gain.assign(1, 0);
+		for (size_t k = 0; k < count; k++)
+		{
+			gain.push_back(gain.back() + defenses[order[class_begin[q] + k]]);
+		}
+
+		for (int residue = 0; residue < cost && residue <= total_cost; residue++)
+		{
+			long length = (total_cost - residue) / cost + 1;
+			line.resize(length);
+			best.resize(length);
+			line_taken.resize(length);
+			for (long t = 0; t < length; t++)
+			{
+				line[t] = row[residue + t * cost];
+			}
+
+			concave_max_plus(line, gain, 0, length - 1, 0, length - 1, best, line_taken, cells);
+
+			for (long t = 0; t < length; t++)
+			{
+				next[residue + t * cost] = best[t];
+				taken[q][residue + t * cost] = line_taken[t];
+			}
+		}
+		row.swap(next);
+	}
+
+	if (stats)
+	{
+		stats->rows_stored = classes + 2;
+		stats->cells_computed = cells;
+	}
+
+	// Walk the classes backwards, taking each class's best items.
+	std::vector<size_t> choice;
+	int horz = total_cost;
+	for (size_t q = classes; q > 0; q--)
+	{
+		int k = taken[q - 1][horz];
+		for (int i = 0; i < k; i++)
+		{
+			choice.push_back(order[class_begin[q - 1] + i]);
+		}
+		horz -= k * costs[order[class_begin[q - 1]]];
+	}
+	return choice;
+}
+
+
+// ArmorVector front end for cost_class_max_defense_indices.
+std::unique_ptr<ArmorVector> cost_class_max_defense
+(
+	const ArmorVector& armors,
+	int total_cost,
+	DynamicStats* stats = nullptr
+)
+{
+	ArmorColumns columns(armors);
+	std::unique_ptr<ArmorVector> choice(new ArmorVector);
+	for (size_t i : cost_class_max_defense_indices(columns.costs(), columns.defenses(), columns.size(), total_cost, stats))
+	{
+		choice->push_back(armors[i]);
+	}
+	return choice;
+}
+
+
+// ArmorColumns front end for cost_class_max_defense_indices.
+std::unique_ptr<ArmorVector> cost_class_max_defense
+(
+	const ArmorColumns& armors,
+	int total_cost,
+	DynamicStats* stats = nullptr
+)
+{
+	return armors.select(
+		cost_class_max_defense_indices(armors.costs(), armors.defenses(), armors.size(), total_cost, stats)
+	);
+}
+
+
+
+
+
+   //print_2d_cache(table);
+   //std::cout<<"\nlast val:"<<table[total_size][total_cost]<<std::endl;
+
+
+
+// A day of catalog changes and best-defense queries, answered offline.
+// Record add_item / remove_item / query calls in time order, then solve()
+// answers every query against the items alive at that moment.
+// Each item's lifetime, measured in queries, is split over the nodes of a
+// segment tree on the query timeline; one depth-first walk pushes a DP row per
+// level, applies the items stored at each node, and answers the queries at the
+// leaves. Total work is O(n log Q * B) instead of a full solve per query.
+class CatalogTimeline
+{
+	//
+	public:
+
+		// Add an item from now on; returns an id for remove_item.
+		size_t add_item(std::shared_ptr<ArmorItem> item)
+		{
+			assert(item);
+			_lifetimes.push_back(Lifetime { item, _budgets.size(), no_end });
+			return _lifetimes.size() - 1;
+		}
+
+		// Remove a previously added item from now on.
+		void remove_item(size_t id)
+		{
+			assert(id < _lifetimes.size());
+			assert(_lifetimes[id].end == no_end);
+			_lifetimes[id].end = _budgets.size();
+		}
+
+		// Ask for the best defense within budget among the items alive now.
+		// Returns the index of this query's answer in solve()'s result.
+		size_t query(int budget)
+		{
+			assert(budget >= 0);
+			_budgets.push_back(budget);
+			return _budgets.size() - 1;
+		}
+
+		// Answer every recorded query.
+		std::vector<double> solve() const
+		{
+			size_t queries = _budgets.size();
+			std::vector<double> answers(queries, 0);
+			if (queries == 0)
+			{
+				return answers;
+			}
+
+			int widest = *std::max_element(_budgets.begin(), _budgets.end());
+
+			// Item lifetimes cover query indices [begin, end).
+			std::vector<std::vector<size_t>> node_items(4 * queries);
+			for (size_t id = 0; id < _lifetimes.size(); id++)
+			{
+				size_t end = std::min(_lifetimes[id].end, queries);
+				if (_lifetimes[id].begin < end && _lifetimes[id].item->cost() <= widest)
+				{
+					insert(node_items, 1, 0, queries, _lifetimes[id].begin, end, id);
+				}
+			}
+
+			// rows[d] is the DP row after applying all items on the path to depth d.
+			std::vector<std::vector<double>> rows(1, std::vector<double>(widest + 1, 0));
+			walk(node_items, 1, 0, queries, 0, widest, rows, answers);
+			return answers;
+		}
+
+	//
+	private:
+
+		static const size_t no_end = SIZE_MAX;
+
+		struct Lifetime
+		{
+			std::shared_ptr<ArmorItem> item;
+			size_t begin, end;
+		};
+
+		// Store id at the O(log Q) nodes that exactly cover [begin, end).
+		void insert
+		(
+			std::vector<std::vector<size_t>>& node_items,
+			size_t node,
+			size_t node_begin,
+			size_t node_end,
+			size_t begin,
+			size_t end,
+			size_t id
+		) const
+		{
+			if (end <= node_begin || node_end <= begin)
+			{
+				return;
+			}
+			if (begin <= node_begin && node_end <= end)
+			{
+				node_items[node].push_back(id);
+				return;
+			}
+			size_t mid = node_begin + (node_end - node_begin) / 2;
+			insert(node_items, 2 * node, node_begin, mid, begin, end, id);
+			insert(node_items, 2 * node + 1, mid, node_end, begin, end, id);
+		}
+
+		void walk
+		(
+			const std::vector<std::vector<size_t>>& node_items,
+			size_t node,
+			size_t node_begin,
+			size_t node_end,
+			size_t depth,
+			int widest,
+			std::vector<std::vector<double>>& rows,
+			std::vector<double>& answers
+		) const
+		{
+			// Push: this node's row starts as a copy of its parent's.
+			if (rows.size() <= depth + 1)
+			{
+				rows.emplace_back(widest + 1);
+			}
+			std::vector<double>& row = rows[depth + 1];
+			row = rows[depth];
+			for (size_t id : node_items[node])
+			{
+				const ArmorItem& item = *_lifetimes[id].item;
+				for (int j = widest; j >= item.cost(); j--)
+				{
+					row[j] = max(row[j], row[j - item.cost()] + item.defense());
+				}
+			}
+
+			if (node_end - node_begin == 1)
+			{
+				answers[node_begin] = row[_budgets[node_begin]];
+				return;
+			}
+			size_t mid = node_begin + (node_end - node_begin) / 2;
+			walk(node_items, 2 * node, node_begin, mid, depth + 1, widest, rows, answers);
+			walk(node_items, 2 * node + 1, mid, node_end, depth + 1, widest, rows, answers);
+
+			// Pop is implicit: the next sibling overwrites rows[depth + 1] from rows[depth].
+		}
+
+		std::vector<Lifetime> _lifetimes;
+		std::vector<int> _budgets;
+};
+
+
+// Counters filled in by float32_max_defense.
+struct Float32Stats
+{
+	// Proven bound on how far any float DP cell can be from its exact value.
+	double error_bound = 0;
+
+	// Backtracking decisions the bound could not settle.
+	size_t ambiguous_decisions = 0;
+
+	// Items whose decisions were re-solved in double precision instead.
+	size_t items_resolved_in_double = 0;
+
+	// True when the double re-solve covered every item, i.e. float32 bought nothing.
+	bool fell_back = false;
+
+	// True when the table held defenses as scaled integers below 2^24, so every
+	// float cell was exact and every decision, ties included, was settled.
+	bool exact = false;
+};
+
+
+// Columns [from, to] of one float32 DP row, all at or above the item's cost.
+void float32_fill_row_portable(const float* above, float* row, int from, int to, int cost, float defense)
+{
+	for (int j = from; j <= to; j++)
+	{
+		float take = above[j - cost] + defense;
+		row[j] = above[j] >= take ? above[j] : take;
+	}
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+// AVX2 version of float32_fill_row_portable, eight columns at a time.
+__attribute__((target("avx2")))
+void float32_fill_row_avx2(const float* above, float* row, int from, int to, int cost, float defense)
+{
+	__m256 add = _mm256_set1_ps(defense);
+	int j = from;
+	for (; j + 7 <= to; j += 8)
+	{
+		__m256 take = _mm256_add_ps(_mm256_loadu_ps(above + j - cost), add);
+		_mm256_storeu_ps(row + j, _mm256_max_ps(take, _mm256_loadu_ps(above + j)));
+	}
+	float32_fill_row_portable(above, row, j, to, cost, defense);
+}
+#endif
+
+
+// One float32 DP row from the row above it; columns below cost are copied.
+void float32_fill_row(const float* above, float* row, int total_cost, int cost, float defense)
+{
+	int fits = std::min(std::max(cost, 0), total_cost + 1);
+	std::memcpy(row, above, fits * sizeof(float));
+#if defined(__x86_64__) || defined(__i386__)
+	static const bool has_avx2 = __builtin_cpu_supports("avx2");
+	if (has_avx2)
+	{
+		float32_fill_row_avx2(above, row, fits, total_cost, cost, defense);
+		return;
+	}
+#endif
+	float32_fill_row_portable(above, row, fits, total_cost, cost, defense);
+}
+
+
+// Same contract as dynamic_max_defense_indices (full_table), but the DP table is
+// float32: half the memory traffic and twice the SIMD lanes of double.
+// Alongside the table we carry a rigorous bound on accumulated rounding error.
+// Every float cell is a chained float sum of the defenses of some set of at
+// most k items, where k is the most items of row i that fit in total_cost;
+// such a sum is off by at most (k + 1) * u * (largest value in the row), with
+// unit roundoff u, and so is the float DP's best compared with the exact best.
+// While backtracking, a take/skip
+// decision is only trusted when the two candidates differ by more than twice
+// that bound; otherwise the remaining items are re-solved exactly in double
+// for the remaining budget. The result is therefore as good as the double engine's.
+//
+// Catalogs whose defenses have at most float32_max_decimals decimal places,
+// like armor.csv's hundredths, are run in fixed point: the table holds
+// defenses times 10^places, and while every cell stays below 2^24 those are
+// integers float represents exactly. Then each decision is checked exactly,
+// an exact tie means either choice is optimal, and nothing is re-solved.
+const int float32_max_decimals = 4;
+
+std::vector<size_t> float32_max_defense_indices
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t n,
+	int total_cost,
+	Float32Stats* stats = nullptr
+)
+{
+	Float32Stats local;
+	Float32Stats& counters = stats ? *stats : local;
+	counters = Float32Stats();
+
+	// Half an ulp, plus a little slack for the bound's own arithmetic.
+	const double unit_roundoff = std::ldexp(1.0, -24) * (1 + 1e-6);
+
+	// Largest integer below which float sums of integers are exact.
+	const double exact_limit = 16777216;
+
+	// Fewest decimal places that make every defense an integer, if any do.
+	double scale = 0;
+	for (int places = 0, power = 1; places <= float32_max_decimals && scale == 0; places++, power *= 10)
+	{
+		bool integral = true;
+		for (size_t i = 0; i < n && integral; i++)
+		{
+			double scaled = defenses[i] * power;
+			integral = std::fabs(scaled) < exact_limit && std::fabs(scaled - std::round(scaled)) <= 1e-9 * std::max(1.0, std::fabs(scaled));
+		}
+		if (integral)
+		{
+			scale = power;
+		}
+	}
+	bool exact = scale != 0;
+
+	// Item k's defense as the table holds it.
+	auto table_defense = [&](size_t k)
+	{
+		return scale != 0 ? float(std::round(defenses[k] * scale)) : float(defenses[k]);
+	};
+
+	size_t width = total_cost + 1;
+	// Every row is written in full before it is read; only row 0 needs zeroing.
+	std::unique_ptr<float[]> table(new float[(n + 1) * width]);
+	std::fill(&table[0], &table[width], 0.0f);
+	std::vector<double> error(n + 1, 0);
+	int cheapest = INT_MAX;
+	bool finite = true;
+	for (size_t i = 1; i <= n && finite; i++)
+	{
+		const float* above = &table[(i - 1) * width];
+		float* row = &table[i * width];
+		int cost = costs[i - 1];
+		float defense = table_defense(i - 1);
+
+		float32_fill_row(above, row, total_cost, cost, defense);
+
+		// Rows are nondecreasing in j, so the largest value is the last one.
+		double largest = std::fabs(double(row[total_cost]));
+		cheapest = std::min(cheapest, cost);
+		double terms = std::min<double>(i, total_cost / cheapest);
+		error[i] = (terms + 1) * unit_roundoff * largest * (1 + 1e-3);
+		finite = std::isfinite(largest) && std::isfinite(defenses[i - 1]);
+
+		// Cells are nonnegative and at most the row's last, so none was rounded.
+		exact = exact && largest <= exact_limit;
+	}
+
+	// Overflow or a non-finite defense: nothing can be certified.
+	if (!finite)
+	{
+		counters.fell_back = true;
+		counters.items_resolved_in_double = n;
+		return dynamic_max_defense_indices(costs, defenses, n, total_cost);
+	}
+	counters.exact = exact;
+	counters.error_bound = exact ? 0 : scale != 0 ? error[n] / scale : error[n];
+
+	std::vector<size_t> choice;
+	int horz = total_cost;
+	for (size_t i = n; i > 0; i--)
+	{
+		int cost = costs[i - 1];
+		if (horz < cost)
+		{
+			continue;
+		}
+
+		const float* above = &table[(i - 1) * width];
+		float skip = above[horz];
+		float take = above[horz - cost] + table_defense(i - 1);
+		double margin = exact ? 0 : 2 * error[i];
+
+		if (double(take) - double(skip) > margin)
+		{
+			horz -= cost;
+			choice.push_back(i - 1);
+		}
+		else if (double(skip) - double(take) > margin || exact)
+		{
+			continue;
+		}
+		else
+		{
+			// Too close to call: solve items [0, i) exactly for what is left.
+			counters.ambiguous_decisions++;
+			counters.items_resolved_in_double = i;
+			counters.fell_back = i == n;
+			for (size_t k : dynamic_max_defense_indices(costs, defenses, i, horz))
+			{
+				choice.push_back(k);
+			}
+			break;
+		}
+	}
+	return choice;
+}
+
+
+// ArmorVector front end for float32_max_defense_indices.
+std::unique_ptr<ArmorVector> float32_max_defense
+(
+	const ArmorVector& armors,
+	int total_cost,
+	Float32Stats* stats = nullptr
+)
+{
+	ArmorColumns columns(armors);
+	std::unique_ptr<ArmorVector> choice(new ArmorVector);
+	for (size_t i : float32_max_defense_indices(columns.costs(), columns.defenses(), columns.size(), total_cost, stats))
+	{
+		choice->push_back(armors[i]);
+	}
+	return choice;
+}
+
+
+// ArmorColumns front end for float32_max_defense_indices.
+std::unique_ptr<ArmorVector> float32_max_defense
+(
+	const ArmorColumns& armors,
+	int total_cost,
+	Float32Stats* stats = nullptr
+)
+{
+	return armors.select(
+		float32_max_defense_indices(armors.costs(), armors.defenses(), armors.size(), total_cost, stats)
+	);
+}
+
+
+// The gold totals, from 0 to max_cost, that some subset of a catalog spends exactly.
+// Built word-parallel: adding an item of cost c is "bits |= bits << c" over
+// 64-bit words (four at a time with AVX2 when the CPU has it), so a catalog of
+// n items costs O(n * max_cost / 64).
+class ReachableCosts
+{
+	//
+	public:
+
+		//
+		ReachableCosts(const ArmorColumns& catalog, int max_cost)
+			:
+			_max_cost(max_cost),
+			_words(max_cost / 64 + 1, 0)
+		{
+			assert(max_cost >= 0);
+			_words[0] = 1;
+			for (size_t i = 0; i < catalog.size(); i++)
+			{
+				add(catalog.cost(i));
+			}
+		}
+
+		//
+		ReachableCosts(const ArmorVector& catalog, int max_cost)
+			:
+			ReachableCosts(ArmorColumns(catalog), max_cost)
+		{}
+
+		//
+		int max_cost() const { return _max_cost; }
+
+		// Does some subset cost exactly cost gold?
+		bool reachable(int cost) const
+		{
+			if (cost < 0 || cost > _max_cost)
+			{
+				return false;
+			}
+			return (_words[cost / 64] >> (cost % 64)) & 1;
+		}
+
+		// Number of reachable totals.
+		size_t count() const
+		{
+			size_t total = 0;
+			for (uint64_t word : _words)
+			{
+				total += __builtin_popcountll(word);
+			}
+			return total;
+		}
+
+	//
+	private:
+
+		// bits |= bits << cost, from the top word down so sources are still unshifted.
+		void add(int cost)
+		{
+			if (cost > _max_cost)
+			{
+				return;
+			}
+			long word_shift = cost / 64;
+			int bit_shift = cost % 64;
+			long w = _words.size() - 1;
+
+#if defined(__x86_64__) || defined(__i386__)
+			static const bool has_avx2 = __builtin_cpu_supports("avx2");
+			if (has_avx2)
+			{
+				w = shift_or_avx2(_words.data(), w, word_shift, bit_shift);
+			}
+#endif
+			for (; w >= word_shift; w--)
+			{
+				long source = w - word_shift;
+				uint64_t shifted = _words[source] << bit_shift;
+				if (bit_shift && source > 0)
+				{
+					shifted |= _words[source - 1] >> (64 - bit_shift);
+				}
+				_words[w] |= shifted;
+			}
+
+			// Totals above max_cost are not tracked.
+			if ((_max_cost + 1) % 64)
+			{
+				_words.back() &= (uint64_t(1) << ((_max_cost + 1) % 64)) - 1;
+			}
+		}
+
+#if defined(__x86_64__) || defined(__i386__)
+		// Four words per step while a whole block of sources, and the word below
+		// them, exist; returns the highest word left for the scalar loop.
+		__attribute__((target("avx2")))
+		static long shift_or_avx2(uint64_t* words, long w, long word_shift, int bit_shift)
+		{
+			__m128i left = _mm_cvtsi32_si128(bit_shift);
+			__m128i right = _mm_cvtsi32_si128(64 - bit_shift);
+			for (; w - 3 - word_shift >= 1; w -= 4)
+			{
+				const uint64_t* source = words + (w - 3 - word_shift);
+				__m256i high = _mm256_loadu_si256((const __m256i*) source);
+				__m256i shifted = _mm256_sll_epi64(high, left);
+				if (bit_shift)
+				{
+					__m256i low = _mm256_loadu_si256((const __m256i*) (source - 1));
+					shifted = _mm256_or_si256(shifted, _mm256_srl_epi64(low, right));
+				}
+				__m256i* target = (__m256i*) (words + (w - 3));
+				_mm256_storeu_si256(target, _mm256_or_si256(_mm256_loadu_si256(target), shifted));
+			}
+			return w;
+		}
+#endif
+
+		int _max_cost;
+		std::vector<uint64_t> _words;
+};
+
+
+// Compute the set of armor items with the most defense whose costs add up to
+// exactly total_cost gold, for merchants who only sell when the purse is emptied.
+// Returns nullptr when no subset costs exactly total_cost; ReachableCosts
+// answers that in O(n * total_cost / 64) before any DP work is done.
+std::unique_ptr<ArmorVector> exact_spend_max_defense
+(
+	const ArmorVector& armors,
+	int total_cost
+)
+{
+	if (!ReachableCosts(armors, total_cost).reachable(total_cost))
+	{
+		return nullptr;
+	}
+
+	// table[i][j]: best defense of items [0, i) costing exactly j; -infinity if impossible.
+	size_t n = armors.size();
+	size_t width = total_cost + 1;
+	std::vector<double> table((n + 1) * width, -INFINITY);
+	table[0] = 0;
+	for (size_t i = 1; i <= n; i++)
+	{
+		const double* above = &table[(i - 1) * width];
+		double* row = &table[i * width];
+		int cost = armors[i - 1]->cost();
+		double defense = armors[i - 1]->defense();
+		for (int j = 0; j <= total_cost; j++)
+		{
+			row[j] = j >= cost ? max(above[j], above[j - cost] + defense) : above[j];
+		}
+	}
+
+	// A cell that differs from the one above came from taking the item.
+	std::unique_ptr<ArmorVector> choice(new ArmorVector);
+	int horz = total_cost;
+	for (size_t i = n; i > 0; i--)
+	{
+		if (table[i * width + horz] != table[(i - 1) * width + horz])
+		{
+			horz -= armors[i - 1]->cost();
+			choice->push_back(armors[i - 1]);
+		}
+	}
+	assert(horz == 0);
+	return choice;
+}
+
+
+// Run body(begin, end) over [0, count) split across up to threads threads.
+// threads == 0 means one per hardware thread.
+template <typename Body>
+void parallel_for_ranges(size_t count, unsigned threads, Body body)
+{
+	if (threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	threads = std::min<size_t>(threads, std::max<size_t>(count, 1));
+	if (threads <= 1)
+	{
+		body(size_t(0), count);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	size_t chunk = (count + threads - 1) / threads;
+	for (size_t begin = 0; begin < count; begin += chunk)
+	{
+		workers.emplace_back(body, begin, std::min(count, begin + chunk));
+	}
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+
+// "If we added this item to the shop, what would the best defense be?"
+// Keeps the catalog's final DP row (best defense for every budget up to
+// max_budget) resident. A candidate item is exactly one more row update on top
+// of it: O(1) for one budget, O(max_budget) for all of them.
+class WhatIfEvaluator
+{
+	//
+	public:
+
+		//
+		WhatIfEvaluator(const ArmorColumns& catalog, int max_budget)
+			:
+			_row(max_budget + 1, 0)
+		{
+			assert(max_budget >= 0);
+			for (size_t i = 0; i < catalog.size(); i++)
+			{
+				for (int j = max_budget; j >= catalog.cost(i); j--)
+				{
+					_row[j] = max(_row[j], _row[j - catalog.cost(i)] + catalog.defense(i));
+				}
+			}
+		}
+
+		//
+		WhatIfEvaluator(const ArmorVector& catalog, int max_budget)
+			:
+			WhatIfEvaluator(ArmorColumns(catalog), max_budget)
+		{}
+
+		//
+		int max_budget() const { return _row.size() - 1; }
+
+		// Best defense within budget for the catalog as it is.
+		double best_defense(int budget) const
+		{
+			assert(0 <= budget && budget <= max_budget());
+			return _row[budget];
+		}
+
+		// Best defense within budget with candidate added to the catalog.
+		double with_candidate(const ArmorItem& candidate, int budget) const
+		{
+			double best = best_defense(budget);
+			if (candidate.cost() <= budget)
+			{
+				best = max(best, _row[budget - candidate.cost()] + candidate.defense());
+			}
+			return best;
+		}
+
+		// with_candidate for every budget 0..max_budget.
+		std::vector<double> with_candidate_all_budgets(const ArmorItem& candidate) const
+		{
+			std::vector<double> result(_row);
+			for (int j = max_budget(); j >= candidate.cost(); j--)
+			{
+				result[j] = max(_row[j], _row[j - candidate.cost()] + candidate.defense());
+			}
+			return result;
+		}
+
+		// with_candidate for each candidate, evaluated on threads threads (0: all cores).
+		std::vector<double> evaluate(const ArmorVector& candidates, int budget, unsigned threads = 0) const
+		{
+			std::vector<double> result(candidates.size());
+			parallel_for_ranges(candidates.size(), threads, [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					result[i] = with_candidate(*candidates[i], budget);
+				}
+			});
+			return result;
+		}
+
+		// with_candidate_all_budgets for each candidate, evaluated on threads threads (0: all cores).
+		std::vector<std::vector<double>> evaluate_all_budgets(const ArmorVector& candidates, unsigned threads = 0) const
+		{
+			std::vector<std::vector<double>> result(candidates.size());
+			parallel_for_ranges(candidates.size(), threads, [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; i++)
+				{
+					result[i] = with_candidate_all_budgets(*candidates[i]);
+				}
+			});
+			return result;
+		}
+
+	//
+	private:
+
+		// _row[j]: best defense of the catalog within j gold.
+		std::vector<double> _row;
+};
+
+
+// Compute the optimal set of armor items with an exhaustive search algorithm.
+// Specifically, among all subsets of armor items,
+// return the subset whose gold cost fits within the total_cost budget,
+// and whose total defense is greatest.
+// To avoid overflow, the size of the armor items vector must be less than 64.
+std::unique_ptr<ArmorVector> exhaustive_max_defense
+(
+	const ArmorVector& armors,
+	double total_cost
+)
+{
+	std::unique_ptr<ArmorVector> bestset(new ArmorVector());
+
+     int budget = 0;
+     double cdefense = 0;
+     double bestdefense = 0;
+
+     const int n = armors.size();
+
+     assert(n < 64);
+
+     // the size of a power set is 2^amount of items in the list
+     int subsetAmt = pow(2, n);
+
+     //Outer For loop runs for Amount of subsets being made
+
+     //First Inner forloop runs for the amount of objects in each set
+     for (int index = 0; index < subsetAmt; index++)
+     {
+         std::unique_ptr<ArmorVector> candidate(new ArmorVector());
 
          for (int j = 0; j < n; j++)
          {
@@ -426,3 +2471,633 @@ std::unique_ptr<ArmorVector> exhaustive_max_defense
 
      return bestset;
 }
+
+
+// Unsigned integer keys whose order matches the values': flip the sign bit of
+// non-negative numbers and every bit of negative ones.
+uint64_t order_preserving_key(double value)
+{
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits >> 63 ? ~bits : bits | (uint64_t(1) << 63);
+}
+
+
+//
+uint64_t order_preserving_key(int32_t value)
+{
+	return uint32_t(value) ^ 0x80000000u;
+}
+
+
+// Item indices 0..n-1 ordered by ascending keys, equal keys in index order.
+// LSD radix sort, 8 bits a pass, skipping passes whose digit is the same for
+// every key. Inputs of at least parallel_min_items items are split across
+// threads threads (0: all cores): each counts its own chunk's digits, and a
+// prefix sum over (digit, chunk) gives each its own output slots, so the
+// scatter stays stable without any locking.
+std::vector<uint32_t> radix_sort_permutation(const std::vector<uint64_t>& keys, unsigned threads = 0)
+{
+	const size_t parallel_min_items = size_t(1) << 16;
+	const size_t radix = 256;
+
+	size_t n = keys.size();
+	assert(n <= UINT32_MAX);
+	if (threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	size_t chunks = n < parallel_min_items ? 1 : threads;
+	size_t chunk_size = (n + chunks - 1) / std::max<size_t>(chunks, 1);
+
+	std::vector<uint32_t> order(n), next_order(n);
+	std::vector<uint64_t> sorted(keys), next_keys(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		order[i] = i;
+	}
+
+	std::vector<size_t> counts(chunks * radix);
+	for (unsigned shift = 0; shift < 64; shift += 8)
+	{
+		std::fill(counts.begin(), counts.end(), 0);
+		parallel_for_ranges(chunks, chunks, [&](size_t first, size_t last)
+		{
+			for (size_t c = first; c < last; c++)
+			{
+				size_t* count = &counts[c * radix];
+				for (size_t i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++)
+				{
+					count[(sorted[i] >> shift) & (radix - 1)]++;
+				}
+			}
+		});
+
+		// Turn counts into each chunk's first slot per digit.
+		size_t at = 0;
+		bool one_digit = false;
+		for (size_t d = 0; d < radix; d++)
+		{
+			size_t start = at;
+			for (size_t c = 0; c < chunks; c++)
+			{
+				size_t count = counts[c * radix + d];
+				counts[c * radix + d] = at;
+				at += count;
+			}
+			one_digit = one_digit || at - start == n;
+		}
+		if (one_digit)
+		{
+			continue;
+		}
+
+		parallel_for_ranges(chunks, chunks, [&](size_t first, size_t last)
+		{
+			for (size_t c = first; c < last; c++)
+			{
+				size_t* slot = &counts[c * radix];
+				for (size_t i = c * chunk_size; i < std::min(n, (c + 1) * chunk_size); i++)
+				{
+					size_t to = slot[(sorted[i] >> shift) & (radix - 1)]++;
+					next_order[to] = order[i];
+					next_keys[to] = sorted[i];
+				}
+			}
+		});
+		order.swap(next_order);
+		sorted.swap(next_keys);
+	}
+	return order;
+}
+
+
+// A catalog's items in the orders the bound, greedy and branch-and-bound
+// engines scan them, so they need not sort per query. Ties keep index order.
+struct CatalogOrderings
+{
+	// ArmorColumns::version of the catalog these belong to.
+	uint64_t version = 0;
+
+	// Most defense per gold first; free items with defense first of all, and
+	// items without defense last.
+	std::vector<uint32_t> by_efficiency;
+
+	// Cheapest first.
+	std::vector<uint32_t> by_cost;
+
+	// Most defense first.
+	std::vector<uint32_t> by_defense;
+
+	//
+	size_t size() const { return by_cost.size(); }
+
+	//
+	explicit CatalogOrderings(const ArmorColumns& catalog, unsigned threads = 0)
+		:
+		version(catalog.version())
+	{
+		size_t n = catalog.size();
+		std::vector<uint64_t> keys(n);
+
+		// Descending orders sort the complemented key.
+		for (size_t i = 0; i < n; i++)
+		{
+			double defense = catalog.defense(i);
+			int cost = catalog.cost(i);
+			double efficiency = cost > 0 ? defense / cost : defense > 0 ? HUGE_VAL : defense < 0 ? -HUGE_VAL : 0;
+			keys[i] = ~order_preserving_key(efficiency);
+		}
+		by_efficiency = radix_sort_permutation(keys, threads);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			keys[i] = order_preserving_key(int32_t(catalog.cost(i)));
+		}
+		by_cost = radix_sort_permutation(keys, threads);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			keys[i] = ~order_preserving_key(catalog.defense(i));
+		}
+		by_defense = radix_sort_permutation(keys, threads);
+	}
+};
+
+
+// CatalogOrderings of the most recently used catalog versions. A catalog that
+// changes is a new ArmorColumns with a new version, so it misses and is
+// sorted once; the old version's entry ages out, or is dropped by invalidate().
+class CatalogOrderCache
+{
+	//
+	public:
+
+		//
+		explicit CatalogOrderCache(size_t capacity = 8)
+			:
+			_capacity(capacity)
+		{
+			assert(capacity > 0);
+		}
+
+		CatalogOrderCache(const CatalogOrderCache&) = delete;
+		CatalogOrderCache& operator=(const CatalogOrderCache&) = delete;
+
+		// The catalog's orderings, built on first use of its version. The
+		// build runs outside the lock, so hits on other versions never wait
+		// for it, and callers missing on the same version share one build.
+		std::shared_ptr<const CatalogOrderings> get(const ArmorColumns& catalog)
+		{
+			uint64_t version = catalog.version();
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (auto found = find(version))
+				{
+					return found;
+				}
+			}
+
+			return _flights.run(version, [&]()
+			{
+				// Another build of this version may have finished since the lookup.
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					if (auto found = find(version))
+					{
+						return found;
+					}
+				}
+
+				std::shared_ptr<const CatalogOrderings> built = std::make_shared<CatalogOrderings>(catalog);
+				std::lock_guard<std::mutex> lock(_mutex);
+				_builds++;
+				if (_entries.size() == _capacity)
+				{
+					_entries.pop_back();
+				}
+				_entries.insert(_entries.begin(), built);
+				return built;
+			});
+		}
+
+		// Forget a catalog version's orderings, e.g. when it is replaced.
+		void invalidate(uint64_t version)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_entries.erase(std::remove_if(_entries.begin(), _entries.end(), [&](const std::shared_ptr<const CatalogOrderings>& entry)
+			{
+				return entry->version == version;
+			}), _entries.end());
+		}
+
+		//
+		void clear()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_entries.clear();
+		}
+
+		// Orderings built so far, i.e. cache misses.
+		size_t builds() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _builds;
+		}
+
+		// Process-wide cache used by the engines' ArmorColumns front ends.
+		static CatalogOrderCache& global()
+		{
+			static CatalogOrderCache cache;
+			return cache;
+		}
+
+	//
+	private:
+
+		// The cached orderings of version, moved to the front; nullptr if
+		// there are none. Called with _mutex held.
+		std::shared_ptr<const CatalogOrderings> find(uint64_t version)
+		{
+			for (size_t i = 0; i < _entries.size(); i++)
+			{
+				if (_entries[i]->version == version)
+				{
+					// Move to the front, so the back is always least recently used.
+					std::rotate(_entries.begin(), _entries.begin() + i, _entries.begin() + i + 1);
+					return _entries.front();
+				}
+			}
+			return nullptr;
+		}
+
+		size_t _capacity;
+		mutable std::mutex _mutex;
+		std::vector<std::shared_ptr<const CatalogOrderings>> _entries;
+		size_t _builds = 0;
+		SingleFlight<uint64_t, std::shared_ptr<const CatalogOrderings>> _flights;
+};
+
+
+// Answer of DefenseBounds::check.
+enum class Feasibility
+{
+	// Some selection within the budget reaches the target; no solve needed.
+	definitely_yes,
+
+	// Even the fractional relaxation falls short of the target.
+	definitely_no,
+
+	// The target lies between the bounds; run an exact solver.
+	needs_exact_solve
+};
+
+
+// Precomputed O(log n) bounds on the best defense reachable within a budget.
+// Built once per catalog in O(n log n): items are sorted by defense per gold,
+// and prefix sums of that order give
+//	- an upper bound: the fractional (Dantzig) relaxation, and
+//	- a lower bound: the better of the greedy prefix and the best single item.
+// Items with no defense are ignored, since they never help.
+class DefenseBounds
+{
+	//
+	public:
+
+		// Walks orders, which must belong to catalog, instead of sorting.
+		DefenseBounds(const ArmorColumns& catalog, const CatalogOrderings& orders)
+		{
+			assert(orders.version == catalog.version() && orders.size() == catalog.size());
+
+			// Most defense per gold first.
+			_prefix_cost.assign(1, 0);
+			_prefix_defense.assign(1, 0);
+			for (size_t i : orders.by_efficiency)
+			{
+				if (catalog.defense(i) > 0)
+				{
+					_prefix_cost.push_back(_prefix_cost.back() + catalog.cost(i));
+					_prefix_defense.push_back(_prefix_defense.back() + catalog.defense(i));
+					_efficiency.push_back(catalog.defense(i) / catalog.cost(i));
+				}
+			}
+
+			// Cheapest first, with the best defense available at or below each cost.
+			for (size_t i : orders.by_cost)
+			{
+				if (catalog.defense(i) > 0)
+				{
+					double best = _best_single_defense.empty() ? 0 : _best_single_defense.back();
+					_single_cost.push_back(catalog.cost(i));
+					_best_single_defense.push_back(max(best, catalog.defense(i)));
+				}
+			}
+		}
+
+		// Orders from CatalogOrderCache::global().
+		explicit DefenseBounds(const ArmorColumns& catalog)
+			:
+			DefenseBounds(catalog, *CatalogOrderCache::global().get(catalog))
+		{}
+
+		// A one-off catalog: sorts it without filling the shared cache.
+		explicit DefenseBounds(const ArmorVector& armors)
+			:
+			DefenseBounds(std::make_shared<ArmorColumns>(armors))
+		{}
+
+		// No selection within budget has more defense than this.
+		double upper_bound(int budget) const
+		{
+			size_t k = greedy_prefix(budget);
+			double bound = _prefix_defense[k];
+			if (k < _efficiency.size())
+			{
+				bound += (budget - _prefix_cost[k]) * _efficiency[k];
+			}
+			return bound;
+		}
+
+		// Some selection within budget has at least this much defense.
+		double lower_bound(int budget) const
+		{
+			double bound = _prefix_defense[greedy_prefix(budget)];
+			auto cheaper = std::upper_bound(_single_cost.begin(), _single_cost.end(), budget);
+			if (cheaper != _single_cost.begin())
+			{
+				bound = max(bound, _best_single_defense[cheaper - _single_cost.begin() - 1]);
+			}
+			return bound;
+		}
+
+		// Can some selection costing at most budget gold reach target_defense?
+		// Bounds are widened by a relative tolerance so that rounding in either
+		// summation order never turns a borderline case into a wrong verdict.
+		Feasibility check(int budget, double target_defense) const
+		{
+			if (budget < 0)
+			{
+				return Feasibility::definitely_no;
+			}
+
+			double upper = upper_bound(budget);
+			double lower = lower_bound(budget);
+			double slack = tolerance * max(upper, 1);
+
+			if (target_defense <= lower - slack)
+			{
+				return Feasibility::definitely_yes;
+			}
+			if (target_defense > upper + slack)
+			{
+				return Feasibility::definitely_no;
+			}
+			return Feasibility::needs_exact_solve;
+		}
+
+	//
+	private:
+
+		//
+		explicit DefenseBounds(const std::shared_ptr<const ArmorColumns>& catalog)
+			:
+			DefenseBounds(*catalog, CatalogOrderings(*catalog))
+		{}
+
+		// Number of leading items, in efficiency order, that fit within budget together.
+		size_t greedy_prefix(int budget) const
+		{
+			return std::upper_bound(_prefix_cost.begin(), _prefix_cost.end(), int64_t(budget)) - _prefix_cost.begin() - 1;
+		}
+
+		static constexpr double tolerance = 1e-9;
+
+		// Efficiency order: _prefix_*[k] sums the first k items; _efficiency[k] is item k's defense per gold.
+		std::vector<int64_t> _prefix_cost;
+		std::vector<double> _prefix_defense;
+		std::vector<double> _efficiency;
+
+		// Cost order: _best_single_defense[k] is the best defense among the first k + 1 items.
+		std::vector<int> _single_cost;
+		std::vector<double> _best_single_defense;
+};
+
+
+// Answer of greedy_half_max_defense_indices. The chosen items are
+// indices[0, count), which points into the workspace's index buffer and
+// stays valid until the workspace is used again.
+struct GreedyChoice
+{
+	const uint32_t* indices = nullptr;
+	size_t count = 0;
+	int64_t total_cost = 0;
+	double total_defense = 0;
+};
+
+
+// 1/2-approximation in O(n) expected time: the better of the greedy prefix in
+// defense-per-gold order and the best single item that fits. Together they
+// hold at least the fractional optimum, so one of them has at least half of
+// it. The prefix is found without sorting, by quickselect on efficiency
+// weighted by cost: partition around the median, keep every item above it if
+// they all fit and look among the rest, otherwise look among them. The median
+// comes from std::nth_element, whose introselect falls back to heap selection
+// on inputs built to defeat its pivots, so no input order makes this worse than
+// O(n log n), and each round at least halves the range. Items of the break
+// efficiency are taken in catalog order, as the by_efficiency walk does. Uses
+// only the workspace's index buffer.
+//
+// Given the catalog's orders, it walks them instead: the prefix is read off
+// by_efficiency and the best single is the first affordable item of
+// by_defense, so the work is proportional to the items looked at.
+GreedyChoice greedy_half_max_defense_indices
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t n,
+	int total_cost,
+	SolverWorkspace& workspace,
+	const CatalogOrderings* orders = nullptr
+)
+{
+	uint32_t* items = workspace.indices(std::max<size_t>(n, 1));
+	GreedyChoice choice;
+	choice.indices = items;
+	if (total_cost < 0)
+	{
+		return choice;
+	}
+
+	if (orders)
+	{
+		assert(orders->size() == n);
+		for (uint32_t i : orders->by_efficiency)
+		{
+			if (defenses[i] <= 0)
+			{
+				break;
+			}
+			if (costs[i] > total_cost)
+			{
+				continue;
+			}
+			if (choice.total_cost + costs[i] > total_cost)
+			{
+				break;
+			}
+			items[choice.count++] = i;
+			choice.total_cost += costs[i];
+			choice.total_defense += defenses[i];
+		}
+		for (uint32_t i : orders->by_defense)
+		{
+			if (defenses[i] <= choice.total_defense)
+			{
+				break;
+			}
+			if (costs[i] <= total_cost)
+			{
+				items[0] = i;
+				choice.count = 1;
+				choice.total_cost = costs[i];
+				choice.total_defense = defenses[i];
+				break;
+			}
+		}
+		return choice;
+	}
+
+	// Only items that help and fit on their own; remember the best of them.
+	size_t m = 0;
+	size_t best_single = n;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (defenses[i] > 0 && costs[i] <= total_cost)
+		{
+			items[m++] = i;
+			if (best_single == n || defenses[i] > defenses[best_single])
+			{
+				best_single = i;
+			}
+		}
+	}
+
+	// a is more efficient than b; cross-multiplied, so free items come first.
+	auto compare = [&](uint32_t a, uint32_t b)
+	{
+		double left = defenses[a] * costs[b], right = defenses[b] * costs[a];
+		return left > right ? 1 : left < right ? -1 : 0;
+	};
+	auto more_efficient = [&](uint32_t a, uint32_t b) { return compare(a, b) > 0; };
+
+	// items[0, taken) is the prefix so far; the break item lies in [taken, end).
+	size_t taken = 0, end = m;
+	int64_t room = total_cost;
+	while (taken < end)
+	{
+		size_t mid = taken + (end - taken) / 2;
+		std::nth_element(items + taken, items + mid, items + end, more_efficient);
+		uint32_t pivot = items[mid];
+
+		// Three-way partition: [taken, above) more efficient than the pivot,
+		// [above, below) as efficient, [below, end) less.
+		size_t above = taken, scan = taken, below = end;
+		int64_t above_cost = 0;
+		while (scan < below)
+		{
+			int order = compare(items[scan], pivot);
+			if (order > 0)
+			{
+				above_cost += costs[items[scan]];
+				std::swap(items[above++], items[scan++]);
+			}
+			else if (order < 0)
+			{
+				std::swap(items[scan], items[--below]);
+			}
+			else
+			{
+				scan++;
+			}
+		}
+
+		if (above_cost > room)
+		{
+			end = above;
+			continue;
+		}
+		room -= above_cost;
+		taken = above;
+
+		// Equal efficiency: any order is as good; catalog order keeps the
+		// answer independent of how the partitions left them.
+		std::sort(items + taken, items + below);
+		while (taken < below && costs[items[taken]] <= room)
+		{
+			room -= costs[items[taken++]];
+		}
+		if (taken < below)
+		{
+			break;
+		}
+	}
+
+	for (size_t k = 0; k < taken; k++)
+	{
+		choice.total_cost += costs[items[k]];
+		choice.total_defense += defenses[items[k]];
+	}
+	choice.count = taken;
+	if (best_single != n && defenses[best_single] > choice.total_defense)
+	{
+		items[0] = best_single;
+		choice.count = 1;
+		choice.total_cost = costs[best_single];
+		choice.total_defense = defenses[best_single];
+	}
+	return choice;
+}
+
+
+// greedy_half_max_defense_indices on a columnar catalog, walking its orders
+// from CatalogOrderCache::global(); only the chosen rows are materialized.
+// Without a workspace, the calling thread's own is used.
+std::unique_ptr<ArmorVector> greedy_half_max_defense
+(
+	const ArmorColumns& armors,
+	int total_cost,
+	SolverWorkspace* workspace = nullptr
+)
+{
+	SolverWorkspace& scratch = workspace ? *workspace : SolverWorkspace::this_thread();
+	std::shared_ptr<const CatalogOrderings> orders = CatalogOrderCache::global().get(armors);
+	GreedyChoice choice = greedy_half_max_defense_indices(armors.costs(), armors.defenses(), armors.size(), total_cost, scratch, orders.get());
+	return armors.select(std::vector<size_t>(choice.indices, choice.indices + choice.count));
+}
+
+
+// Same as above, for an ArmorVector; costs and defenses are gathered into the workspace.
+std::unique_ptr<ArmorVector> greedy_half_max_defense
+(
+	const ArmorVector& armors,
+	int total_cost,
+	SolverWorkspace* workspace = nullptr
+)
+{
+	SolverWorkspace& scratch = workspace ? *workspace : SolverWorkspace::this_thread();
+	int32_t* costs = scratch.costs(armors.size());
+	double* defenses = scratch.defenses(armors.size());
+	for (size_t i = 0; i < armors.size(); i++)
+	{
+		costs[i] = armors[i]->cost();
+		defenses[i] = armors[i]->defense();
+	}
+
+	GreedyChoice choice = greedy_half_max_defense_indices(costs, defenses, armors.size(), total_cost, scratch);
+	std::unique_ptr<ArmorVector> result(new ArmorVector);
+	for (size_t k = 0; k < choice.count; k++)
+	{
+		result->push_back(armors[choice.indices[k]]);
+	}
+	return result;
+}
@@ -1,11 +1,539 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxdefense_main.cc
+//
+// Experiment driver: times the solver variants in maxdefense.hh against the
+// armor.csv catalog.
+//
+///////////////////////////////////////////////////////////////////////////////
 
 
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+
+#include "armor_embedded.hh"
+#include "armorshm.hh"
 #include "maxdefense.hh"
+#include "profiler.hh"
+#include "timer.hh"
 
 
-int main()
+// Compare the memory and time of each ReconstructionStrategy at a few budgets.
+void benchmark_reconstruction(const ArmorVector& armors)
 {
-	return 0;
+	struct Variant
+	{
+		std::string name;
+		ReconstructionStrategy strategy;
+	};
+	const Variant variants[] =
+	{
+		{ "full_table", ReconstructionStrategy::full_table },
+		{ "checkpointed", ReconstructionStrategy::checkpointed },
+		{ "divide_and_conquer", ReconstructionStrategy::divide_and_conquer }
+	};
+
+	std::cout << "*** Reconstruction strategies, n = " << armors.size() << " ***" << std::endl;
+	for (int budget : { 500, 1000, 2000 })
+	{
+		for (auto& variant : variants)
+		{
+			DynamicStats stats;
+			DynamicOptions options;
+			options.reconstruction = variant.strategy;
+			options.stats = &stats;
+
+			Timer timer;
+			auto solution = dynamic_max_defense(armors, budget, options);
+			double elapsed = timer.elapsed();
+
+			int cost;
+			double defense;
+			sum_armor_vector(*solution, cost, defense);
+			std::cout
+				<< "budget " << std::setw(5) << budget
+				<< "  " << std::setw(18) << variant.name
+				<< "  " << std::fixed << std::setprecision(4) << elapsed << " s"
+				<< "  rows stored " << std::setw(5) << stats.rows_stored
+				<< "  cells " << std::setw(9) << stats.cells_computed
+				<< "  defense " << std::setprecision(2) << defense
+				<< std::endl
+				;
+		}
+	}
+	std::cout << std::endl;
+}
+
+
+// Compare one dynamic_max_defense call per small catalog with the lane-batched engine.
+void benchmark_batch(const ArmorVector& armors)
+{
+	const size_t merchant_count = 512, merchant_size = 40;
+	const int budget = 300;
+
+	std::vector<std::unique_ptr<ArmorVector>> merchants;
+	std::vector<const ArmorVector*> catalogs;
+	for (size_t m = 0; m < merchant_count && (m + 1) * merchant_size <= armors.size(); m++)
+	{
+		auto first = armors.begin() + m * merchant_size;
+		merchants.emplace_back(new ArmorVector(first, first + merchant_size));
+		catalogs.push_back(merchants.back().get());
+	}
+
+	// Both runs take well under a tenth of a second, so keep the best of a few.
+	const int repeats = 5;
+	double single_elapsed = 0, batch_elapsed = 0;
+	for (int r = 0; r < repeats; r++)
+	{
+		Timer timer;
+		for (auto catalog : catalogs)
+		{
+			dynamic_max_defense(*catalog, budget);
+		}
+		double elapsed = timer.elapsed();
+		single_elapsed = r ? std::min(single_elapsed, elapsed) : elapsed;
+
+		timer.reset();
+		batch_dynamic_max_defense(catalogs, budget);
+		elapsed = timer.elapsed();
+		batch_elapsed = r ? std::min(batch_elapsed, elapsed) : elapsed;
+	}
+
+	std::cout
+		<< "*** Batch solving, " << catalogs.size() << " catalogs of " << merchant_size << " items, budget " << budget << " ***" << std::endl
+		<< "one at a time  " << std::fixed << std::setprecision(4) << single_elapsed << " s" << std::endl
+		<< "batched        " << batch_elapsed << " s"
+		<< "  (" << std::setprecision(1) << single_elapsed / batch_elapsed << "x over one at a time, "
+		<< batch_lanes << " lanes)" << std::endl
+		<< std::endl
+		;
+}
+
+
+// Compare load times of the ArmorVector loader and the columnar loader modes.
+void benchmark_loading()
+{
+	const int repeats = 5;
+
+	Timer timer;
+	for (int r = 0; r < repeats; r++)
+	{
+		load_armor_database("armor.csv");
+	}
+	double vector_elapsed = timer.elapsed() / repeats;
+
+	timer.reset();
+	for (int r = 0; r < repeats; r++)
+	{
+		load_armor_columns("armor.csv", DescriptionLoading::eager);
+	}
+	double eager_elapsed = timer.elapsed() / repeats;
+
+	timer.reset();
+	for (int r = 0; r < repeats; r++)
+	{
+		load_armor_columns("armor.csv", DescriptionLoading::lazy);
+	}
+	double lazy_elapsed = timer.elapsed() / repeats;
+
+	// What a second process pays once the first has published the catalog.
+	const std::string segment = "/maxdefense_experiment";
+	double attach_elapsed = 0;
+	auto columns = load_armor_columns("armor.csv", DescriptionLoading::eager);
+	if (columns && publish_armor_shm(segment, *columns, 1))
+	{
+		timer.reset();
+		for (int r = 0; r < repeats; r++)
+		{
+			attach_armor_shm(segment);
+		}
+		attach_elapsed = timer.elapsed() / repeats;
+		unpublish_armor_shm(segment);
+	}
+
+	timer.reset();
+	for (int r = 0; r < repeats; r++)
+	{
+		embedded_armor_columns();
+	}
+	double embedded_elapsed = timer.elapsed() / repeats;
+
+	std::cout
+		<< "*** Loading armor.csv ***" << std::endl
+		<< "load_armor_database        " << std::fixed << std::setprecision(4) << vector_elapsed << " s" << std::endl
+		<< "load_armor_columns eager   " << eager_elapsed << " s" << std::endl
+		<< "load_armor_columns lazy    " << lazy_elapsed << " s" << std::endl
+		<< "attach_armor_shm           " << std::setprecision(6) << attach_elapsed << " s" << std::endl
+		<< "embedded_armor_columns     " << embedded_elapsed << " s" << std::endl
+		<< std::endl
+		;
+}
+
+
+// Time feasibility pre-checks against the exact solve they avoid.
+void benchmark_bounds(const ArmorVector& armors)
+{
+	Timer timer;
+	DefenseBounds bounds(armors);
+	double build_elapsed = timer.elapsed();
+
+	const int queries = 100000;
+	int decided = 0;
+	timer.reset();
+	for (int q = 0; q < queries; q++)
+	{
+		int budget = 100 + q % 4900;
+		double target = 15 * budget + (q % 7) * budget;
+		if (bounds.check(budget, target) != Feasibility::needs_exact_solve)
+		{
+			decided++;
+		}
+	}
+	double query_elapsed = timer.elapsed();
+
+	std::cout
+		<< "*** Feasibility bounds, n = " << armors.size() << " ***" << std::endl
+		<< "build                 " << std::fixed << std::setprecision(4) << build_elapsed << " s" << std::endl
+		<< "per check             " << std::setprecision(3) << query_elapsed / queries * 1e6 << " us" << std::endl
+		<< "decided without solve " << decided << " / " << queries << std::endl
+		<< std::endl
+		;
+}
+
+
+// Compare the item-by-item DP with the per-cost-class concave DP.
+void benchmark_cost_classes(const ArmorVector& armors)
+{
+	std::cout << "*** Cost-class DP, n = " << armors.size() << " ***" << std::endl;
+	for (int budget : { 500, 2000, 5000 })
+	{
+		DynamicStats dynamic_stats, class_stats;
+		DynamicOptions options;
+		options.reconstruction = ReconstructionStrategy::checkpointed;
+		options.stats = &dynamic_stats;
+
+		Timer timer;
+		dynamic_max_defense(armors, budget, options);
+		double dynamic_elapsed = timer.elapsed();
+
+		timer.reset();
+		cost_class_max_defense(armors, budget, &class_stats);
+		double class_elapsed = timer.elapsed();
+
+		std::cout
+			<< "budget " << std::setw(5) << budget
+			<< "  per item " << std::fixed << std::setprecision(4) << dynamic_elapsed << " s"
+			<< "  per class " << class_elapsed << " s"
+			<< "  cells " << dynamic_stats.cells_computed << " vs " << class_stats.cells_computed
+			<< std::endl
+			;
+	}
+	std::cout << std::endl;
+}
+
+
+// Report how much of the DP table the reachable-column windows skip.
+void benchmark_column_windows(const ArmorVector& armors)
+{
+	std::cout << "*** Column windows ***" << std::endl;
+	for (size_t n : { size_t(50), size_t(200), armors.size() })
+	{
+		auto subset = filter_armor_vector(armors, 0, 1e9, n);
+		for (int budget : { 500, 2000 })
+		{
+			Timer full_timer;
+			dynamic_max_defense(*subset, budget);
+			double full_elapsed = full_timer.elapsed();
+
+			for (bool ordered : { false, true })
+			{
+				DynamicStats stats;
+				DynamicOptions options;
+				options.bound_columns = true;
+				options.order_for_windows = ordered;
+				options.stats = &stats;
+
+				Timer timer;
+				dynamic_max_defense(*subset, budget, options);
+				double elapsed = timer.elapsed();
+
+				std::cout
+					<< "n " << std::setw(5) << subset->size()
+					<< "  budget " << std::setw(5) << budget
+					<< (ordered ? "  cheap-ends order" : "  catalog order   ")
+					<< "  computed " << std::fixed << std::setprecision(1) << 100 * stats.fraction_computed() << "% of cells"
+					<< "  windowed " << std::setprecision(4) << elapsed << " s"
+					<< "  full table " << full_elapsed << " s"
+					<< std::endl
+					;
+			}
+		}
+	}
+	std::cout << std::endl;
 }
 
 
+// Compare offline timeline answering with a fresh solve per query.
+void benchmark_timeline(const ArmorVector& armors)
+{
+	const size_t steps = 4000;
+	const int budget = 1000;
+
+	// Add items steadily, remove the oldest live one now and then, query often.
+	CatalogTimeline timeline;
+	std::vector<ArmorVector> snapshots;
+	ArmorVector alive;
+	std::vector<size_t> alive_ids;
+	for (size_t step = 0; step < steps && step < armors.size(); step++)
+	{
+		alive_ids.push_back(timeline.add_item(armors[step]));
+		alive.push_back(armors[step]);
+		if (step % 3 == 0)
+		{
+			timeline.remove_item(alive_ids.front());
+			alive_ids.erase(alive_ids.begin());
+			alive.erase(alive.begin());
+		}
+		if (step % 20 == 0)
+		{
+			timeline.query(budget);
+			snapshots.push_back(alive);
+		}
+	}
+
+	Timer timer;
+	timeline.solve();
+	double offline_elapsed = timer.elapsed();
+
+	timer.reset();
+	for (auto& snapshot : snapshots)
+	{
+		DynamicOptions options;
+		options.reconstruction = ReconstructionStrategy::divide_and_conquer;
+		dynamic_max_defense(snapshot, budget, options);
+	}
+	double resolve_elapsed = timer.elapsed();
+
+	std::cout
+		<< "*** Catalog timeline, " << steps << " events, " << snapshots.size() << " queries, budget " << budget << " ***" << std::endl
+		<< "offline segment tree  " << std::fixed << std::setprecision(4) << offline_elapsed << " s" << std::endl
+		<< "resolve per query     " << resolve_elapsed << " s" << std::endl
+		<< std::endl
+		;
+}
+
+
+// Time what-if evaluation of candidate items against the resident final row.
+void benchmark_what_if(const ArmorVector& armors)
+{
+	const int max_budget = 5000;
+	ArmorVector candidates(armors.end() - 500, armors.end());
+	ArmorVector shop(armors.begin(), armors.end() - 500);
+
+	Timer timer;
+	WhatIfEvaluator what_if(shop, max_budget);
+	double build_elapsed = timer.elapsed();
+
+	timer.reset();
+	what_if.evaluate(candidates, max_budget);
+	double single_elapsed = timer.elapsed();
+
+	timer.reset();
+	what_if.evaluate_all_budgets(candidates);
+	double all_elapsed = timer.elapsed();
+
+	std::cout
+		<< "*** What-if, " << candidates.size() << " candidates, shop of " << shop.size() << " ***" << std::endl
+		<< "build final row       " << std::fixed << std::setprecision(4) << build_elapsed << " s" << std::endl
+		<< "one budget each       " << single_elapsed << " s" << std::endl
+		<< "all budgets each      " << all_elapsed << " s" << std::endl
+		<< std::endl
+		;
+}
+
+
+// Compare the double and float32 full-table engines.
+void benchmark_float32(const ArmorVector& armors)
+{
+	std::cout << "*** float32 DP, n = " << armors.size() << " ***" << std::endl;
+	for (int budget : { 500, 2000 })
+	{
+		Timer timer;
+		dynamic_max_defense(armors, budget);
+		double double_elapsed = timer.elapsed();
+
+		Float32Stats stats;
+		timer.reset();
+		float32_max_defense(armors, budget, &stats);
+		double float_elapsed = timer.elapsed();
+
+		std::cout
+			<< "budget " << std::setw(5) << budget
+			<< "  double " << std::fixed << std::setprecision(4) << double_elapsed << " s"
+			<< "  float32 " << float_elapsed << " s"
+			<< "  error bound " << std::scientific << std::setprecision(2) << stats.error_bound << std::fixed
+			<< "  re-solved in double " << stats.items_resolved_in_double << " items"
+			<< (stats.exact ? ", fixed point" : "")
+			<< std::endl
+			;
+	}
+	std::cout << std::endl;
+}
+
+
+// Compare query streams with and without a reused SolverWorkspace.
+// glibc recycles freed blocks of these sizes, so the two are expected to
+// be close; what reuse buys is a bounded footprint the service can count.
+void benchmark_workspace(const ArmorVector& armors)
+{
+	const int queries = 2000;
+	std::cout << "*** Solver workspace, " << queries << " queries, budgets 200-499 ***" << std::endl;
+	for (size_t n : { 30, 200 })
+	{
+		auto subset = filter_armor_vector(armors, 0, 1e9, n);
+
+		Timer timer;
+		for (int q = 0; q < queries; q++)
+		{
+			dynamic_max_defense(*subset, 200 + q % 300);
+		}
+		double fresh_elapsed = timer.elapsed();
+
+		SolverWorkspace workspace;
+		DynamicOptions options;
+		options.workspace = &workspace;
+		timer.reset();
+		for (int q = 0; q < queries; q++)
+		{
+			dynamic_max_defense(*subset, 200 + q % 300, options);
+		}
+		double reused_elapsed = timer.elapsed();
+
+		std::cout
+			<< "n = " << std::setw(4) << subset->size()
+			<< "  per-call workspace " << std::fixed << std::setprecision(4) << fresh_elapsed << " s"
+			<< "  reused " << reused_elapsed << " s"
+			<< "  (" << std::setprecision(2) << fresh_elapsed / reused_elapsed << "x, "
+			<< workspace.capacity_bytes() / 1024 << " KiB held)" << std::endl
+			;
+	}
+	std::cout << std::endl;
+}
+
+
+// Measure what recording latencies costs per query.
+void benchmark_metrics(const ArmorVector& armors)
+{
+	const int records = 10000000, queries = 20000;
+
+	// The record alone, then with the two clock reads of a timed scope.
+	LatencyHistogram histogram;
+	Timer timer;
+	for (int r = 0; r < records; r++)
+	{
+		histogram.record(r & 0xfffff);
+	}
+	double record_elapsed = timer.elapsed();
+
+	timer.reset();
+	for (int r = 0; r < records; r++)
+	{
+		ScopedLatency latency(&histogram);
+	}
+	double scope_elapsed = timer.elapsed();
+
+	auto subset = filter_armor_vector(armors, 0, 1e9, 30);
+	DynamicOptions plain;
+	plain.workspace = &SolverWorkspace::this_thread();
+	DynamicOptions instrumented = plain;
+	instrumented.metrics = &SolverMetrics::global();
+
+	// Everything a recorded query adds: the histogram lookup, the timed
+	// scope, and the cells counter.
+	SolverMetrics scratch;
+	DynamicOptions recorded = plain;
+	recorded.metrics = &scratch;
+	timer.reset();
+	for (int r = 0; r < records; r++)
+	{
+		ScopedLatency latency(dynamic_phase_histogram(recorded, DynamicPhase::solve));
+		scratch.cells_computed.add(r);
+	}
+	double query_cost = timer.elapsed() / records * 1e9;
+
+	timer.reset();
+	for (int q = 0; q < queries; q++)
+	{
+		dynamic_max_defense(*subset, 200 + q % 300, plain);
+	}
+	double plain_elapsed = timer.elapsed();
+
+	timer.reset();
+	for (int q = 0; q < queries; q++)
+	{
+		dynamic_max_defense(*subset, 200 + q % 300, instrumented);
+	}
+	double instrumented_elapsed = timer.elapsed();
+
+	LatencyHistogram& solve = SolverMetrics::global().histogram("full_table", "solve");
+	std::cout
+		<< "*** Metrics, " << queries << " queries, n = " << subset->size() << " ***" << std::endl
+		<< "per record            " << std::fixed << std::setprecision(1) << record_elapsed / records * 1e9 << " ns" << std::endl
+		<< "per timed scope       " << scope_elapsed / records * 1e9 << " ns" << std::endl
+		<< "recording per query   " << query_cost << " ns (target 50 ns)" << std::endl
+		<< "per query, plain      " << plain_elapsed / queries * 1e9 << " ns" << std::endl
+		<< "per query, recorded   " << instrumented_elapsed / queries * 1e9 << " ns" << std::endl
+		<< "solve p50 / p99       " << solve.percentile(0.5) << " / " << solve.percentile(0.99) << " ns" << std::endl
+		<< std::endl
+		;
+}
+
+
+int main()
+{
+	// MAXDEFENSE_PROFILE=out.folded samples the whole run for a flamegraph.
+	SamplingProfiler profiler;
+	const char* profile_path = std::getenv("MAXDEFENSE_PROFILE");
+	if (profile_path)
+	{
+		profiler.start();
+	}
+
+	auto all_armors = load_armor_database("armor.csv");
+	if ( ! all_armors )
+	{
+		return 1;
+	}
+
+	auto filtered_armors = filter_armor_vector(*all_armors, 1, 2500, all_armors->size());
+
+	// kill -USR1 prints the metrics; MAXDEFENSE_METRICS_SOCKET also serves them.
+	auto metrics_dump = dump_metrics_on_signal(SolverMetrics::global());
+	std::unique_ptr<MetricsServer> metrics_server;
+	if (const char* socket_path = std::getenv("MAXDEFENSE_METRICS_SOCKET"))
+	{
+		metrics_server = serve_metrics(SolverMetrics::global(), socket_path);
+	}
+
+	benchmark_loading();
+	benchmark_reconstruction(*filtered_armors);
+	benchmark_batch(*filtered_armors);
+	benchmark_bounds(*filtered_armors);
+	benchmark_cost_classes(*filtered_armors);
+	benchmark_column_windows(*filtered_armors);
+	benchmark_timeline(*filtered_armors);
+	benchmark_what_if(*filtered_armors);
+	benchmark_float32(*filtered_armors);
+	benchmark_workspace(*filtered_armors);
+	benchmark_metrics(*filtered_armors);
+
+	if (profile_path)
+	{
+		profiler.stop();
+		profiler.write_folded(profile_path);
+	}
+
+	return 0;
+}
@@ -7,11 +7,25 @@
 
 
 #include <cassert>
+#include <cstdio>
+#include <set>
 #include <sstream>
 
+#include <sys/wait.h>
 
+
+#include "armor_embedded.hh"
+#include "armorarrow.hh"
+#include "armorshm.hh"
 #include "maxdefense.hh"
+#include "party.hh"
+#include "profiler.hh"
+#include "querycapture.hh"
+#include "resultring.hh"
 #include "rubrictest.hh"
+#include "solverservice.hh"
+#include "speculation.hh"
+#include "tenants.hh"
 
 
 int main()
@@ -206,6 +220,1731 @@ int main()
 		}
 	);
 	
+	//
+	rubric.criterion(
+		"Arrow IPC catalog round trip", 2,
+		[&]()
+		{
+			ArmorColumns columns(*filtered_armors);
+			TEST_EQUAL("column size", filtered_armors->size(), columns.size());
+			TEST_EQUAL("column contents", (*filtered_armors)[7]->description(), columns.description(7));
+			
+			// Per process, so concurrent test runs do not replace each other's file.
+			std::string path = "maxdefense_test." + std::to_string(::getpid()) + ".arrow";
+			TEST_TRUE("save catalog", save_armor_arrow(path, columns));
+			auto loaded = load_armor_arrow(path);
+			TEST_TRUE("non-null", loaded);
+			TEST_EQUAL("size", columns.size(), loaded->size());
+			for (size_t i = 0; i < columns.size(); i++)
+			{
+				TEST_EQUAL("cost", columns.cost(i), loaded->cost(i));
+				TEST_EQUAL("defense", columns.defense(i), loaded->defense(i));
+				TEST_EQUAL("description", columns.description(i), loaded->description(i));
+			}
+			
+			int vector_cost, columns_cost;
+			double vector_defense, columns_defense;
+			sum_armor_vector(*dynamic_max_defense(*filtered_armors, 500), vector_cost, vector_defense);
+			sum_armor_vector(*dynamic_max_defense(*loaded, 500), columns_cost, columns_defense);
+			TEST_EQUAL("solve on mapped columns", vector_cost, columns_cost);
+			TEST_EQUAL("solve on mapped columns", vector_defense, columns_defense);
+			
+			// Solver outputs round trip too. Saving replaces the file, so the
+			// catalog mapped above stays readable.
+			TEST_TRUE("save solution", save_armor_arrow(path, trivial_armors));
+			TEST_EQUAL("old mapping intact", columns.description(columns.size() - 1), loaded->description(columns.size() - 1));
+			loaded = load_armor_arrow(path);
+			TEST_TRUE("non-null", loaded);
+			TEST_EQUAL("solution size", 2, loaded->size());
+			TEST_EQUAL("solution contents", "test boots", loaded->description(1));
+			std::remove(path.c_str());
+			
+			TEST_FALSE("missing file", load_armor_arrow("no_such_file.arrow"));
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"dynamic_max_defense reconstruction strategies", 2,
+		[&]()
+		{
+			for (int budget : { 9, 14, 500, 2000 })
+			{
+				const ArmorVector& armors = budget < 100 ? trivial_armors : *filtered_armors;
+				
+				DynamicStats full_stats, checkpointed_stats, split_stats;
+				DynamicOptions options;
+				options.stats = &full_stats;
+				auto full = dynamic_max_defense(armors, budget, options);
+				
+				options.reconstruction = ReconstructionStrategy::checkpointed;
+				options.stats = &checkpointed_stats;
+				auto checkpointed = dynamic_max_defense(armors, budget, options);
+				
+				options.reconstruction = ReconstructionStrategy::divide_and_conquer;
+				options.stats = &split_stats;
+				auto split = dynamic_max_defense(armors, budget, options);
+				
+				TEST_TRUE("non-null", full && checkpointed && split);
+				TEST_EQUAL("checkpointed picks the same items", full->size(), checkpointed->size());
+				for (size_t i = 0; i < full->size(); i++)
+				{
+					TEST_EQUAL("checkpointed picks the same items", (*full)[i], (*checkpointed)[i]);
+				}
+				
+				int full_cost, split_cost;
+				double full_defense, split_defense;
+				sum_armor_vector(*full, full_cost, full_defense);
+				sum_armor_vector(*split, split_cost, split_defense);
+				TEST_LE("divide and conquer within budget", split_cost, budget);
+				TEST_EQUAL("divide and conquer optimal", std::round(full_defense * 100), std::round(split_defense * 100));
+				
+				if (armors.size() > 100)
+				{
+					TEST_LT("checkpointed stores fewer rows", checkpointed_stats.rows_stored, full_stats.rows_stored / 10);
+				}
+				TEST_EQUAL("checkpointed recomputes each row once", 2 * full_stats.cells_computed, checkpointed_stats.cells_computed);
+			}
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"batch_dynamic_max_defense matches per-catalog solves", 2,
+		[&]()
+		{
+			// 19 ragged catalogs: three full groups of lanes and a partial one.
+			std::vector<std::unique_ptr<ArmorVector>> merchants;
+			std::vector<const ArmorVector*> catalogs;
+			size_t next = 0;
+			for (size_t m = 0; m < 19; m++)
+			{
+				size_t count = 5 + (m * 7) % 30;
+				merchants.emplace_back(new ArmorVector(filtered_armors->begin() + next, filtered_armors->begin() + next + count));
+				catalogs.push_back(merchants.back().get());
+				next += count;
+			}
+			catalogs.push_back(&trivial_armors);
+			
+			for (int budget : { 9, 14, 300 })
+			{
+				auto batch = batch_dynamic_max_defense(catalogs, budget);
+				TEST_EQUAL("one solution per catalog", catalogs.size(), batch.size());
+				for (size_t m = 0; m < catalogs.size(); m++)
+				{
+					auto single = dynamic_max_defense(*catalogs[m], budget);
+					TEST_EQUAL("same items", single->size(), batch[m]->size());
+					for (size_t i = 0; i < single->size(); i++)
+					{
+						TEST_EQUAL("same items", (*single)[i], (*batch[m])[i]);
+					}
+				}
+			}
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"load_armor_columns eager and lazy", 2,
+		[&]()
+		{
+			auto eager = load_armor_columns("armor.csv", DescriptionLoading::eager);
+			auto lazy = load_armor_columns("armor.csv", DescriptionLoading::lazy);
+			TEST_TRUE("non-null", eager && lazy);
+			TEST_EQUAL("size", all_armors->size(), eager->size());
+			TEST_EQUAL("size", all_armors->size(), lazy->size());
+			TEST_TRUE("layout", eager->layout() == DescriptionLayout::packed);
+			TEST_TRUE("layout", lazy->layout() == DescriptionLayout::delimited);
+			for (size_t i = 0; i < all_armors->size(); i++)
+			{
+				TEST_EQUAL("cost", (*all_armors)[i]->cost(), lazy->cost(i));
+				TEST_EQUAL("defense", (*all_armors)[i]->defense(), lazy->defense(i));
+				TEST_EQUAL("eager description", (*all_armors)[i]->description(), eager->description(i));
+				TEST_EQUAL("lazy description", (*all_armors)[i]->description(), lazy->description(i));
+			}
+			
+			ArmorColumns packed = lazy->packed();
+			TEST_EQUAL("packed description", (*all_armors)[8063]->description(), packed.description(8063));
+			
+			auto solution = dynamic_max_defense(*lazy, 14);
+			TEST_TRUE("solution materialized", !solution->empty() && !solution->front()->description().empty());
+			
+			TEST_FALSE("missing file", load_armor_columns("no_such_file.csv"));
+			
+			// Odd rows load as load_armor_database loads them, except rows with no
+			// description or costing under 1 gold, which the columns skip and which
+			// load_armor_database cannot load at all.
+			std::string path = "maxdefense_test." + std::to_string(::getpid()) + ".csv";
+			const std::string rows = "header^cost^defense\nplain^5^3\nbad defense^6^x\nlast^7^1.5";
+			std::ofstream(path) << rows;
+			auto database = load_armor_database(path);
+			std::ofstream(path) << rows.substr(0, rows.find("last")) << "free^0^9\nbad cost^x^2\n^4^2\n" << rows.substr(rows.find("last"));
+			for (auto loading : { DescriptionLoading::eager, DescriptionLoading::lazy })
+			{
+				auto odd = load_armor_columns(path, loading);
+				TEST_TRUE("odd rows loaded", database && odd && odd->size() == 3 && database->size() == 3);
+				for (size_t i = 0; i < odd->size(); i++)
+				{
+					TEST_EQUAL("odd cost", (*database)[i]->cost(), odd->cost(i));
+					TEST_EQUAL("odd defense", (*database)[i]->defense(), odd->defense(i));
+					TEST_EQUAL("odd description", (*database)[i]->description(), odd->description(i));
+				}
+			}
+			std::remove(path.c_str());
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"DefenseBounds brackets the optimum", 2,
+		[&]()
+		{
+			DefenseBounds bounds(*filtered_armors);
+			for (int budget : { 0, 5, 6, 100, 500, 2000 })
+			{
+				int cost;
+				double best;
+				sum_armor_vector(*dynamic_max_defense(*filtered_armors, budget), cost, best);
+				
+				TEST_LE("lower bound", bounds.lower_bound(budget), best + 1e-6);
+				TEST_GE("upper bound", bounds.upper_bound(budget), best - 1e-6);
+				
+				TEST_TRUE("optimum is reachable", bounds.check(budget, best) != Feasibility::definitely_no);
+				TEST_TRUE("beyond the optimum is not", bounds.check(budget, best + 1) != Feasibility::definitely_yes);
+				TEST_TRUE("above upper bound", bounds.check(budget, bounds.upper_bound(budget) + 1) == Feasibility::definitely_no);
+				TEST_TRUE("below lower bound", bounds.check(budget, bounds.lower_bound(budget) - 1) == Feasibility::definitely_yes || budget < 6);
+			}
+			
+			DefenseBounds trivial(trivial_armors);
+			TEST_EQUAL("trivial lower bound", 25, trivial.lower_bound(14));
+			TEST_EQUAL("trivial upper bound", 25, trivial.upper_bound(14));
+			TEST_EQUAL("trivial best single", 20, trivial.lower_bound(10));
+			TEST_TRUE("trivial reachable", trivial.check(14, 24.5) == Feasibility::definitely_yes);
+			TEST_TRUE("trivial over", trivial.check(14, 25.5) == Feasibility::definitely_no);
+			TEST_TRUE("negative budget", trivial.check(-1, 0) == Feasibility::definitely_no);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"cost_class_max_defense matches dynamic_max_defense", 2,
+		[&]()
+		{
+			for (int budget : { 3, 9, 10, 14 })
+			{
+				int dynamic_cost, class_cost;
+				double dynamic_defense, class_defense;
+				sum_armor_vector(*dynamic_max_defense(trivial_armors, budget), dynamic_cost, dynamic_defense);
+				sum_armor_vector(*cost_class_max_defense(trivial_armors, budget), class_cost, class_defense);
+				TEST_EQUAL("trivial defense", dynamic_defense, class_defense);
+			}
+			
+			for (int budget : { 5, 6, 107, 500, 2000 })
+			{
+				DynamicStats dynamic_stats, class_stats;
+				DynamicOptions options;
+				options.stats = &dynamic_stats;
+				
+				int dynamic_cost, class_cost;
+				double dynamic_defense, class_defense;
+				sum_armor_vector(*dynamic_max_defense(*filtered_armors, budget, options), dynamic_cost, dynamic_defense);
+				sum_armor_vector(*cost_class_max_defense(*filtered_armors, budget, &class_stats), class_cost, class_defense);
+				
+				TEST_LE("within budget", class_cost, budget);
+				TEST_EQUAL("same defense", std::round(dynamic_defense * 100), std::round(class_defense * 100));
+				TEST_LE("fewer cells", class_stats.cells_computed, dynamic_stats.cells_computed);
+			}
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"dynamic_max_defense column windows", 2,
+		[&]()
+		{
+			std::vector<std::pair<const ArmorVector*, int>> cases =
+			{
+				{ &trivial_armors, 9 }, { &trivial_armors, 14 }, { &trivial_armors, 100 },
+				{ filtered_armors.get(), 500 }, { filtered_armors.get(), 2000 }
+			};
+			auto fifty = filter_armor_vector(*filtered_armors, 1, 2500, 50);
+			cases.push_back({ fifty.get(), 1000 });
+			cases.push_back({ fifty.get(), 2500 });
+			cases.push_back({ fifty.get(), 100000 });
+			
+			for (auto& test : cases)
+			{
+				const ArmorVector& armors = *test.first;
+				int budget = test.second;
+				auto full = dynamic_max_defense(armors, budget);
+				
+				DynamicStats stats;
+				DynamicOptions options;
+				options.bound_columns = true;
+				options.stats = &stats;
+				auto windowed = dynamic_max_defense(armors, budget, options);
+				TEST_EQUAL("same items", full->size(), windowed->size());
+				for (size_t i = 0; i < full->size(); i++)
+				{
+					TEST_EQUAL("same items", (*full)[i], (*windowed)[i]);
+				}
+				TEST_LE("fraction computed", stats.fraction_computed(), 1.0);
+				
+				DynamicStats ordered_stats;
+				options.order_for_windows = true;
+				options.stats = &ordered_stats;
+				auto ordered = dynamic_max_defense(armors, budget, options);
+				
+				int full_cost, ordered_cost;
+				double full_defense, ordered_defense;
+				sum_armor_vector(*full, full_cost, full_defense);
+				sum_armor_vector(*ordered, ordered_cost, ordered_defense);
+				TEST_LE("within budget", ordered_cost, budget);
+				TEST_EQUAL("same defense", std::round(full_defense * 100), std::round(ordered_defense * 100));
+			}
+			
+			// A 50 item catalog costs about 2500 in total, so windows cut a lot there.
+			DynamicStats stats;
+			DynamicOptions options;
+			options.bound_columns = true;
+			options.order_for_windows = true;
+			options.stats = &stats;
+			dynamic_max_defense(*fifty, 1000, options);
+			TEST_LT("windows skip cells", stats.fraction_computed(), 0.8);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"CatalogTimeline answers queries over time", 2,
+		[&]()
+		{
+			CatalogTimeline timeline;
+			ArmorVector alive;
+			std::vector<size_t> alive_ids;
+			std::vector<double> expected;
+			
+			// Deterministic mix of additions, removals and queries.
+			unsigned state = 12345;
+			auto next = [&](unsigned bound) { state = state * 1103515245 + 12345; return (state >> 16) % bound; };
+			size_t source = 0;
+			for (int step = 0; step < 300; step++)
+			{
+				unsigned action = next(10);
+				if (action < 5)
+				{
+					auto item = (*filtered_armors)[source++];
+					alive_ids.push_back(timeline.add_item(item));
+					alive.push_back(item);
+				}
+				else if (action < 7 && !alive.empty())
+				{
+					size_t victim = next(alive.size());
+					timeline.remove_item(alive_ids[victim]);
+					alive.erase(alive.begin() + victim);
+					alive_ids.erase(alive_ids.begin() + victim);
+				}
+				else
+				{
+					int budget = next(400);
+					TEST_EQUAL("query index", expected.size(), timeline.query(budget));
+					int cost;
+					double defense;
+					sum_armor_vector(*dynamic_max_defense(alive, budget), cost, defense);
+					expected.push_back(defense);
+				}
+			}
+			
+			auto answers = timeline.solve();
+			TEST_EQUAL("one answer per query", expected.size(), answers.size());
+			for (size_t q = 0; q < answers.size(); q++)
+			{
+				TEST_EQUAL("answer", std::round(expected[q] * 100), std::round(answers[q] * 100));
+			}
+			
+			TEST_TRUE("no queries", CatalogTimeline().solve().empty());
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"WhatIfEvaluator adds one candidate row", 2,
+		[&]()
+		{
+			// The catalog is the first 60 filtered items; candidates are the next 40.
+			ArmorVector shop(filtered_armors->begin(), filtered_armors->begin() + 60);
+			ArmorVector candidates(filtered_armors->begin() + 60, filtered_armors->begin() + 100);
+			const int max_budget = 600;
+			
+			WhatIfEvaluator what_if(shop, max_budget);
+			auto single = what_if.evaluate(candidates, 450, 4);
+			auto all = what_if.evaluate_all_budgets(candidates, 3);
+			TEST_EQUAL("one answer per candidate", candidates.size(), single.size());
+			TEST_EQUAL("one row per candidate", candidates.size(), all.size());
+			
+			for (size_t c = 0; c < candidates.size(); c += 7)
+			{
+				ArmorVector extended(shop);
+				extended.push_back(candidates[c]);
+				for (int budget : { 0, 30, 450, max_budget })
+				{
+					int cost;
+					double defense;
+					sum_armor_vector(*dynamic_max_defense(extended, budget), cost, defense);
+					TEST_EQUAL("all budgets", std::round(defense * 100), std::round(all[c][budget] * 100));
+					TEST_EQUAL("single budget", std::round(defense * 100), std::round(what_if.with_candidate(*candidates[c], budget) * 100));
+				}
+				TEST_EQUAL("parallel matches serial", what_if.with_candidate(*candidates[c], 450), single[c]);
+			}
+			
+			int cost;
+			double defense;
+			sum_armor_vector(*dynamic_max_defense(shop, 450), cost, defense);
+			TEST_EQUAL("unchanged catalog", std::round(defense * 100), std::round(what_if.best_defense(450) * 100));
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"float32_max_defense with verified error bounds", 2,
+		[&]()
+		{
+			for (int budget : { 3, 9, 10, 14 })
+			{
+				auto exact = dynamic_max_defense(trivial_armors, budget);
+				auto single = float32_max_defense(trivial_armors, budget);
+				TEST_EQUAL("trivial", exact->size(), single->size());
+			}
+			
+			for (int budget : { 6, 100, 500, 2000 })
+			{
+				Float32Stats stats;
+				int exact_cost, single_cost;
+				double exact_defense, single_defense;
+				sum_armor_vector(*dynamic_max_defense(*filtered_armors, budget), exact_cost, exact_defense);
+				sum_armor_vector(*float32_max_defense(*filtered_armors, budget, &stats), single_cost, single_defense);
+				TEST_LE("within budget", single_cost, budget);
+				TEST_EQUAL("same defense", std::round(exact_defense * 100), std::round(single_defense * 100));
+				
+				// Hundredths of defense: fixed point, so every decision is exact.
+				TEST_TRUE("exact", stats.exact);
+				TEST_EQUAL("no error", 0, stats.error_bound);
+				TEST_EQUAL("nothing re-solved", 0, stats.items_resolved_in_double);
+			}
+			
+			// Two identical items tie exactly; in fixed point either is optimal.
+			ArmorVector twins;
+			twins.push_back(std::shared_ptr<ArmorItem>(new ArmorItem("left glove", 5, 7.1)));
+			twins.push_back(std::shared_ptr<ArmorItem>(new ArmorItem("right glove", 5, 7.1)));
+			Float32Stats stats;
+			auto soln = float32_max_defense(twins, 7, &stats);
+			TEST_EQUAL("one glove", 1, soln->size());
+			TEST_EQUAL("tie settled exactly", 0, stats.ambiguous_decisions);
+			
+			// Thirds are no decimal: the float bound can't separate the tie.
+			twins[0] = std::shared_ptr<ArmorItem>(new ArmorItem("left glove", 5, 1.0 / 3));
+			twins[1] = std::shared_ptr<ArmorItem>(new ArmorItem("right glove", 5, 1.0 / 3));
+			soln = float32_max_defense(twins, 7, &stats);
+			TEST_EQUAL("one third glove", 1, soln->size());
+			TEST_FALSE("not exact", stats.exact);
+			TEST_GT("error bound tracked", stats.error_bound, 0);
+			TEST_EQUAL("tie re-solved in double", 1, stats.ambiguous_decisions);
+			TEST_TRUE("fell back", stats.fell_back);
+			
+			// Inexact but well separated: float decisions, bound in defense units.
+			ArmorVector thirds;
+			for (int i = 1; i <= 40; i++)
+			{
+				thirds.push_back(std::shared_ptr<ArmorItem>(new ArmorItem("third", i, i * i / 3.0)));
+			}
+			int thirds_cost, float_cost;
+			double thirds_defense, float_defense;
+			sum_armor_vector(*dynamic_max_defense(thirds, 100), thirds_cost, thirds_defense);
+			sum_armor_vector(*float32_max_defense(thirds, 100, &stats), float_cost, float_defense);
+			TEST_LE("thirds same defense", std::fabs(thirds_defense - float_defense), 1e-9 * thirds_defense);
+			TEST_LT("thirds error bound small", stats.error_bound, 1);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"ReachableCosts and exact_spend_max_defense", 2,
+		[&]()
+		{
+			ReachableCosts trivial(trivial_armors, 20);
+			TEST_EQUAL("trivial totals", 4, trivial.count());
+			TEST_TRUE("nothing", trivial.reachable(0));
+			TEST_TRUE("boots", trivial.reachable(4));
+			TEST_TRUE("helmet", trivial.reachable(10));
+			TEST_TRUE("both", trivial.reachable(14));
+			TEST_FALSE("thirteen", trivial.reachable(13));
+			TEST_FALSE("beyond limit", trivial.reachable(21));
+			
+			TEST_FALSE("unreachable spend", exact_spend_max_defense(trivial_armors, 13));
+			auto both = exact_spend_max_defense(trivial_armors, 14);
+			TEST_TRUE("spend 14", both && both->size() == 2);
+			auto boots = exact_spend_max_defense(trivial_armors, 4);
+			TEST_TRUE("spend 4", boots && boots->size() == 1 && (*boots)[0]->description() == "test boots");
+			
+			// Against brute force over every subset of 14 items; long enough to use the wide path.
+			auto small = filter_armor_vector(*filtered_armors, 1, 2500, 14);
+			const int limit = 1500;
+			ReachableCosts reachable(*small, limit);
+			std::vector<double> best(limit + 1, -1);
+			for (unsigned mask = 0; mask < (1u << small->size()); mask++)
+			{
+				int cost = 0;
+				double defense = 0;
+				for (size_t i = 0; i < small->size(); i++)
+				{
+					if (mask & (1u << i))
+					{
+						cost += (*small)[i]->cost();
+						defense += (*small)[i]->defense();
+					}
+				}
+				if (cost <= limit)
+				{
+					best[cost] = max(best[cost], defense);
+				}
+			}
+			for (int cost = 0; cost <= limit; cost++)
+			{
+				TEST_EQUAL("reachable", best[cost] >= 0, reachable.reachable(cost));
+			}
+			for (int cost : { 59, 200, 401, 577, 1024 })
+			{
+				auto soln = exact_spend_max_defense(*small, cost);
+				TEST_EQUAL("exact spend feasible", best[cost] >= 0, bool(soln));
+				if (soln)
+				{
+					int total_cost;
+					double total_defense;
+					sum_armor_vector(*soln, total_cost, total_defense);
+					TEST_EQUAL("spends exactly", cost, total_cost);
+					TEST_EQUAL("best defense", std::round(best[cost] * 100), std::round(total_defense * 100));
+				}
+			}
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"SolverWorkspace reuse", 2,
+		[&]()
+		{
+			auto subset = filter_armor_vector(*filtered_armors, 1, 2500, 60);
+			SolverWorkspace workspace;
+			const ReconstructionStrategy strategies[] =
+			{
+				ReconstructionStrategy::full_table,
+				ReconstructionStrategy::checkpointed,
+				ReconstructionStrategy::divide_and_conquer
+			};
+			
+			// Shrinking then growing budgets leave stale cells behind for the next call.
+			for (int budget : { 900, 300, 1200, 0, 700 })
+			{
+				for (auto strategy : strategies)
+				{
+					for (bool bound : { false, true })
+					{
+						DynamicOptions fresh;
+						fresh.reconstruction = strategy;
+						fresh.bound_columns = bound;
+						DynamicOptions reused = fresh;
+						reused.workspace = &workspace;
+						
+						auto expected = dynamic_max_defense(*subset, budget, fresh);
+						auto actual = dynamic_max_defense(*subset, budget, reused);
+						TEST_EQUAL("same size", expected->size(), actual->size());
+						for (size_t i = 0; i < expected->size() && i < actual->size(); i++)
+						{
+							TEST_TRUE("same items", (*expected)[i] == (*actual)[i]);
+						}
+					}
+				}
+			}
+			
+			size_t held = workspace.capacity_bytes();
+			TEST_TRUE("holds buffers", held > 0);
+			DynamicOptions small;
+			small.workspace = &workspace;
+			dynamic_max_defense(*subset, 100, small);
+			TEST_EQUAL("no growth for smaller query", held, workspace.capacity_bytes());
+			workspace.release();
+			TEST_EQUAL("released", 0, workspace.capacity_bytes());
+			
+			TEST_TRUE("per thread", &SolverWorkspace::this_thread() == &SolverWorkspace::this_thread());
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"SolverMetrics histograms and exposition", 2,
+		[&]()
+		{
+			// Buckets tile the value range with about 3% relative width.
+			for (size_t i = 0; i + 1 < LatencyHistogram::bucket_count; i++)
+			{
+				TEST_EQUAL("contiguous", LatencyHistogram::bucket_upper(i), LatencyHistogram::bucket_lower(i + 1));
+				TEST_EQUAL("own bucket", i, LatencyHistogram::bucket_index(LatencyHistogram::bucket_lower(i)));
+			}
+			for (uint64_t value : { 0ul, 63ul, 64ul, 1000ul, 123456789ul, uint64_t(1) << 63 })
+			{
+				size_t i = LatencyHistogram::bucket_index(value);
+				TEST_TRUE("value in bucket", LatencyHistogram::bucket_lower(i) <= value && value < LatencyHistogram::bucket_upper(i));
+			}
+			
+			// The largest values, e.g. a negative duration cast to unsigned, land in the last bucket.
+			TEST_EQUAL("last bucket", LatencyHistogram::bucket_count - 1, LatencyHistogram::bucket_index(UINT64_MAX));
+			LatencyHistogram extreme;
+			extreme.record(UINT64_MAX);
+			TEST_EQUAL("extreme count", 1, extreme.count());
+			TEST_EQUAL("extreme sum", UINT64_MAX, extreme.sum());
+			TEST_EQUAL("extreme bucket", 1, extreme.bucket(LatencyHistogram::bucket_count - 1));
+			
+			LatencyHistogram histogram;
+			for (uint64_t value = 1; value <= 1000; value++)
+			{
+				histogram.record(value * 1000);
+			}
+			TEST_EQUAL("count", 1000, histogram.count());
+			TEST_EQUAL("sum", 500500000, histogram.sum());
+			TEST_TRUE("p50", std::abs(double(histogram.percentile(0.5)) - 500000) <= 500000 / 32.0);
+			TEST_TRUE("p99", std::abs(double(histogram.percentile(0.99)) - 990000) <= 990000 / 32.0);
+			
+			SolverMetrics metrics;
+			DynamicOptions options;
+			options.metrics = &metrics;
+			dynamic_max_defense(*filtered_armors, 200, options);
+			TEST_EQUAL("phases off by default", 0, metrics.histogram("full_table", "gather").count());
+			options.phase_metrics = true;
+			dynamic_max_defense(*filtered_armors, 200, options);
+			ArmorColumns columns(*filtered_armors);
+			options.reconstruction = ReconstructionStrategy::checkpointed;
+			dynamic_max_defense(columns, 200, options);
+			metrics.rejected_queries.add();
+			
+			TEST_EQUAL("queries", 3, metrics.queries());
+			metrics.cache_hits.add();
+			TEST_EQUAL("hits are queries", 4, metrics.queries());
+			
+			// Counter shards from many threads, some long gone, all add up.
+			MetricCounter counter;
+			for (int round = 0; round < 3; round++)
+			{
+				std::vector<std::thread> threads;
+				for (int t = 0; t < 80; t++)
+				{
+					threads.emplace_back([&]()
+					{
+						for (int k = 0; k < 1000; k++)
+						{
+							counter.add(2);
+						}
+					});
+				}
+				for (auto& thread : threads)
+				{
+					thread.join();
+				}
+			}
+			TEST_EQUAL("sharded sum", 3 * 80 * 2000, counter.value());
+			TEST_EQUAL("cells", 4 * filtered_armors->size() * 200, metrics.cells_computed.value());
+			TEST_EQUAL("full table solves", 2, metrics.histogram("full_table", "solve").count());
+			TEST_EQUAL("full table gathers", 1, metrics.histogram("full_table", "gather").count());
+			TEST_EQUAL("checkpointed selects", 1, metrics.histogram("checkpointed", "select").count());
+			TEST_EQUAL("no checkpointed gather", 0, metrics.histogram("checkpointed", "gather").count());
+			
+			// Past max_series, further pairs share one overflow histogram.
+			SolverMetrics crowded;
+			std::vector<std::string> phases;
+			for (size_t i = 0; i < SolverMetrics::max_series + 2; i++)
+			{
+				phases.push_back("phase" + std::to_string(i));
+			}
+			for (auto& phase : phases)
+			{
+				crowded.histogram("engine", phase.c_str()).record(1);
+			}
+			TEST_EQUAL("own series", 1, crowded.histogram("engine", "phase0").count());
+			TEST_EQUAL("overflow series", 2, crowded.histogram("engine", phases.back().c_str()).count());
+			TEST_TRUE("overflow exported", crowded.prometheus_text().find("maxdefense_latency_seconds_count{engine=\"overflow\",phase=\"overflow\"} 2\n") != std::string::npos);
+			
+			std::string text = metrics.prometheus_text();
+			TEST_TRUE("counter", text.find("\nmaxdefense_rejected_queries_total 1\n") != std::string::npos);
+			TEST_TRUE("type", text.find("# TYPE maxdefense_latency_seconds histogram\n") != std::string::npos);
+			TEST_TRUE("count line", text.find("maxdefense_latency_seconds_count{engine=\"full_table\",phase=\"solve\"} 2\n") != std::string::npos);
+			TEST_TRUE("inf bucket", text.find("maxdefense_latency_seconds_bucket{engine=\"checkpointed\",phase=\"solve\",le=\"+Inf\"} 1\n") != std::string::npos);
+			
+			// Both exposition paths return the same text while nothing changes.
+			std::string path = "/tmp/maxdefense_test_metrics." + std::to_string(::getpid()) + ".sock";
+			auto server = serve_metrics(metrics, path);
+			TEST_TRUE("server", bool(server));
+			if (server)
+			{
+				int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+				sockaddr_un address;
+				std::memset(&address, 0, sizeof(address));
+				address.sun_family = AF_UNIX;
+				std::strcpy(address.sun_path, path.c_str());
+				TEST_EQUAL("connect", 0, ::connect(client, (const sockaddr*) &address, sizeof(address)));
+				std::string served;
+				char buf[4096];
+				ssize_t got;
+				while ((got = ::read(client, buf, sizeof(buf))) > 0)
+				{
+					served.append(buf, got);
+				}
+				::close(client);
+				TEST_TRUE("served text", served == text);
+			}
+			
+			int pipe_fds[2];
+			TEST_EQUAL("pipe", 0, ::pipe(pipe_fds));
+			auto dump = dump_metrics_on_signal(metrics, SIGUSR2, pipe_fds[1]);
+			TEST_TRUE("dump", bool(dump));
+			TEST_FALSE("only one dump", dump_metrics_on_signal(metrics, SIGUSR1, pipe_fds[1]));
+			::raise(SIGUSR2);
+			std::string dumped;
+			char buf[4096];
+			while (dumped.size() < text.size())
+			{
+				ssize_t got = ::read(pipe_fds[0], buf, sizeof(buf));
+				if (got <= 0)
+				{
+					break;
+				}
+				dumped.append(buf, got);
+			}
+			dump.reset();
+			::close(pipe_fds[0]);
+			::close(pipe_fds[1]);
+			TEST_TRUE("dumped text", dumped == text);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"SamplingProfiler folded stacks", 2,
+		[&]()
+		{
+			TEST_EQUAL("symbol name", "dynamic_fill_row", SamplingProfiler::frame_name((void*) &dynamic_fill_row));
+			
+			SamplingProfiler profiler(4096);
+			TEST_TRUE("start", profiler.start(1000));
+			SamplingProfiler other;
+			TEST_FALSE("one at a time", other.start());
+			
+			// Burn enough CPU time for plenty of 1 ms samples.
+			std::clock_t until = std::clock() + CLOCKS_PER_SEC / 4;
+			while (std::clock() < until)
+			{
+				dynamic_max_defense(*filtered_armors, 300);
+			}
+			profiler.stop();
+			TEST_FALSE("stopped", profiler.running());
+			
+			size_t taken = profiler.samples();
+			TEST_TRUE("sampled", taken >= 50);
+			
+			std::string folded = profiler.folded_stacks();
+			TEST_TRUE("dp frames", folded.find("main;") != std::string::npos && folded.find(";dynamic_max_defense_indices;") != std::string::npos);
+			size_t total = 0;
+			std::istringstream lines(folded);
+			std::string line;
+			while (std::getline(lines, line))
+			{
+				size_t space = line.rfind(' ');
+				TEST_TRUE("folded format", space != std::string::npos && line.find(';') != std::string::npos);
+				total += std::stoul(line.substr(space + 1));
+			}
+			TEST_TRUE("every sample folded", total > 0 && total <= taken);
+			
+			// Stopped means stopped, and the profiler can be restarted.
+			until = std::clock() + CLOCKS_PER_SEC / 20;
+			while (std::clock() < until)
+			{
+			}
+			TEST_EQUAL("no samples while stopped", taken, profiler.samples());
+			profiler.clear();
+			TEST_EQUAL("cleared", 0, profiler.samples());
+			TEST_TRUE("restart", profiler.start());
+			profiler.stop();
+			
+			// Profilers destroyed while other threads take samples.
+			std::atomic<bool> busy{true};
+			std::vector<std::thread> workers;
+			for (int t = 0; t < 3; t++)
+			{
+				workers.emplace_back([&]()
+				{
+					while (busy)
+					{
+						dynamic_max_defense(trivial_armors, 14);
+					}
+				});
+			}
+			bool restarted = true;
+			for (int round = 0; round < 50; round++)
+			{
+				std::unique_ptr<SamplingProfiler> brief(new SamplingProfiler(64));
+				restarted = restarted && brief->start(10000);
+				std::clock_t stop_at = std::clock() + CLOCKS_PER_SEC / 500;
+				while (std::clock() < stop_at)
+				{
+				}
+			}
+			busy = false;
+			for (auto& worker : workers)
+			{
+				worker.join();
+			}
+			TEST_TRUE("restarted every round", restarted);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Query capture round trip", 2,
+		[&]()
+		{
+			uint64_t fingerprint = catalog_fingerprint(*filtered_armors);
+			TEST_EQUAL("stable fingerprint", fingerprint, catalog_fingerprint(ArmorColumns(*filtered_armors)));
+			TEST_TRUE("distinct fingerprint", fingerprint != catalog_fingerprint(*all_armors));
+			TEST_TRUE("order matters", catalog_fingerprint(trivial_armors) != catalog_fingerprint(ArmorVector(trivial_armors.rbegin(), trivial_armors.rend())));
+			
+			std::string path = "maxdefense_test." + std::to_string(::getpid()) + ".capture";
+			std::vector<DefenseQuery> queries(3);
+			queries[0].min_defense = 0;
+			queries[0].max_defense = 2500;
+			queries[0].total_size = 100;
+			queries[0].budget = 500;
+			queries[1] = queries[0];
+			queries[1].budget = 900;
+			queries[2] = queries[0];
+			queries[2].min_defense = 1.5;
+			queries[2].total_size = 40;
+			{
+				auto capture = open_query_capture(path);
+				TEST_TRUE("opened", bool(capture));
+				for (auto& query : queries)
+				{
+					auto captured = answer_defense_query(*filtered_armors, query, DynamicOptions(), capture.get());
+					auto subset = filter_armor_vector(*filtered_armors, query.min_defense, query.max_defense, query.total_size);
+					auto direct = dynamic_max_defense(*subset, query.budget);
+					TEST_EQUAL("same answer", direct->size(), captured->size());
+				}
+				TEST_EQUAL("recorded", 3, capture->recorded());
+			}
+			
+			auto loaded = load_query_capture(path);
+			TEST_TRUE("loaded", bool(loaded));
+			TEST_EQUAL("records", 3, loaded->size());
+			for (size_t i = 0; i < loaded->size() && i < queries.size(); i++)
+			{
+				const CapturedQuery& record = (*loaded)[i];
+				TEST_EQUAL("min_defense", queries[i].min_defense, record.query.min_defense);
+				TEST_EQUAL("max_defense", queries[i].max_defense, record.query.max_defense);
+				TEST_EQUAL("total_size", queries[i].total_size, record.query.total_size);
+				TEST_EQUAL("budget", queries[i].budget, record.query.budget);
+				TEST_EQUAL("fingerprint", fingerprint, record.fingerprint);
+				TEST_TRUE("latency", record.latency_ns > 0);
+				TEST_TRUE("arrivals in order", i == 0 || (*loaded)[i - 1].arrival_ns + (*loaded)[i - 1].latency_ns <= record.arrival_ns);
+			}
+			
+			TEST_FALSE("not a capture", load_query_capture("armor.csv"));
+			std::remove(path.c_str());
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Shared-memory catalog", 2,
+		[&]()
+		{
+			std::string name = "/maxdefense_test." + std::to_string(::getpid());
+			ArmorColumns columns(*filtered_armors);
+			TEST_TRUE("publish", publish_armor_shm(name, columns, 7));
+			
+			// Another process attaches and solves without parsing anything.
+			pid_t child = ::fork();
+			if (child == 0)
+			{
+				uint64_t version = 0;
+				auto attached = attach_armor_shm(name, &version);
+				bool same = attached && version == 7 && attached->size() == columns.size()
+					&& dynamic_max_defense(*attached, 500)->size() == dynamic_max_defense(columns, 500)->size();
+				::_exit(same ? 0 : 1);
+			}
+			int status = -1;
+			::waitpid(child, &status, 0);
+			TEST_TRUE("child attached", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+			
+			uint64_t version = 0;
+			auto attached = attach_armor_shm(name, &version);
+			TEST_TRUE("attached", bool(attached));
+			TEST_EQUAL("version", 7, version);
+			TEST_EQUAL("size", columns.size(), attached->size());
+			for (size_t i = 0; i < columns.size(); i++)
+			{
+				TEST_EQUAL("cost", columns.cost(i), attached->cost(i));
+				TEST_EQUAL("defense", columns.defense(i), attached->defense(i));
+				TEST_EQUAL("description", columns.description(i), attached->description(i));
+			}
+			
+			// Republishing leaves existing attachments on the old catalog.
+			TEST_TRUE("republish", publish_armor_shm(name, trivial_armors, 8));
+			auto fresh = attach_armor_shm(name, &version);
+			TEST_EQUAL("new version", 8, version);
+			TEST_EQUAL("new size", 2, fresh->size());
+			TEST_EQUAL("new contents", "test boots", fresh->description(1));
+			TEST_EQUAL("old attachment intact", columns.description(3), attached->description(3));
+			
+			// Attaching while the catalog is republished always finds a complete one.
+			std::atomic<bool> republishing{true};
+			std::atomic<int> missed{0};
+			std::thread attacher([&]()
+			{
+				while (republishing)
+				{
+					if ( ! attach_armor_shm(name) )
+					{
+						missed++;
+					}
+				}
+			});
+			for (uint64_t v = 9; v < 200; v++)
+			{
+				publish_armor_shm(name, trivial_armors, v);
+			}
+			republishing = false;
+			attacher.join();
+			TEST_EQUAL("never missing", 0, missed.load());
+			
+			// A corrupt header is refused instead of read out of bounds.
+			TEST_TRUE("publish again", publish_armor_shm(name, columns, 200));
+			int fd = shm_open(name.c_str(), O_RDWR, 0);
+			struct stat info;
+			fstat(fd, &info);
+			char* base = static_cast<char*>(mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+			close(fd);
+			armor_shm::Header* header = reinterpret_cast<armor_shm::Header*>(base);
+			int32_t* offsets = reinterpret_cast<int32_t*>(base + header->description_offsets_offset);
+			auto refused = [&](const char* what, uint64_t& field, uint64_t value)
+			{
+				uint64_t saved = field;
+				field = value;
+				TEST_FALSE(what, attach_armor_shm(name));
+				field = saved;
+			};
+			refused("huge size", header->size, uint64_t(1) << 62);
+			refused("size past the columns", header->size, columns.size() * 2);
+			refused("costs outside", header->costs_offset, info.st_size - 4);
+			refused("defenses misaligned", header->defenses_offset, header->defenses_offset + 4);
+			refused("offsets overflow", header->description_offsets_offset, UINT64_MAX - 3);
+			std::swap(offsets[3], offsets[4]);
+			TEST_FALSE("offsets decrease", attach_armor_shm(name));
+			std::swap(offsets[3], offsets[4]);
+			offsets[columns.size()] += 1000000;
+			TEST_FALSE("descriptions outside", attach_armor_shm(name));
+			offsets[columns.size()] -= 1000000;
+			TEST_TRUE("intact again", bool(attach_armor_shm(name)));
+			munmap(base, info.st_size);
+			
+			TEST_TRUE("unpublish", unpublish_armor_shm(name));
+			TEST_FALSE("gone", attach_armor_shm(name));
+			TEST_EQUAL("still readable", columns.cost(5), attached->cost(5));
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Embedded constexpr catalog", 2,
+		[&]()
+		{
+			static_assert(embedded_armor::size > 0, "the embedded catalog is known at compile time");
+			static_assert(embedded_armor::costs[0] == 59, "costs are constant expressions");
+			
+			auto loaded = load_armor_columns("armor.csv", DescriptionLoading::eager);
+			ArmorColumns embedded = embedded_armor_columns();
+			TEST_EQUAL("size", all_armors->size(), embedded.size());
+			for (size_t i = 0; i < embedded.size(); i++)
+			{
+				TEST_EQUAL("cost", loaded->cost(i), embedded.cost(i));
+				TEST_EQUAL("defense", loaded->defense(i), embedded.defense(i));
+				TEST_EQUAL("description", loaded->description(i), embedded.description(i));
+			}
+			
+			int loaded_cost, embedded_cost;
+			double loaded_defense, embedded_defense;
+			sum_armor_vector(*dynamic_max_defense(*loaded, 800), loaded_cost, loaded_defense);
+			sum_armor_vector(*dynamic_max_defense(embedded, 800), embedded_cost, embedded_defense);
+			TEST_EQUAL("same cost", loaded_cost, embedded_cost);
+			TEST_EQUAL("same defense", loaded_defense, embedded_defense);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"SolverService admission and scheduling", 2,
+		[&]()
+		{
+			std::shared_ptr<const ArmorVector> catalog(new ArmorVector(*filtered_armors));
+			auto query = [](int32_t total_size, int32_t budget)
+			{
+				DefenseQuery q;
+				q.min_defense = 0;
+				q.max_defense = 2500;
+				q.total_size = total_size;
+				q.budget = budget;
+				return q;
+			};
+			auto direct_defense = [&](const DefenseQuery& q)
+			{
+				auto subset = filter_armor_vector(*catalog, q.min_defense, q.max_defense, q.total_size);
+				int cost;
+				double defense;
+				sum_armor_vector(*dynamic_max_defense(*subset, q.budget), cost, defense);
+				return std::round(defense * 100);
+			};
+			
+			{
+				SolverMetrics metrics;
+				ServiceOptions options;
+				options.threads = 2;
+				options.max_cells = 2000000;
+				options.metrics = &metrics;
+				SolverService service(catalog, options);
+				
+				for (auto q : { query(100, 500), query(300, 50), query(10, 100000), query(2000, 800) })
+				{
+					QueryResult result = service.solve(q);
+					TEST_TRUE("solved", result.status == QueryStatus::solved);
+					TEST_EQUAL("same defense", direct_defense(q), std::round(result.total_defense * 100));
+					TEST_TRUE("estimate within limit", result.estimated_cells <= options.max_cells);
+				}
+				
+				// Pruning caps the budget at what all ten items cost together.
+				TEST_TRUE("pruned budget", service.solve(query(10, 100000)).estimated_cells < 10 * 1000);
+				
+				QueryResult huge = service.solve(query(8000, 5000));
+				TEST_TRUE("rejected", huge.status == QueryStatus::rejected);
+				TEST_TRUE("nothing chosen", huge.armors->empty());
+				TEST_TRUE("rejected invalid", service.solve(query(10, -1)).status == QueryStatus::rejected);
+				TEST_EQUAL("rejections counted", 2, metrics.rejected_queries.value());
+				TEST_EQUAL("stats", 2, service.stats().rejected);
+			}
+			
+			{
+				// Too little memory for a full table: a leaner strategy, same answer.
+				ServiceOptions options;
+				options.threads = 1;
+				options.max_query_bytes = 200 * 1024;
+				SolverService service(catalog, options);
+				QueryResult result = service.solve(query(2000, 1000));
+				TEST_TRUE("solved lean", result.status == QueryStatus::solved);
+				TEST_TRUE("lean strategy", result.strategy != ReconstructionStrategy::full_table);
+				TEST_TRUE("lean bytes", result.estimated_bytes <= options.max_query_bytes);
+				TEST_EQUAL("lean defense", direct_defense(query(2000, 1000)), std::round(result.total_defense * 100));
+			}
+			
+			{
+				// One worker, busy; a large and then a small job queue behind it.
+				ServiceOptions options;
+				options.threads = 1;
+				options.aging_seconds = 1e9;
+				SolverService service(catalog, options);
+				auto busy = service.submit(query(8000, 3000));
+				while (service.stats().running == 0)
+				{
+					std::this_thread::yield();
+				}
+				auto large = service.submit(query(4000, 2000));
+				auto small = service.submit(query(50, 200));
+				double large_wait = large.get().queue_seconds, small_wait = small.get().queue_seconds;
+				busy.get();
+				TEST_TRUE("shortest job first", small_wait < large_wait);
+			}
+			
+			{
+				// Memory for one big job at a time: the second waits for headroom.
+				ServiceOptions options;
+				options.threads = 2;
+				options.memory_budget_bytes = 40 * 1024 * 1024;
+				SolverService service(catalog, options);
+				auto first = service.submit(query(3000, 1500));
+				auto second = service.submit(query(3000, 1400));
+				TEST_TRUE("both solved", first.get().status == QueryStatus::solved && second.get().status == QueryStatus::solved);
+				TEST_EQUAL("deferred", 1, service.stats().deferred);
+				ServiceStats stats = service.stats();
+				TEST_EQUAL("memory returned", stats.workspace_bytes, stats.bytes_in_use);
+				TEST_LE("workspaces within budget", stats.workspace_bytes, options.memory_budget_bytes);
+			}
+			
+			{
+				// Idle workers' scratch memory counts against the budget, and is
+				// handed back when a query needs the room.
+				ServiceOptions options;
+				options.threads = 2;
+				options.memory_budget_bytes = 40 * 1024 * 1024;
+				SolverService service(catalog, options);
+				service.solve(query(2000, 1000));
+				ServiceStats kept = service.stats();
+				TEST_TRUE("workspace kept", kept.workspace_bytes > 0);
+				TEST_EQUAL("workspace counted", kept.workspace_bytes, kept.bytes_in_use);
+				QueryResult big = service.solve(query(3000, 1500));
+				TEST_TRUE("big solved", big.status == QueryStatus::solved);
+				TEST_TRUE("needed the kept memory", kept.workspace_bytes + big.estimated_bytes > options.memory_budget_bytes);
+				ServiceStats after = service.stats();
+				TEST_EQUAL("only workspaces left", after.workspace_bytes, after.bytes_in_use);
+				TEST_LE("after within budget", after.bytes_in_use, options.memory_budget_bytes);
+			}
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Single-flight coalescing", 2,
+		[&]()
+		{
+			// Every caller arrives while the leader is still computing.
+			SingleFlight<int, int> flights;
+			std::atomic<int> computed{0};
+			const int callers = 8;
+			std::vector<int> answers(callers);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < callers; t++)
+			{
+				threads.emplace_back([&, t]()
+				{
+					answers[t] = flights.run(42, [&]()
+					{
+						computed++;
+						while (flights.coalesced() < callers - 1)
+						{
+							std::this_thread::yield();
+						}
+						return 7;
+					});
+				});
+			}
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+			TEST_EQUAL("computed once", 1, computed.load());
+			TEST_EQUAL("coalesced", callers - 1, flights.coalesced());
+			TEST_TRUE("same answer", std::count(answers.begin(), answers.end(), 7) == callers);
+			TEST_EQUAL("forgotten", 0, flights.in_flight());
+			TEST_EQUAL("computes again later", 8, flights.run(42, []() { return 8; }));
+			
+			auto failing = flights.join(1);
+			flights.fail(1, std::make_exception_ptr(std::runtime_error("no")));
+			bool threw = false;
+			try
+			{
+				failing.first.get();
+			}
+			catch (const std::runtime_error&)
+			{
+				threw = true;
+			}
+			TEST_TRUE("failure shared", threw);
+			
+			// Identical queries queued behind a busy worker share one solve.
+			std::shared_ptr<const ArmorVector> catalog(new ArmorVector(*filtered_armors));
+			SolverMetrics metrics;
+			ServiceOptions options;
+			options.threads = 1;
+			options.metrics = &metrics;
+			SolverService service(catalog, options);
+			DefenseQuery busy;
+			busy.max_defense = 2500;
+			busy.total_size = 8000;
+			busy.budget = 3000;
+			auto blocker = service.submit(busy);
+			while (service.stats().running == 0)
+			{
+				std::this_thread::yield();
+			}
+			DefenseQuery hot = busy;
+			hot.total_size = 500;
+			hot.budget = 700;
+			std::vector<std::shared_future<QueryResult>> results;
+			for (int i = 0; i < 20; i++)
+			{
+				results.push_back(service.submit(hot));
+			}
+			auto first = results[0].get().armors;
+			for (auto& result : results)
+			{
+				TEST_TRUE("same result", result.get().armors == first);
+			}
+			blocker.get();
+			TEST_EQUAL("service coalesced", 19, service.stats().coalesced);
+			TEST_EQUAL("solved twice", 2, service.stats().solved);
+			TEST_EQUAL("cache hits", 19, metrics.cache_hits.value());
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Idle-time speculation", 2,
+		[&]()
+		{
+			CountMinSketch sketch(256, 4);
+			for (int i = 0; i < 100; i++)
+			{
+				sketch.add(1);
+			}
+			for (uint64_t key = 2; key < 500; key++)
+			{
+				sketch.add(key);
+			}
+			TEST_TRUE("never undercounts", sketch.estimate(1) >= 100 && sketch.estimate(77) >= 1);
+			TEST_TRUE("small overcount", sketch.estimate(1) < 120);
+			TEST_EQUAL("total", 598, sketch.total());
+			
+			DefenseQuery often, sometimes, rarely;
+			often.max_defense = sometimes.max_defense = rarely.max_defense = 2500;
+			often.total_size = 500;
+			sometimes.total_size = 400;
+			rarely.total_size = 300;
+			HotWindowTracker tracker(2);
+			for (int i = 0; i < 5; i++)
+			{
+				often.budget = 100 * (i + 1);
+				tracker.record(often);
+			}
+			for (int i = 0; i < 3; i++)
+			{
+				tracker.record(sometimes);
+			}
+			tracker.record(rarely);
+			auto hottest = tracker.hottest();
+			TEST_EQUAL("kept", 2, hottest.size());
+			TEST_EQUAL("hottest first", 500, hottest[0].window.total_size);
+			TEST_EQUAL("largest budget", 500, hottest[0].max_budget);
+			TEST_FALSE("cold window dropped", tracker.is_hot(window_of(rarely)));
+			
+			// A build stopped part way resumes from the same row.
+			auto subset = filter_armor_vector(*filtered_armors, 0, 2500, 500);
+			SpeculativeTable table(*filtered_armors, window_of(often), 800, size_t(1) << 30);
+			int rows = 0;
+			TEST_FALSE("preempted", table.advance([&]() { return ++rows > 10; }));
+			TEST_EQUAL("rows before preemption", 10, table.rows_done());
+			TEST_TRUE("resumed", table.advance([]() { return false; }));
+			for (int budget : { 0, 1, 250, 555, 800 })
+			{
+				int expected_cost, got_cost;
+				double expected_defense, got_defense;
+				sum_armor_vector(*dynamic_max_defense(*subset, budget), expected_cost, expected_defense);
+				sum_armor_vector(*table.answer(budget), got_cost, got_defense);
+				TEST_EQUAL("table answer cost", expected_cost, got_cost);
+				TEST_EQUAL("table answer defense", expected_defense, got_defense);
+			}
+			TEST_FALSE("no column", table.covers(801));
+			SpeculativeTable capped(*filtered_armors, window_of(often), 800, 101 * sizeof(double) * (subset->size() + 1));
+			TEST_EQUAL("capped to memory", 100, capped.max_budget());
+			
+			// An idle service builds the hot window's table and answers from it.
+			std::shared_ptr<const ArmorVector> catalog(new ArmorVector(*filtered_armors));
+			ServiceOptions options;
+			options.threads = 1;
+			options.speculate = true;
+			SolverService service(catalog, options);
+			often.budget = 900;
+			service.solve(often);
+			often.budget = 300;
+			service.solve(often);
+			for (int waited = 0; service.stats().speculated_windows == 0 && waited < 10000; waited++)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			TEST_EQUAL("table built", 1, service.stats().speculated_windows);
+			often.budget = 650;
+			QueryResult result = service.solve(often);
+			TEST_EQUAL("answered from table", 1, service.stats().speculative_hits);
+			int expected_cost;
+			double expected_defense;
+			sum_armor_vector(*dynamic_max_defense(*subset, 650), expected_cost, expected_defense);
+			TEST_EQUAL("service answer cost", expected_cost, result.total_cost);
+			TEST_EQUAL("service answer defense", expected_defense, result.total_defense);
+			
+			// A larger budget in the same window replaces the table with a wider one.
+			often.budget = 1500;
+			service.solve(often);
+			for (int waited = 0; service.stats().speculated_windows < 2 && waited < 10000; waited++)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			TEST_EQUAL("table rebuilt", 2, service.stats().speculated_windows);
+			often.budget = 1400;
+			result = service.solve(often);
+			TEST_EQUAL("answered from rebuilt table", 2, service.stats().speculative_hits);
+			sum_armor_vector(*dynamic_max_defense(*subset, 1400), expected_cost, expected_defense);
+			TEST_EQUAL("rebuilt answer defense", expected_defense, result.total_defense);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Tenant registry eviction", 2,
+		[&]()
+		{
+			std::map<std::string, int> loads;
+			auto loader = [&](const std::string& name, int delay_ms = 0)
+			{
+				return [&loads, &filtered_armors, name, delay_ms]()
+				{
+					loads[name]++;
+					std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+					return std::unique_ptr<ArmorVector>(new ArmorVector(*filtered_armors));
+				};
+			};
+			DefenseQuery query;
+			query.max_defense = 2500;
+			query.total_size = 200;
+			query.budget = 1000;
+			auto subset = filter_armor_vector(*filtered_armors, 0, 2500, 200);
+			int expected_cost, got_cost;
+			double expected_defense, got_defense;
+			sum_armor_vector(*dynamic_max_defense(*subset, 1000), expected_cost, expected_defense);
+			
+			size_t catalog_bytes = armor_vector_bytes(ArmorVector(*filtered_armors));
+			size_t table_bytes = SpeculativeTable(*filtered_armors, window_of(query), 1000, size_t(1) << 30).bytes();
+			
+			// Room for both catalogs and one table: the second table evicts the first.
+			TenantOptions options;
+			options.memory_cap_bytes = 2 * catalog_bytes + table_bytes + table_bytes / 2;
+			TenantRegistry registry(options);
+			registry.add_tenant("a", loader("a"));
+			registry.add_tenant("b", loader("b"));
+			TEST_TRUE("unknown tenant", registry.solve("c", query) == nullptr);
+			TEST_EQUAL("lazy", 0, loads["a"]);
+			
+			sum_armor_vector(*registry.solve("a", query), got_cost, got_defense);
+			TEST_EQUAL("answer cost", expected_cost, got_cost);
+			TEST_EQUAL("answer defense", expected_defense, got_defense);
+			TEST_EQUAL("accounted", catalog_bytes + table_bytes, registry.tenant_bytes("a"));
+			query.budget = 400;
+			auto smaller = registry.solve("a", query);
+			TEST_EQUAL("hit", 1, registry.stats().table_hits);
+			TEST_EQUAL("hit answer", dynamic_max_defense(*subset, 400)->size(), smaller->size());
+			
+			query.budget = 1000;
+			registry.solve("b", query);
+			TenantStats stats = registry.stats();
+			TEST_EQUAL("table evicted first", 1, stats.evicted_tables);
+			TEST_EQUAL("catalogs kept", 2, stats.resident_catalogs);
+			TEST_LE("under cap", stats.bytes_in_use, options.memory_cap_bytes);
+			
+			// Room for one catalog: the one slower to rebuild stays, and the
+			// other reloads on each of its queries.
+			options.memory_cap_bytes = catalog_bytes + catalog_bytes / 2;
+			TenantRegistry tight(options);
+			tight.add_tenant("slow", loader("slow", 50));
+			tight.add_tenant("fast", loader("fast"));
+			tight.solve("slow", query);
+			tight.solve("fast", query);
+			stats = tight.stats();
+			TEST_EQUAL("one catalog resident", 1, stats.resident_catalogs);
+			TEST_EQUAL("no tables left", 0, stats.resident_tables);
+			TEST_LE("tight under cap", stats.bytes_in_use, options.memory_cap_bytes);
+			TEST_TRUE("costly catalog kept", tight.tenant_bytes("slow") > 0 && tight.tenant_bytes("fast") == 0);
+			sum_armor_vector(*tight.solve("fast", query), got_cost, got_defense);
+			TEST_EQUAL("reloaded", 2, loads["fast"]);
+			TEST_EQUAL("reloaded answer", expected_defense, got_defense);
+			tight.solve("slow", query);
+			TEST_EQUAL("kept tenant not reloaded", 1, loads["slow"]);
+			
+			TEST_TRUE("removed", tight.remove_tenant("slow"));
+			TEST_FALSE("gone", tight.has_tenant("slow"));
+			
+			// A table capped below the budget is skipped, not built and dropped.
+			options = TenantOptions();
+			options.max_table_bytes = table_bytes / 4;
+			TenantRegistry capped(options);
+			capped.add_tenant("a", loader("a"));
+			sum_armor_vector(*capped.solve("a", query), got_cost, got_defense);
+			TEST_EQUAL("capped answer", expected_defense, got_defense);
+			TEST_EQUAL("no table built", 0, capped.stats().table_builds);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Shared-memory result ring", 2,
+		[&]()
+		{
+			std::string catalog_name = "/maxdefense_test_catalog." + std::to_string(::getpid());
+			std::string ring_name = "/maxdefense_test_ring." + std::to_string(::getpid());
+			TEST_TRUE("publish", publish_armor_shm(catalog_name, *filtered_armors, 3));
+			auto shared = attach_armor_shm(catalog_name);
+			auto writer = create_result_ring(ring_name, 2, 64, 3);
+			TEST_TRUE("created", bool(writer));
+			
+			DefenseQuery query;
+			query.max_defense = 2500;
+			query.total_size = 300;
+			query.budget = 800;
+			auto expected = dynamic_max_defense(*filter_armor_vector(*filtered_armors, 0, 2500, 300), 800);
+			
+			// A client process sleeps on the ring until the answer arrives,
+			// then resolves it against its own mapping of the catalog.
+			pid_t child = ::fork();
+			if (child == 0)
+			{
+				auto reader = attach_result_ring(ring_name);
+				auto catalog = attach_armor_shm(catalog_name);
+				bool same = reader && catalog && reader->catalog_version() == 3 && reader->wait(10000);
+				if (same)
+				{
+					const ResultRecord* record = reader->front();
+					same = record->request_id == 41 && record->status == 0 && record->count == expected->size();
+					for (size_t i = 0; same && i < record->count; i++)
+					{
+						same = description_view(*catalog, record->indices()[i]) == (*expected)[i]->description();
+					}
+					reader->pop();
+				}
+				::_exit(same ? 0 : 1);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			TEST_TRUE("pushed", solve_into_result_ring(*shared, query, 41, *writer));
+			int status = -1;
+			::waitpid(child, &status, 0);
+			TEST_TRUE("client read in place", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+			TEST_EQUAL("consumed", 0, writer->pending());
+			
+			auto reader = attach_result_ring(ring_name);
+			TEST_FALSE("nothing yet", reader->wait(0));
+			TEST_TRUE("first", writer->push(1, 0, { 0, 1 }, 10, 2.5));
+			TEST_TRUE("second", writer->push(2, 0, {}, 0, 0));
+			TEST_FALSE("full", writer->push(3, 0, {}, 0, 0));
+			TEST_TRUE("ready", reader->wait(0));
+			const ResultRecord* record = reader->front();
+			TEST_EQUAL("in order", 1, record->request_id);
+			TEST_EQUAL("totals", 10, record->total_cost);
+			TEST_EQUAL("index", 1, record->indices()[1]);
+			reader->pop();
+			TEST_TRUE("too many items recorded", writer->push(3, 0, std::vector<size_t>(65, 0), 7, 1.5));
+			TEST_FALSE("full again", writer->push(4, 0, {}, 0, 0));
+			reader->pop();
+			record = reader->front();
+			TEST_EQUAL("wrapped", 3, record->request_id);
+			TEST_EQUAL("truncated status", result_ring::too_many_items, record->status);
+			TEST_EQUAL("no indices", 0, record->count);
+			TEST_EQUAL("totals kept", 7, record->total_cost);
+			
+			TEST_TRUE("unlink", unlink_result_ring(ring_name));
+			TEST_FALSE("gone", attach_result_ring(ring_name));
+			unpublish_armor_shm(catalog_name);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Party multiple-knapsack allocation", 2,
+		[&]()
+		{
+			// Every basket within its member's gold, and no item bought twice.
+			auto feasible = [](const std::vector<std::unique_ptr<ArmorVector>>& party, const std::vector<int>& budgets, double& defense)
+			{
+				std::set<const ArmorItem*> bought;
+				defense = 0;
+				for (size_t k = 0; k < party.size(); k++)
+				{
+					int cost;
+					double member_defense;
+					sum_armor_vector(*party[k], cost, member_defense);
+					defense += member_defense;
+					for (auto& armor : *party[k])
+					{
+						if ( ! bought.insert(armor.get()).second )
+						{
+							return false;
+						}
+					}
+					if (cost > budgets[k])
+					{
+						return false;
+					}
+				}
+				return party.size() == budgets.size();
+			};
+			
+			auto shop = filter_armor_vector(*filtered_armors, 0, 2500, 9);
+			std::vector<int> budgets = { 70, 55, 40 };
+			double brute = 0;
+			size_t assignments = 1;
+			for (size_t i = 0; i < shop->size(); i++)
+			{
+				assignments *= budgets.size() + 1;
+			}
+			for (size_t code = 0; code < assignments; code++)
+			{
+				std::vector<int> spent(budgets.size(), 0);
+				double defense = 0;
+				size_t rest = code;
+				for (size_t i = 0; i < shop->size(); i++, rest /= budgets.size() + 1)
+				{
+					size_t k = rest % (budgets.size() + 1);
+					if (k < budgets.size())
+					{
+						spent[k] += (*shop)[i]->cost();
+						defense += (*shop)[i]->defense();
+					}
+				}
+				bool fits = true;
+				for (size_t k = 0; k < budgets.size(); k++)
+				{
+					fits = fits && spent[k] <= budgets[k];
+				}
+				if (fits)
+				{
+					brute = std::max(brute, defense);
+				}
+			}
+			
+			for (unsigned threads : { 1u, 4u })
+			{
+				PartyStats stats;
+				PartyOptions options;
+				options.threads = threads;
+				options.stats = &stats;
+				double defense;
+				auto party = party_max_defense(*shop, budgets, options);
+				TEST_TRUE("exact feasible", feasible(party, budgets, defense));
+				TEST_TRUE("matches brute force", std::abs(defense - brute) <= 1e-9 * brute);
+				TEST_TRUE("proven", stats.optimal);
+			}
+			
+			PartyOptions heuristic;
+			heuristic.mode = PartyMode::heuristic;
+			double heuristic_defense;
+			TEST_TRUE("heuristic feasible", feasible(party_max_defense(*shop, budgets, heuristic), budgets, heuristic_defense));
+			TEST_LE("heuristic below optimum", heuristic_defense, brute * (1 + 1e-9));
+			PartyStats heuristic_stats;
+			heuristic.stats = &heuristic_stats;
+			party_max_defense(*shop, budgets, heuristic);
+			double row_bound = heuristic_stats.upper_bound;
+			TEST_LE("heuristic bound holds", brute, row_bound * (1 + 1e-9));
+			heuristic.max_surrogate_cells = 0;
+			party_max_defense(*shop, budgets, heuristic);
+			TEST_LE("linear bound looser", row_bound, heuristic_stats.upper_bound * (1 + 1e-9));
+			heuristic.max_surrogate_cells = PartyOptions().max_surrogate_cells;
+			heuristic.stats = nullptr;
+			
+			// A party of eight over a large shop, with the search cut short.
+			std::vector<int> party_budgets = { 150, 157, 164, 150, 157, 164, 150, 157 };
+			auto big_shop = filter_armor_vector(*filtered_armors, 0, 2500, 2000);
+			PartyStats stats;
+			PartyOptions options;
+			options.threads = 4;
+			options.max_nodes = 100000;
+			options.stats = &stats;
+			double defense;
+			auto party = party_max_defense(*big_shop, party_budgets, options);
+			TEST_TRUE("large feasible", feasible(party, party_budgets, defense));
+			TEST_TRUE("totals agree", std::abs(defense - stats.total_defense) <= 1e-9 * defense);
+			TEST_LE("within bound", stats.total_defense, stats.upper_bound * (1 + 1e-9));
+			heuristic.stats = &stats;
+			party_max_defense(*big_shop, party_budgets, heuristic);
+			TEST_LE("search keeps the heuristic floor", stats.total_defense, defense * (1 + 1e-9));
+			double column_defense;
+			feasible(party_max_defense(ArmorColumns(*big_shop), party_budgets, heuristic), party_budgets, column_defense);
+			TEST_EQUAL("columns agree", stats.total_defense, column_defense);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Greedy half-approximation", 2,
+		[&]()
+		{
+			ArmorColumns columns(*filtered_armors);
+			SolverWorkspace workspace;
+			for (size_t size : { size_t(1), size_t(17), size_t(200), columns.size() })
+			{
+				auto subset = filter_armor_vector(*filtered_armors, 0, 2500, size);
+				ArmorColumns subset_columns(*subset);
+				DefenseBounds bounds(subset_columns);
+				for (int budget : { 0, 7, 100, 1000, 20000 })
+				{
+					int cost, optimal_cost;
+					double defense, optimal_defense;
+					sum_armor_vector(*greedy_half_max_defense(subset_columns, budget, &workspace), cost, defense);
+					sum_armor_vector(*dynamic_max_defense(*subset, budget), optimal_cost, optimal_defense);
+					TEST_LE("within budget", cost, budget);
+					TEST_LE("at most optimal", defense, optimal_defense * (1 + 1e-12));
+					TEST_GE("at least half of optimal", defense * (1 + 1e-12), optimal_defense / 2);
+					TEST_GE("no worse than the sorted greedy", defense * (1 + 1e-9), bounds.lower_bound(budget));
+					
+					int vector_cost;
+					double vector_defense;
+					sum_armor_vector(*greedy_half_max_defense(*subset, budget), vector_cost, vector_defense);
+					// Same items, though not always summed in the same order.
+					TEST_EQUAL("front ends agree on cost", cost, vector_cost);
+					TEST_LE("front ends agree", std::fabs(defense - vector_defense), 1e-9 * std::max(1.0, defense));
+				}
+			}
+			
+			// Repeat calls reuse the workspace's index buffer.
+			GreedyChoice first = greedy_half_max_defense_indices(columns.costs(), columns.defenses(), columns.size(), 500, workspace);
+			size_t held = workspace.capacity_bytes();
+			GreedyChoice again = greedy_half_max_defense_indices(columns.costs(), columns.defenses(), columns.size(), 500, workspace);
+			TEST_TRUE("same buffer", first.indices == again.indices && held == workspace.capacity_bytes());
+			TEST_EQUAL("same answer", first.total_defense, again.total_defense);
+			TEST_EQUAL("negative budget", 0, greedy_half_max_defense_indices(columns.costs(), columns.defenses(), columns.size(), -1, workspace).count);
+			
+			// Orders that defeat fixed pivot rules: rising efficiency, and one efficiency throughout.
+			const size_t ramp = 100000;
+			std::vector<int32_t> unit_costs(ramp, 1);
+			std::vector<double> rising(ramp), flat(ramp, 1);
+			for (size_t i = 0; i < ramp; i++)
+			{
+				rising[i] = i + 1;
+			}
+			GreedyChoice top = greedy_half_max_defense_indices(unit_costs.data(), rising.data(), ramp, ramp / 2, workspace);
+			TEST_EQUAL("rising count", ramp / 2, top.count);
+			TEST_EQUAL("rising defense", double(ramp / 2) * (ramp / 2 + 1 + ramp) / 2, top.total_defense);
+			GreedyChoice level = greedy_half_max_defense_indices(unit_costs.data(), flat.data(), ramp, ramp / 2, workspace);
+			TEST_EQUAL("flat count", ramp / 2, level.count);
+			TEST_TRUE("flat in catalog order", level.indices[0] == 0 && level.indices[level.count - 1] == ramp / 2 - 1);
+			
+			// The service answers queries over its limits approximately.
+			std::shared_ptr<const ArmorVector> catalog(new ArmorVector(*filtered_armors));
+			ServiceOptions options;
+			options.threads = 1;
+			options.max_cells = 1000;
+			options.greedy_fallback = true;
+			SolverService service(catalog, options);
+			DefenseQuery query;
+			query.max_defense = 2500;
+			query.total_size = 8000;
+			query.budget = 5000;
+			QueryResult result = service.solve(query);
+			TEST_TRUE("approximated", result.status == QueryStatus::approximated);
+			TEST_FALSE("something chosen", result.armors->empty());
+			TEST_LE("fallback within budget", result.total_cost, 5000);
+			TEST_EQUAL("still counted as rejected", 1, service.stats().rejected);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Cached radix-sorted orderings", 2,
+		[&]()
+		{
+			// Stable ascending order, signs and all, across several passes.
+			std::vector<uint64_t> keys;
+			for (int i = -300; i < 300; i++)
+			{
+				keys.push_back(order_preserving_key(int32_t((i * 7919) % 1000)));
+				keys.push_back(order_preserving_key(double(i % 37) * 1.5e5));
+			}
+			std::vector<uint32_t> order = radix_sort_permutation(keys);
+			std::vector<uint32_t> expected(keys.size());
+			for (size_t i = 0; i < expected.size(); i++)
+			{
+				expected[i] = i;
+			}
+			std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+			TEST_TRUE("radix sort is stable and ordered", order == expected);
+			TEST_TRUE("keys keep order", order_preserving_key(-2.5) < order_preserving_key(-1.0)
+				&& order_preserving_key(-1.0) < order_preserving_key(0.0) && order_preserving_key(0.0) < order_preserving_key(3.0)
+				&& order_preserving_key(int32_t(-5)) < order_preserving_key(int32_t(0)));
+			
+			ArmorColumns columns(*filtered_armors);
+			CatalogOrderings orders(columns, 4);
+			TEST_EQUAL("version", columns.version(), orders.version);
+			TEST_EQUAL("size", columns.size(), orders.size());
+			bool sorted = true;
+			for (size_t k = 1; k < columns.size(); k++)
+			{
+				uint32_t a = orders.by_efficiency[k - 1], b = orders.by_efficiency[k];
+				sorted = sorted && columns.defense(a) / columns.cost(a) >= columns.defense(b) / columns.cost(b);
+				a = orders.by_cost[k - 1], b = orders.by_cost[k];
+				sorted = sorted && (columns.cost(a) < columns.cost(b) || (columns.cost(a) == columns.cost(b) && a < b));
+				a = orders.by_defense[k - 1], b = orders.by_defense[k];
+				sorted = sorted && columns.defense(a) >= columns.defense(b);
+			}
+			TEST_TRUE("orders sorted", sorted);
+			
+			// Built once per catalog version; a changed catalog is a new version.
+			CatalogOrderCache cache(2);
+			auto first = cache.get(columns);
+			TEST_TRUE("hit", cache.get(columns) == first);
+			TEST_EQUAL("one build", 1, cache.builds());
+			ArmorColumns copy(columns);
+			TEST_TRUE("copies share a version", cache.get(copy) == first);
+			auto subset = filter_armor_vector(*filtered_armors, 0, 2500, 100);
+			ArmorColumns changed(*subset);
+			TEST_TRUE("new version", changed.version() != columns.version());
+			TEST_EQUAL("changed catalog sorted", changed.size(), cache.get(changed)->size());
+			TEST_EQUAL("two builds", 2, cache.builds());
+			cache.invalidate(columns.version());
+			TEST_TRUE("rebuilt after invalidate", cache.get(columns) != first);
+			TEST_EQUAL("three builds", 3, cache.builds());
+			
+			// Threads missing on one version together share a single build.
+			CatalogOrderCache shared_cache;
+			std::vector<std::shared_ptr<const CatalogOrderings>> seen(8);
+			std::vector<std::thread> threads;
+			for (size_t t = 0; t < seen.size(); t++)
+			{
+				threads.emplace_back([&, t]() { seen[t] = shared_cache.get(columns); });
+			}
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+			TEST_EQUAL("one shared build", 1, shared_cache.builds());
+			TEST_TRUE("same orderings", std::all_of(seen.begin(), seen.end(), [&](const std::shared_ptr<const CatalogOrderings>& got)
+			{
+				return got == seen[0];
+			}));
+			
+			// The engines answer the same with the orders as by sorting.
+			DefenseBounds cached_bounds(columns, orders);
+			DefenseBounds sorted_bounds(*filtered_armors);
+			SolverWorkspace workspace;
+			for (int budget : { 0, 7, 100, 1000, 20000 })
+			{
+				TEST_EQUAL("bounds lower", sorted_bounds.lower_bound(budget), cached_bounds.lower_bound(budget));
+				TEST_EQUAL("bounds upper", sorted_bounds.upper_bound(budget), cached_bounds.upper_bound(budget));
+				GreedyChoice walked = greedy_half_max_defense_indices(columns.costs(), columns.defenses(), columns.size(), budget, workspace, &orders);
+				double walked_defense = walked.total_defense;
+				GreedyChoice selected = greedy_half_max_defense_indices(columns.costs(), columns.defenses(), columns.size(), budget, workspace);
+				TEST_LE("greedy within budget", walked.total_cost, budget);
+				TEST_LE("greedy agrees", std::fabs(walked_defense - selected.total_defense), 1e-9 * std::max(1.0, walked_defense));
+			}
+			
+			std::vector<int> budgets = { 300, 200, 100 };
+			PartyOptions party_options;
+			party_options.threads = 1;
+			double with_orders = 0, without_orders = 0;
+			for (auto& basket : party_max_defense(columns, budgets, party_options))
+			{
+				int cost;
+				double defense;
+				sum_armor_vector(*basket, cost, defense);
+				with_orders += defense;
+			}
+			for (auto& basket : party_max_defense(*filtered_armors, budgets, party_options))
+			{
+				int cost;
+				double defense;
+				sum_armor_vector(*basket, cost, defense);
+				without_orders += defense;
+			}
+			TEST_LE("party agrees", std::fabs(with_orders - without_orders), 1e-9 * with_orders);
+		}
+	);
+	
 	return rubric.run();
 }
 
@@ -0,0 +1,820 @@
+///////////////////////////////////////////////////////////////////////////////
+// metrics.hh
+//
+// Operational metrics for a resident solver: latency histograms per engine
+// and phase, and counters for cells computed, cache hits and rejected queries.
+//
+// Recording is lock-free so it can stay on in production: one relaxed atomic
+// add into a fixed bucket, while sums and counters go to a shard owned by the
+// recording thread, a plain load and store summed when the metrics are read.
+// The histograms are HDR-style: exact below 64 ns,
+// then 32 linear sub-buckets per power of two, so any recorded latency is
+// reported within about 3%.
+//
+// The whole set can be rendered in the Prometheus text exposition format and
+// served on a local Unix socket, or written out when the process gets a signal:
+//
+//    auto server = serve_metrics(SolverMetrics::global(), "/tmp/maxdefense.sock");
+//    auto dump = dump_metrics_on_signal(SolverMetrics::global(), SIGUSR1);
+//
+//    $ socat - UNIX-CONNECT:/tmp/maxdefense.sock
+//    $ kill -USR1 <pid>
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+// Per-thread shards for MetricCounter.
+namespace metric_shards
+{
+	// Threads that can own a shard at once; the rest share one atomic.
+	const size_t count = 64;
+
+	// Owners of the shards, handed back when their thread exits.
+	class Registry
+	{
+		//
+		public:
+
+			// A free shard, or count if all are taken.
+			size_t acquire()
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				for (size_t i = 0; i < count; i++)
+				{
+					if ( ! _taken[i] )
+					{
+						_taken[i] = true;
+						return i;
+					}
+				}
+				return count;
+			}
+
+			//
+			void release(size_t shard)
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (shard < count)
+				{
+					_taken[shard] = false;
+				}
+			}
+
+			//
+			static Registry& global()
+			{
+				static Registry registry;
+				return registry;
+			}
+
+		//
+		private:
+
+			std::mutex _mutex;
+			bool _taken[count] = {};
+	};
+
+	// Takes a shard for the calling thread and hands it back at thread exit.
+	size_t claim()
+	{
+		struct Owner
+		{
+			// Keeps the registry alive until the last owner has released.
+			Registry& registry = Registry::global();
+			size_t shard = registry.acquire();
+			~Owner() { registry.release(shard); }
+		};
+		static thread_local Owner owner;
+		return owner.shard;
+	}
+
+	// The calling thread's shard, its alone while it lives; count if none was
+	// free. A plain thread_local, so after the first call there is no guard.
+	size_t this_thread()
+	{
+		static thread_local size_t shard = SIZE_MAX;
+		if (shard == SIZE_MAX)
+		{
+			shard = claim();
+		}
+		return shard;
+	}
+}
+
+
+// Monotonic event counter. Each thread adds into its own shard with a plain
+// load and store instead of a locked add; value() sums the shards. A shard
+// keeps its total when its thread exits and the next owner adds onto it.
+class MetricCounter
+{
+	//
+	public:
+
+		//
+		MetricCounter()
+		{
+			for (auto& shard : _shards)
+			{
+				shard.value.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		MetricCounter(const MetricCounter&) = delete;
+		MetricCounter& operator=(const MetricCounter&) = delete;
+
+		//
+		void add(uint64_t amount = 1)
+		{
+			size_t shard = metric_shards::this_thread();
+			if (shard < metric_shards::count)
+			{
+				std::atomic<uint64_t>& value = _shards[shard].value;
+				value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+			}
+			else
+			{
+				_shared.fetch_add(amount, std::memory_order_relaxed);
+			}
+		}
+
+		//
+		uint64_t value() const
+		{
+			uint64_t total = _shared.load(std::memory_order_relaxed);
+			for (auto& shard : _shards)
+			{
+				total += shard.value.load(std::memory_order_relaxed);
+			}
+			return total;
+		}
+
+	//
+	private:
+
+		// One cache line each, so owners never share a line.
+		struct alignas(64) Shard
+		{
+			std::atomic<uint64_t> value;
+		};
+
+		Shard _shards[metric_shards::count];
+		std::atomic<uint64_t> _shared{0};
+};
+
+
+// Latency distribution in nanoseconds.
+class LatencyHistogram
+{
+	//
+	public:
+
+		// Linear sub-buckets per power of two, as a power of two.
+		static const int sub_bucket_bits = 5;
+		static const size_t sub_buckets = size_t(1) << sub_bucket_bits;
+		// Group 0 holds 0..2 * sub_buckets - 1 exactly; groups 1 through
+		// 64 - sub_bucket_bits cover exponents sub_bucket_bits + 1 through 63.
+		static const size_t bucket_count = (65 - sub_bucket_bits) * sub_buckets;
+
+		//
+		LatencyHistogram()
+		{
+			for (auto& count : _counts)
+			{
+				count.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		LatencyHistogram(const LatencyHistogram&) = delete;
+		LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+		//
+		void record(uint64_t nanoseconds)
+		{
+			_counts[bucket_index(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+			_sum.add(nanoseconds);
+		}
+
+		// Record the time since start.
+		void record_since(std::chrono::steady_clock::time_point start)
+		{
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+		}
+
+		// Number of values recorded so far.
+		uint64_t count() const
+		{
+			uint64_t total = 0;
+			for (auto& count : _counts)
+			{
+				total += count.load(std::memory_order_relaxed);
+			}
+			return total;
+		}
+
+		// Sum of the values recorded so far.
+		uint64_t sum() const { return _sum.value(); }
+
+		// Smallest bucket bound at or below which a fraction q of the values lie;
+		// 0 when nothing was recorded.
+		uint64_t percentile(double q) const
+		{
+			assert(q >= 0 && q <= 1);
+			uint64_t total = count();
+			if (total == 0)
+			{
+				return 0;
+			}
+			uint64_t rank = std::max<uint64_t>(1, std::ceil(q * total));
+			uint64_t seen = 0;
+			for (size_t i = 0; i < bucket_count; i++)
+			{
+				seen += _counts[i].load(std::memory_order_relaxed);
+				if (seen >= rank)
+				{
+					return bucket_upper(i) - 1;
+				}
+			}
+			return bucket_upper(bucket_count - 1) - 1;
+		}
+
+		// Values recorded into bucket i.
+		uint64_t bucket(size_t i) const { return _counts[i].load(std::memory_order_relaxed); }
+
+		// Bucket i holds values in [bucket_lower(i), bucket_upper(i)).
+		static uint64_t bucket_lower(size_t i)
+		{
+			size_t group = i / sub_buckets;
+			if (group == 0)
+			{
+				return i;
+			}
+			return uint64_t(i % sub_buckets + sub_buckets) << (group - 1);
+		}
+
+		static uint64_t bucket_upper(size_t i)
+		{
+			size_t group = i / sub_buckets;
+			if (i + 1 == bucket_count)
+			{
+				return UINT64_MAX;
+			}
+			return bucket_lower(i) + (group == 0 ? 1 : uint64_t(1) << (group - 1));
+		}
+
+		//
+		static size_t bucket_index(uint64_t value)
+		{
+			if (value < 2 * sub_buckets)
+			{
+				return value;
+			}
+			int exponent = 63 - __builtin_clzll(value);
+			size_t mantissa = value >> (exponent - sub_bucket_bits);
+			return (exponent - sub_bucket_bits + 1) * sub_buckets + (mantissa - sub_buckets);
+		}
+
+	//
+	private:
+
+		std::atomic<uint64_t> _counts[bucket_count];
+		MetricCounter _sum;
+};
+
+
+// Every metric of one solver process.
+class SolverMetrics
+{
+	//
+	public:
+
+		// Most (engine, phase) pairs that can be registered; further pairs all
+		// share one histogram, exported as engine="overflow", phase="overflow".
+		static const size_t max_series = 64;
+
+		// Slots for histogram(slot, engine, phase).
+		static const size_t max_slots = 64;
+
+		//
+		SolverMetrics()
+		{
+			for (auto& slot : _slots)
+			{
+				slot.store(nullptr, std::memory_order_relaxed);
+			}
+		}
+
+		SolverMetrics(const SolverMetrics&) = delete;
+		SolverMetrics& operator=(const SolverMetrics&) = delete;
+
+		// DP cells filled by any engine.
+		MetricCounter cells_computed;
+
+		// Queries answered from a cache instead of a solve.
+		MetricCounter cache_hits;
+
+		// Queries turned away, e.g. by admission control.
+		MetricCounter rejected_queries;
+
+		// Histogram for one engine and phase, registered on first use. Lookups
+		// after the first are lock-free; passing string literals makes them a
+		// pointer comparison per registered series.
+		LatencyHistogram& histogram(const char* engine, const char* phase)
+		{
+			size_t published = _published.load(std::memory_order_acquire);
+			for (size_t i = 0; i < published; i++)
+			{
+				if (_series[i]->engine_key == engine && _series[i]->phase_key == phase)
+				{
+					return _series[i]->histogram;
+				}
+			}
+			for (size_t i = 0; i < published; i++)
+			{
+				if (_series[i]->engine == engine && _series[i]->phase == phase)
+				{
+					return _series[i]->histogram;
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(_register);
+			published = _published.load(std::memory_order_relaxed);
+			for (size_t i = 0; i < published; i++)
+			{
+				if (_series[i]->engine == engine && _series[i]->phase == phase)
+				{
+					return _series[i]->histogram;
+				}
+			}
+			if (published == max_series)
+			{
+				return _overflow.histogram;
+			}
+			_series[published].reset(new Series(engine, phase));
+			_published.store(published + 1, std::memory_order_release);
+			return _series[published]->histogram;
+		}
+
+		// Same as above, remembered in slot so later lookups are a single atomic
+		// load. Callers number their (engine, phase) pairs, e.g. by enum, and
+		// must always pass the same pair for a slot. Slots past max_slots fall
+		// back to the lookup by name.
+		LatencyHistogram& histogram(size_t slot, const char* engine, const char* phase)
+		{
+			if (slot >= max_slots)
+			{
+				return histogram(engine, phase);
+			}
+			LatencyHistogram* cached = _slots[slot].load(std::memory_order_acquire);
+			if ( ! cached )
+			{
+				cached = &histogram(engine, phase);
+				_slots[slot].store(cached, std::memory_order_release);
+			}
+			return *cached;
+		}
+
+		// Queries answered, including cache hits: every solve-phase latency
+		// recorded, plus the hits, so solves need no counter of their own.
+		uint64_t queries() const
+		{
+			uint64_t total = cache_hits.value();
+			size_t published = _published.load(std::memory_order_acquire);
+			for (size_t s = 0; s < published; s++)
+			{
+				if (_series[s]->phase == "solve")
+				{
+					total += _series[s]->histogram.count();
+				}
+			}
+			return total;
+		}
+
+		// Render every metric in the Prometheus text exposition format.
+		// Latencies are in seconds; only non-empty buckets get an "le" line.
+		std::string prometheus_text() const
+		{
+			std::ostringstream out;
+			counter_text(out, "maxdefense_queries_total", "Queries answered, including cache hits.", queries());
+			counter_text(out, "maxdefense_cache_hits_total", "Queries answered from a cache.", cache_hits);
+			counter_text(out, "maxdefense_rejected_queries_total", "Queries turned away by admission control.", rejected_queries);
+			counter_text(out, "maxdefense_cells_computed_total", "DP cells filled.", cells_computed);
+
+			out
+				<< "# HELP maxdefense_latency_seconds Solver latency by engine and phase." << std::endl
+				<< "# TYPE maxdefense_latency_seconds histogram" << std::endl
+				;
+			out.precision(9);
+			size_t published = _published.load(std::memory_order_acquire);
+			for (size_t s = 0; s <= published; s++)
+			{
+				const Series& series = s < published ? *_series[s] : _overflow;
+				if (&series == &_overflow && series.histogram.count() == 0)
+				{
+					continue;
+				}
+				std::string labels = "engine=\"" + series.engine + "\",phase=\"" + series.phase + "\"";
+				uint64_t cumulative = 0;
+				for (size_t i = 0; i < LatencyHistogram::bucket_count; i++)
+				{
+					uint64_t count = series.histogram.bucket(i);
+					if (count == 0)
+					{
+						continue;
+					}
+					cumulative += count;
+					out
+						<< "maxdefense_latency_seconds_bucket{" << labels
+						<< ",le=\"" << LatencyHistogram::bucket_upper(i) * 1e-9 << "\"} " << cumulative << std::endl
+						;
+				}
+				out
+					<< "maxdefense_latency_seconds_bucket{" << labels << ",le=\"+Inf\"} " << cumulative << std::endl
+					<< "maxdefense_latency_seconds_sum{" << labels << "} " << series.histogram.sum() * 1e-9 << std::endl
+					<< "maxdefense_latency_seconds_count{" << labels << "} " << cumulative << std::endl
+					;
+			}
+			return out.str();
+		}
+
+		// Process-wide instance for code without a SolverMetrics to hand.
+		static SolverMetrics& global()
+		{
+			static SolverMetrics metrics;
+			return metrics;
+		}
+
+	//
+	private:
+
+		struct Series
+		{
+			Series(const char* engine, const char* phase)
+				:
+				engine_key(engine),
+				phase_key(phase),
+				engine(engine),
+				phase(phase)
+			{}
+
+			const char* engine_key;
+			const char* phase_key;
+			std::string engine, phase;
+			LatencyHistogram histogram;
+		};
+
+		static void counter_text(std::ostream& out, const char* name, const char* help, uint64_t value)
+		{
+			out
+				<< "# HELP " << name << " " << help << std::endl
+				<< "# TYPE " << name << " counter" << std::endl
+				<< name << " " << value << std::endl
+				;
+		}
+
+		static void counter_text(std::ostream& out, const char* name, const char* help, const MetricCounter& counter)
+		{
+			counter_text(out, name, help, counter.value());
+		}
+
+		std::unique_ptr<Series> _series[max_series];
+		std::atomic<size_t> _published{0};
+		Series _overflow{"overflow", "overflow"};
+		std::atomic<LatencyHistogram*> _slots[max_slots];
+		std::mutex _register;
+};
+
+
+// Timestamps for ScopedLatency. On x86 these are TSC ticks, which read in about
+// half the time of steady_clock on a VM; elsewhere, steady_clock nanoseconds.
+namespace latency_clock
+{
+	//
+	uint64_t now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// Nanoseconds per tick of now(); the first call calibrates the TSC against
+	// steady_clock for about a millisecond.
+	double nanoseconds_per_tick()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		static const double ratio = []()
+		{
+			auto start = std::chrono::steady_clock::now();
+			uint64_t ticks = __rdtsc();
+			std::chrono::steady_clock::duration elapsed;
+			do
+			{
+				elapsed = std::chrono::steady_clock::now() - start;
+			}
+			while (elapsed < std::chrono::milliseconds(1));
+			ticks = __rdtsc() - ticks;
+			return ticks ? double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / ticks : 1.0;
+		}();
+		return ratio;
+#else
+		return 1;
+#endif
+	}
+}
+
+
+// Records the lifetime of a scope into a histogram; does nothing for nullptr.
+class ScopedLatency
+{
+	//
+	public:
+
+		//
+		explicit ScopedLatency(LatencyHistogram* histogram)
+			:
+			_histogram(histogram)
+		{
+			if (_histogram)
+			{
+				_nanoseconds_per_tick = latency_clock::nanoseconds_per_tick();
+				_start = latency_clock::now();
+			}
+		}
+
+		~ScopedLatency()
+		{
+			if (_histogram)
+			{
+				// A thread moved between cores may see a slightly earlier tick.
+				uint64_t end = latency_clock::now();
+				_histogram->record(end > _start ? uint64_t((end - _start) * _nanoseconds_per_tick) : 0);
+			}
+		}
+
+		ScopedLatency(const ScopedLatency&) = delete;
+		ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+	//
+	private:
+
+		LatencyHistogram* _histogram;
+		double _nanoseconds_per_tick = 1;
+		uint64_t _start = 0;
+};
+
+
+// Write all of buf to fd, retrying short writes; false on error.
+bool write_fully(int fd, const std::string& buf)
+{
+	size_t done = 0;
+	while (done < buf.size())
+	{
+		ssize_t wrote = ::write(fd, buf.data() + done, buf.size() - done);
+		if (wrote < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (wrote <= 0)
+		{
+			return false;
+		}
+		done += wrote;
+	}
+	return true;
+}
+
+
+// Serves SolverMetrics::prometheus_text() to every client that connects to a
+// Unix socket, then closes the connection. Stops when destroyed.
+class MetricsServer
+{
+	//
+	public:
+
+		//
+		MetricsServer(SolverMetrics& metrics, int listener, const std::string& path)
+			:
+			_metrics(metrics),
+			_listener(listener),
+			_path(path),
+			_thread(&MetricsServer::serve, this)
+		{}
+
+		~MetricsServer()
+		{
+			_stop.store(true);
+			_thread.join();
+			::close(_listener);
+			::unlink(_path.c_str());
+		}
+
+		MetricsServer(const MetricsServer&) = delete;
+		MetricsServer& operator=(const MetricsServer&) = delete;
+
+		//
+		const std::string& path() const { return _path; }
+
+	//
+	private:
+
+		// Poll with a short timeout so the destructor never waits long.
+		void serve()
+		{
+			while ( ! _stop.load() )
+			{
+				pollfd ready = { _listener, POLLIN, 0 };
+				if (::poll(&ready, 1, 100) <= 0)
+				{
+					continue;
+				}
+				int client = ::accept(_listener, nullptr, nullptr);
+				if (client < 0)
+				{
+					continue;
+				}
+				write_fully(client, _metrics.prometheus_text());
+				::close(client);
+			}
+		}
+
+		SolverMetrics& _metrics;
+		int _listener;
+		std::string _path;
+		std::atomic<bool> _stop{false};
+		std::thread _thread;
+};
+
+
+// Start serving metrics on a Unix socket at path, replacing any stale socket
+// file there. Returns nullptr on failure.
+std::unique_ptr<MetricsServer> serve_metrics(SolverMetrics& metrics, const std::string& path)
+{
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		std::cout << "Metrics socket path too long: " << path << std::endl;
+		return nullptr;
+	}
+	std::strcpy(address.sun_path, path.c_str());
+
+	int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0)
+	{
+		std::cout << "Failed to create metrics socket" << std::endl;
+		return nullptr;
+	}
+	::unlink(path.c_str());
+	if (::bind(listener, (const sockaddr*) &address, sizeof(address)) != 0 || ::listen(listener, 8) != 0)
+	{
+		std::cout << "Failed to listen on metrics socket " << path << std::endl;
+		::close(listener);
+		return nullptr;
+	}
+	return std::unique_ptr<MetricsServer>(new MetricsServer(metrics, listener, path));
+}
+
+
+// Write end of the self-pipe the signal handler pokes; -1 when none is installed.
+std::atomic<int> metrics_signal_pipe{-1};
+
+
+// Async-signal-safe: only writes one byte to the pipe.
+void metrics_signal_handler(int)
+{
+	int fd = metrics_signal_pipe.load();
+	if (fd >= 0)
+	{
+		char poke = 1;
+		ssize_t ignored = ::write(fd, &poke, 1);
+		(void) ignored;
+	}
+}
+
+
+// Writes SolverMetrics::prometheus_text() to a file descriptor each time the
+// process receives a signal. The handler only pokes a pipe; formatting happens
+// on a helper thread. One may be installed at a time; destroying it restores
+// the previous handler.
+class MetricsSignalDump
+{
+	//
+	public:
+
+		//
+		MetricsSignalDump(SolverMetrics& metrics, int signal, int output, const int pipe_fds[2])
+			:
+			_metrics(metrics),
+			_signal(signal),
+			_output(output),
+			_read_end(pipe_fds[0]),
+			_write_end(pipe_fds[1])
+		{
+			metrics_signal_pipe.store(_write_end);
+			_thread = std::thread(&MetricsSignalDump::dump, this);
+
+			struct sigaction action;
+			std::memset(&action, 0, sizeof(action));
+			action.sa_handler = metrics_signal_handler;
+			action.sa_flags = SA_RESTART;
+			sigemptyset(&action.sa_mask);
+			::sigaction(_signal, &action, &_previous);
+		}
+
+		~MetricsSignalDump()
+		{
+			::sigaction(_signal, &_previous, nullptr);
+			metrics_signal_pipe.store(-1);
+
+			// Closing the write end wakes the helper thread with end of file.
+			::close(_write_end);
+			_thread.join();
+			::close(_read_end);
+		}
+
+		MetricsSignalDump(const MetricsSignalDump&) = delete;
+		MetricsSignalDump& operator=(const MetricsSignalDump&) = delete;
+
+	//
+	private:
+
+		void dump()
+		{
+			char poke;
+			while (true)
+			{
+				ssize_t got = ::read(_read_end, &poke, 1);
+				if (got < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (got <= 0)
+				{
+					return;
+				}
+				write_fully(_output, _metrics.prometheus_text());
+			}
+		}
+
+		SolverMetrics& _metrics;
+		int _signal, _output, _read_end, _write_end;
+		struct sigaction _previous;
+		std::thread _thread;
+};
+
+
+// Dump metrics to output each time signal arrives. Returns nullptr on failure
+// or when another dump is already installed.
+std::unique_ptr<MetricsSignalDump> dump_metrics_on_signal(SolverMetrics& metrics, int signal = SIGUSR1, int output = STDERR_FILENO)
+{
+	if (metrics_signal_pipe.load() >= 0)
+	{
+		std::cout << "A metrics signal dump is already installed" << std::endl;
+		return nullptr;
+	}
+	int pipe_fds[2];
+	if (::pipe2(pipe_fds, O_CLOEXEC) != 0)
+	{
+		std::cout << "Failed to create metrics signal pipe" << std::endl;
+		return nullptr;
+	}
+	return std::unique_ptr<MetricsSignalDump>(new MetricsSignalDump(metrics, signal, output, pipe_fds));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// metrics.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,688 @@
+///////////////////////////////////////////////////////////////////////////////
+// party.hh
+//
+// Party allocation: several characters, each with their own gold, buy from one
+// shop whose items can each be bought once. That is the 0/1 multiple knapsack
+// problem; solving one character after another with dynamic_max_defense gives
+// the first one the best items whether or not that leaves the party well off.
+//
+// Two modes:
+//
+//  - heuristic: members solve exactly one after another over what is left,
+//    poorest first and richest first, and a best-fit greedy in defense-per-gold
+//    order whose baskets are then re-solved the same way; the best of the three
+//    wins. A handful of single-knapsack DPs, so fast.
+//
+//  - exact: branch and bound seeded with the heuristic answer. Upper bounds
+//    come from the surrogate relaxation, which pools the party's gold into one
+//    knapsack. When its table fits in PartyOptions::max_surrogate_cells, the
+//    best defense of every suffix of items at every pooled budget is computed
+//    up front, so each node's bound is exact for the relaxation and costs one
+//    lookup; otherwise nodes use its linear relaxation. Members with equal gold left
+//    are interchangeable, so only the first of them is tried. The top of the
+//    tree is split into subproblems that worker threads take in turn, sharing
+//    the best defense found so far for pruning. A node limit turns it back
+//    into an anytime heuristic; PartyStats says whether the answer is proven.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "maxdefense.hh"
+
+
+// How party_max_defense searches.
+enum class PartyMode
+{
+	heuristic,
+	exact
+};
+
+
+// Counters filled in by party_max_defense when PartyOptions::stats is set.
+struct PartyStats
+{
+	// Defense of the answer, summed over the party.
+	double total_defense = 0;
+
+	// No allocation has more defense than this.
+	double upper_bound = 0;
+
+	// Whether total_defense is proven to be the optimum.
+	bool optimal = false;
+
+	// Branch-and-bound nodes visited, and the subproblems the tree was split into.
+	size_t nodes = 0;
+	size_t subproblems = 0;
+};
+
+
+// Knobs for party_max_defense.
+struct PartyOptions
+{
+	PartyMode mode = PartyMode::exact;
+
+	// Branch-and-bound threads; 0 means one per hardware thread.
+	unsigned threads = 0;
+
+	// Stop the exact search after this many nodes and keep the best answer so far.
+	size_t max_nodes = size_t(1) << 24;
+
+	// Most cells of the surrogate bound table, (items + 1) x (pooled gold + 1)
+	// doubles. Larger problems bound nodes by the linear relaxation instead,
+	// with one exact surrogate row for the root if the pooled gold fits. The
+	// heuristic mode only ever builds that root row.
+	size_t max_surrogate_cells = size_t(1) << 23;
+
+	// Optional orders of the shop, so its items need not be sorted again. The
+	// ArmorColumns front end fills it from CatalogOrderCache::global().
+	const CatalogOrderings* orderings = nullptr;
+
+	// Optional; receives counters for this call.
+	PartyStats* stats = nullptr;
+};
+
+
+// Shared state of one exact party search; see the top of this file.
+class PartySearch
+{
+	//
+	public:
+
+		// costs and defenses are in efficiency order, every item affordable by
+		// some member; incumbent is a feasible assignment (member or -1 per item).
+		PartySearch
+		(
+			const std::vector<int32_t>& costs,
+			const std::vector<double>& defenses,
+			const std::vector<int>& budgets,
+			const std::vector<int>& incumbent,
+			double incumbent_defense,
+			size_t max_nodes,
+			size_t max_surrogate_cells
+		)
+			:
+			_costs(costs),
+			_defenses(defenses),
+			_budgets(budgets),
+			_max_nodes(max_nodes),
+			_best_defense(incumbent_defense),
+			_best(incumbent)
+		{
+			_prefix_cost.assign(1, 0);
+			_prefix_defense.assign(1, 0);
+			for (size_t i = 0; i < _costs.size(); i++)
+			{
+				_prefix_cost.push_back(_prefix_cost.back() + _costs[i]);
+				_prefix_defense.push_back(_prefix_defense.back() + _defenses[i]);
+			}
+
+			int64_t pooled = 0;
+			for (int gold : _budgets)
+			{
+				pooled += gold;
+			}
+			size_t n = _costs.size();
+			if (size_t(pooled) + 1 <= max_surrogate_cells / (n + 1))
+			{
+				// Row i: best defense from items i.. for every pooled budget.
+				_width = pooled + 1;
+				_suffix.assign((n + 1) * _width, 0);
+				for (size_t i = n; i > 0; i--)
+				{
+					dynamic_fill_row(&_suffix[i * _width], &_suffix[(i - 1) * _width], pooled, _costs[i - 1], _defenses[i - 1]);
+				}
+			}
+		}
+
+		// Whether bound() is the exact surrogate optimum rather than its linear relaxation.
+		bool exact_surrogate() const { return ! _suffix.empty(); }
+
+		// Surrogate bound on what items first.. can add with the party's
+		// remaining gold pooled into capacity.
+		double bound(size_t first, int64_t capacity) const
+		{
+			if ( ! _suffix.empty() )
+			{
+				return _suffix[first * _width + capacity];
+			}
+			auto limit = std::upper_bound(_prefix_cost.begin() + first, _prefix_cost.end(), _prefix_cost[first] + capacity);
+			size_t k = limit - _prefix_cost.begin() - 1;
+			double bound = _prefix_defense[k] - _prefix_defense[first];
+			if (k < _costs.size())
+			{
+				bound += double(capacity - (_prefix_cost[k] - _prefix_cost[first])) * _defenses[k] / _costs[k];
+			}
+			return bound;
+		}
+
+		// Split the tree below the root into at least count subproblems, in
+		// depth-first order, and solve them on threads threads.
+		void run(unsigned threads, size_t count)
+		{
+			std::vector<Node> frontier(1);
+			frontier[0].residual = _budgets;
+			for (size_t depth = 0; depth < _costs.size() && frontier.size() < count; depth++)
+			{
+				std::vector<Node> next;
+				for (Node& node : frontier)
+				{
+					expand(node, next);
+				}
+				frontier.swap(next);
+			}
+			_subproblems = frontier.size();
+
+			std::atomic<size_t> taken(0);
+			auto work = [&]()
+			{
+				Worker worker;
+				worker.assignment.assign(_costs.size(), -1);
+				for (size_t s; (s = taken++) < frontier.size(); )
+				{
+					const Node& node = frontier[s];
+					worker.residual = node.residual;
+					std::fill(worker.assignment.begin(), worker.assignment.end(), -1);
+					std::copy(node.decisions.begin(), node.decisions.end(), worker.assignment.begin());
+					int64_t total = 0;
+					for (int gold : worker.residual)
+					{
+						total += gold;
+					}
+					search(worker, node.decisions.size(), node.defense, total);
+				}
+				_nodes += worker.nodes % flush_every;
+			};
+
+			std::vector<std::thread> workers;
+			for (unsigned t = 1; t < threads; t++)
+			{
+				workers.emplace_back(work);
+			}
+			work();
+			for (auto& worker : workers)
+			{
+				worker.join();
+			}
+		}
+
+		//
+		double best_defense() const { return _best_defense.load(); }
+		const std::vector<int>& best() const { return _best; }
+		bool aborted() const { return _aborted.load(); }
+		size_t nodes() const { return _nodes.load(); }
+		size_t subproblems() const { return _subproblems; }
+
+	//
+	private:
+
+		// A subproblem: the decisions for the first items (member or -1).
+		struct Node
+		{
+			std::vector<int> decisions;
+			std::vector<int> residual;
+			double defense = 0;
+		};
+
+		struct Worker
+		{
+			std::vector<int> residual;
+			std::vector<int> assignment;
+			size_t nodes = 0;
+		};
+
+		static const size_t flush_every = 4096;
+
+		// Members that may take item i given gold left, tightest fit first,
+		// skipping members with the same gold left as one already listed.
+		size_t members_for(size_t i, const std::vector<int>& residual, int* order) const
+		{
+			size_t count = 0;
+			for (size_t k = 0; k < residual.size(); k++)
+			{
+				if (residual[k] < _costs[i])
+				{
+					continue;
+				}
+				bool duplicate = false;
+				for (size_t j = 0; j < count && ! duplicate; j++)
+				{
+					duplicate = residual[order[j]] == residual[k];
+				}
+				if (duplicate)
+				{
+					continue;
+				}
+				size_t at = count++;
+				for ( ; at > 0 && residual[order[at - 1]] > residual[k]; at--)
+				{
+					order[at] = order[at - 1];
+				}
+				order[at] = k;
+			}
+			return count;
+		}
+
+		// Append node's children for its next item to out.
+		void expand(const Node& node, std::vector<Node>& out) const
+		{
+			size_t i = node.decisions.size();
+			std::vector<int> order(node.residual.size());
+			size_t count = members_for(i, node.residual, order.data());
+			for (size_t c = 0; c <= count; c++)
+			{
+				Node child = node;
+				if (c < count)
+				{
+					child.decisions.push_back(order[c]);
+					child.residual[order[c]] -= _costs[i];
+					child.defense += _defenses[i];
+				}
+				else
+				{
+					child.decisions.push_back(-1);
+				}
+				out.push_back(std::move(child));
+			}
+		}
+
+		// Keep worker's assignment if it beats the best so far.
+		void offer(const Worker& worker, double defense)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (defense > _best_defense.load())
+			{
+				_best = worker.assignment;
+				_best_defense.store(defense);
+			}
+		}
+
+		// Depth-first search deciding items i.. with defense so far and
+		// total gold left across the party.
+		void search(Worker& worker, size_t i, double defense, int64_t total)
+		{
+			if (++worker.nodes % flush_every == 0 && (_nodes += flush_every) > _max_nodes)
+			{
+				_aborted = true;
+			}
+			if (_aborted.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			// Every node is a feasible allocation of the items decided so far.
+			double best = _best_defense.load(std::memory_order_relaxed);
+			if (defense > best)
+			{
+				offer(worker, defense);
+				best = defense;
+			}
+			if (i == _costs.size() || total == 0 || defense + bound(i, total) <= best + tolerance * std::max(1.0, best))
+			{
+				return;
+			}
+
+			int order[64];
+			assert(worker.residual.size() <= 64);
+			size_t count = members_for(i, worker.residual, order);
+			for (size_t c = 0; c < count; c++)
+			{
+				int k = order[c];
+				worker.residual[k] -= _costs[i];
+				worker.assignment[i] = k;
+				search(worker, i + 1, defense + _defenses[i], total - _costs[i]);
+				worker.assignment[i] = -1;
+				worker.residual[k] += _costs[i];
+			}
+			search(worker, i + 1, defense, total);
+		}
+
+		static constexpr double tolerance = 1e-12;
+
+		const std::vector<int32_t>& _costs;
+		const std::vector<double>& _defenses;
+		const std::vector<int>& _budgets;
+		std::vector<int64_t> _prefix_cost;
+		std::vector<double> _prefix_defense;
+		std::vector<double> _suffix;
+		size_t _width = 0;
+		size_t _max_nodes;
+
+		std::atomic<double> _best_defense;
+		std::atomic<bool> _aborted{false};
+		std::atomic<size_t> _nodes{0};
+		size_t _subproblems = 0;
+
+		std::mutex _mutex;
+		std::vector<int> _best;
+};
+
+
+// Total defense of an assignment (member or -1 per item).
+double party_defense(const std::vector<double>& defenses, const std::vector<int>& assignment)
+{
+	double total = 0;
+	for (size_t i = 0; i < assignment.size(); i++)
+	{
+		total += assignment[i] >= 0 ? defenses[i] : 0;
+	}
+	return total;
+}
+
+
+// Member k solves exactly over its own basket and every unassigned item it
+// can afford. Never lowers the party's defense, since the old basket is one
+// of its choices; with an empty basket this is one step of sequential buying.
+void party_resolve
+(
+	size_t k,
+	const std::vector<int32_t>& costs,
+	const std::vector<double>& defenses,
+	const std::vector<int>& budgets,
+	std::vector<int>& assignment,
+	SolverWorkspace& workspace
+)
+{
+	std::vector<size_t> candidates;
+	int32_t* candidate_costs = workspace.costs(costs.size());
+	double* candidate_defenses = workspace.defenses(costs.size());
+	for (size_t i = 0; i < costs.size(); i++)
+	{
+		if (assignment[i] == int(k) || (assignment[i] < 0 && costs[i] <= budgets[k]))
+		{
+			candidate_costs[candidates.size()] = costs[i];
+			candidate_defenses[candidates.size()] = defenses[i];
+			candidates.push_back(i);
+			assignment[i] = -1;
+		}
+	}
+
+	DynamicOptions options;
+	options.workspace = &workspace;
+	for (size_t c : dynamic_max_defense_indices(candidate_costs, candidate_defenses, candidates.size(), budgets[k], options))
+	{
+		assignment[candidates[c]] = k;
+	}
+}
+
+
+// The heuristic mode's answer; see the top of this file. costs and defenses
+// are in efficiency order.
+std::vector<int> party_heuristic
+(
+	const std::vector<int32_t>& costs,
+	const std::vector<double>& defenses,
+	const std::vector<int>& budgets,
+	SolverWorkspace& workspace
+)
+{
+	size_t m = budgets.size();
+	std::vector<size_t> poorest_first(m);
+	for (size_t k = 0; k < m; k++)
+	{
+		poorest_first[k] = k;
+	}
+	std::stable_sort(poorest_first.begin(), poorest_first.end(), [&](size_t a, size_t b) { return budgets[a] < budgets[b]; });
+	std::vector<size_t> richest_first(poorest_first.rbegin(), poorest_first.rend());
+
+	// Best-fit greedy: each item to the member it leaves the least gold.
+	std::vector<int> greedy(costs.size(), -1);
+	std::vector<int> residual(budgets);
+	for (size_t i = 0; i < costs.size(); i++)
+	{
+		int fit = -1;
+		for (size_t k = 0; k < m; k++)
+		{
+			if (residual[k] >= costs[i] && (fit < 0 || residual[k] < residual[fit]))
+			{
+				fit = k;
+			}
+		}
+		if (fit >= 0)
+		{
+			greedy[i] = fit;
+			residual[fit] -= costs[i];
+		}
+	}
+
+	// Buy one after another from an empty start both ways, and re-solve the greedy baskets.
+	struct Start
+	{
+		const std::vector<int>* assignment;
+		const std::vector<size_t>* members;
+	};
+	std::vector<int> none(costs.size(), -1);
+	std::vector<int> best;
+	double best_defense = -1;
+	for (Start start : { Start{ &none, &poorest_first }, Start{ &none, &richest_first }, Start{ &greedy, &poorest_first } })
+	{
+		std::vector<int> assignment = *start.assignment;
+		for (size_t k : *start.members)
+		{
+			party_resolve(k, costs, defenses, budgets, assignment, workspace);
+		}
+		double defense = party_defense(defenses, assignment);
+		if (defense > best_defense)
+		{
+			best.swap(assignment);
+			best_defense = defense;
+		}
+	}
+	return best;
+}
+
+
+// Linear relaxation of the surrogate knapsack, the party's gold pooled into
+// capacity: whole items in efficiency order while they fit, then a fraction
+// of the next.
+double party_linear_bound(const std::vector<int32_t>& costs, const std::vector<double>& defenses, int64_t capacity)
+{
+	double bound = 0;
+	for (size_t i = 0; i < costs.size(); i++)
+	{
+		if (costs[i] > capacity)
+		{
+			return bound + double(capacity) * defenses[i] / costs[i];
+		}
+		capacity -= costs[i];
+		bound += defenses[i];
+	}
+	return bound;
+}
+
+
+// Multiple-knapsack core shared by the front ends. costs and defenses describe
+// n shop items and budgets the party's gold; returns, for each member, the
+// indices of the items it buys, highest first.
+std::vector<std::vector<size_t>> party_max_defense_indices
+(
+	const int32_t* costs,
+	const double* defenses,
+	size_t n,
+	const std::vector<int>& budgets,
+	const PartyOptions& options = PartyOptions()
+)
+{
+	size_t m = budgets.size();
+	assert(m <= 64);
+	int richest = 0;
+	int64_t pooled = 0;
+	for (int gold : budgets)
+	{
+		assert(gold >= 0);
+		richest = std::max(richest, gold);
+		pooled += gold;
+	}
+
+	// Only items that help and that someone can afford, most defense per gold first.
+	std::vector<size_t> order;
+	if (options.orderings)
+	{
+		assert(options.orderings->size() == n);
+		for (size_t i : options.orderings->by_efficiency)
+		{
+			if (defenses[i] > 0 && costs[i] <= richest)
+			{
+				order.push_back(i);
+			}
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			if (defenses[i] > 0 && costs[i] <= richest)
+			{
+				order.push_back(i);
+			}
+		}
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+		{
+			double left = defenses[a] * costs[b], right = defenses[b] * costs[a];
+			return left != right ? left > right : a < b;
+		});
+	}
+	std::vector<int32_t> sorted_costs(order.size());
+	std::vector<double> sorted_defenses(order.size());
+	for (size_t s = 0; s < order.size(); s++)
+	{
+		sorted_costs[s] = costs[order[s]];
+		sorted_defenses[s] = defenses[order[s]];
+	}
+
+	SolverWorkspace workspace;
+	std::vector<int> assignment = party_heuristic(sorted_costs, sorted_defenses, budgets, workspace);
+	double heuristic_defense = party_defense(sorted_defenses, assignment);
+
+	PartyStats stats;
+	stats.total_defense = heuristic_defense;
+
+	// Only the exact search needs PartySearch and its suffix table; the
+	// heuristic bounds the root alone.
+	std::unique_ptr<PartySearch> search;
+	if (options.mode == PartyMode::exact)
+	{
+		search.reset(new PartySearch(sorted_costs, sorted_defenses, budgets, assignment, heuristic_defense, options.max_nodes, options.max_surrogate_cells));
+		stats.upper_bound = search->bound(0, pooled);
+	}
+	else
+	{
+		stats.upper_bound = party_linear_bound(sorted_costs, sorted_defenses, pooled);
+	}
+	if ( ! (search && search->exact_surrogate()) && size_t(pooled) <= options.max_surrogate_cells )
+	{
+		std::vector<double> row(pooled + 1, 0);
+		for (size_t s = 0; s < order.size(); s++)
+		{
+			for (int64_t j = pooled; j >= sorted_costs[s]; j--)
+			{
+				row[j] = max(row[j], row[j - sorted_costs[s]] + sorted_defenses[s]);
+			}
+		}
+		stats.upper_bound = std::min(stats.upper_bound, row[pooled]);
+	}
+	auto proven = [&](double defense)
+	{
+		return defense >= stats.upper_bound - 1e-9 * std::max(1.0, stats.upper_bound);
+	};
+	stats.optimal = proven(heuristic_defense);
+
+	if (options.mode == PartyMode::exact && ! stats.optimal)
+	{
+		unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+		search->run(threads, threads > 1 ? 8 * threads : 1);
+		assignment = search->best();
+		stats.total_defense = search->best_defense();
+		stats.optimal = ! search->aborted() || proven(stats.total_defense);
+		if ( ! search->aborted() )
+		{
+			stats.upper_bound = stats.total_defense;
+		}
+		stats.nodes = search->nodes();
+		stats.subproblems = search->subproblems();
+	}
+
+	std::vector<std::vector<size_t>> baskets(m);
+	for (size_t s = order.size(); s > 0; s--)
+	{
+		if (assignment[s - 1] >= 0)
+		{
+			baskets[assignment[s - 1]].push_back(order[s - 1]);
+		}
+	}
+	for (auto& basket : baskets)
+	{
+		std::sort(basket.begin(), basket.end(), std::greater<size_t>());
+	}
+	if (options.stats)
+	{
+		*options.stats = stats;
+	}
+	return baskets;
+}
+
+
+// Split the shop between party members with the given gold, maximizing the
+// party's total defense; one ArmorVector per member, in budgets order.
+std::vector<std::unique_ptr<ArmorVector>> party_max_defense
+(
+	const ArmorVector& shop,
+	const std::vector<int>& budgets,
+	const PartyOptions& options = PartyOptions()
+)
+{
+	ArmorColumns columns(shop);
+	std::vector<std::unique_ptr<ArmorVector>> party;
+	for (auto& basket : party_max_defense_indices(columns.costs(), columns.defenses(), columns.size(), budgets, options))
+	{
+		std::unique_ptr<ArmorVector> armors(new ArmorVector);
+		for (size_t i : basket)
+		{
+			armors->push_back(shop[i]);
+		}
+		party.push_back(std::move(armors));
+	}
+	return party;
+}
+
+
+// Same as above, for a columnar catalog; only the bought rows are materialized,
+// and the shop's cached orderings are used unless options has its own.
+std::vector<std::unique_ptr<ArmorVector>> party_max_defense
+(
+	const ArmorColumns& shop,
+	const std::vector<int>& budgets,
+	const PartyOptions& options = PartyOptions()
+)
+{
+	PartyOptions cached = options;
+	std::shared_ptr<const CatalogOrderings> orders;
+	if ( ! cached.orderings )
+	{
+		orders = CatalogOrderCache::global().get(shop);
+		cached.orderings = orders.get();
+	}
+
+	std::vector<std::unique_ptr<ArmorVector>> party;
+	for (auto& basket : party_max_defense_indices(shop.costs(), shop.defenses(), shop.size(), budgets, cached))
+	{
+		party.push_back(shop.select(basket));
+	}
+	return party;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// party.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,352 @@
+///////////////////////////////////////////////////////////////////////////////
+// profiler.hh
+//
+// In-process sampling profiler for hosts where attaching an external one is
+// not allowed. A POSIX CPU-time timer raises SIGPROF at a fixed rate; the
+// handler captures a backtrace into a preallocated buffer with one atomic
+// increment and no locks or allocation. Stacks are symbolized only when the
+// folded output is written, in the "frame;frame;frame count" format that
+// flamegraph.pl and speedscope read.
+//
+//    SamplingProfiler profiler;
+//    profiler.start();            // may be toggled at runtime
+//    ...
+//    profiler.stop();
+//    profiler.write_folded("maxdefense.folded");
+//
+//    $ flamegraph.pl maxdefense.folded > maxdefense.svg
+//
+// Function names come from the dynamic symbol table, so link with -rdynamic;
+// otherwise frames show up as module+offset. Inlined functions fold into
+// their callers.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+
+
+// Samples the whole process's call stacks on CPU time. Only one profiler can
+// be running at a time; starting and stopping is cheap and may be repeated.
+class SamplingProfiler
+{
+	//
+	public:
+
+		// Deepest stack kept per sample; deeper stacks lose their outermost frames.
+		static const int max_depth = 64;
+
+		//
+		explicit SamplingProfiler(size_t capacity = 1 << 16)
+			:
+			_capacity(capacity),
+			_samples(new Sample[capacity])
+		{
+			assert(capacity > 0);
+		}
+
+		~SamplingProfiler()
+		{
+			stop();
+		}
+
+		SamplingProfiler(const SamplingProfiler&) = delete;
+		SamplingProfiler& operator=(const SamplingProfiler&) = delete;
+
+		// Begin sampling at about hz samples per CPU second. Returns false if
+		// another profiler is running or the timer cannot be created.
+		bool start(int hz = 997)
+		{
+			assert(hz > 0);
+			if (_running)
+			{
+				return true;
+			}
+			SamplingProfiler* expected = nullptr;
+			if ( ! active().compare_exchange_strong(expected, this) )
+			{
+				std::cout << "Another sampling profiler is already running" << std::endl;
+				return false;
+			}
+
+			// backtrace() loads its unwinder on first use, which must not happen
+			// inside the signal handler.
+			void* warm[1];
+			backtrace(warm, 1);
+			install_handler();
+
+			sigevent event;
+			std::memset(&event, 0, sizeof(event));
+			event.sigev_notify = SIGEV_SIGNAL;
+			event.sigev_signo = SIGPROF;
+			if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &_timer) != 0)
+			{
+				std::cout << "Failed to create the profiling timer" << std::endl;
+				active().store(nullptr);
+				return false;
+			}
+			long interval = 1000000000L / hz;
+			itimerspec spec;
+			spec.it_interval.tv_sec = interval / 1000000000L;
+			spec.it_interval.tv_nsec = interval % 1000000000L;
+			spec.it_value = spec.it_interval;
+			timer_settime(_timer, 0, &spec, nullptr);
+			_running = true;
+			return true;
+		}
+
+		// Stop sampling; samples taken so far are kept. Returns once no
+		// handler on any thread can still be writing into this profiler.
+		void stop()
+		{
+			if ( ! _running )
+			{
+				return;
+			}
+			timer_delete(_timer);
+			active().store(nullptr);
+
+			// A handler counts itself in before it loads active(), so once the
+			// count drops to zero every later one sees nullptr.
+			while (in_flight().load() != 0)
+			{
+				std::this_thread::yield();
+			}
+			_running = false;
+		}
+
+		//
+		bool running() const { return _running; }
+
+		// Samples held, and samples lost because the buffer was full.
+		size_t samples() const { return std::min(_next.load(), _capacity); }
+		size_t dropped() const { return _dropped.load(); }
+
+		// Forget all samples. Only while stopped.
+		void clear()
+		{
+			assert( ! _running );
+			for (size_t i = 0; i < samples(); i++)
+			{
+				_samples[i].ready.store(false, std::memory_order_relaxed);
+			}
+			_next.store(0);
+			_dropped.store(0);
+		}
+
+		// One line per distinct stack, outermost frame first, with its sample count.
+		std::string folded_stacks() const
+		{
+			std::unordered_map<void*, std::string> names;
+			auto name = [&](void* address, bool return_address)
+			{
+				auto found = names.find(address);
+				if (found == names.end())
+				{
+					// A return address may point just past its function's end.
+					void* inside = return_address ? (char*) address - 1 : address;
+					found = names.emplace(address, frame_name(inside)).first;
+				}
+				return found->second;
+			};
+
+			std::map<std::string, size_t> counts;
+			for (size_t i = 0; i < samples(); i++)
+			{
+				const Sample& sample = _samples[i];
+				if ( ! sample.ready.load(std::memory_order_acquire) || sample.depth <= skipped_frames )
+				{
+					continue;
+				}
+				std::string stack;
+				for (int f = sample.depth - 1; f >= skipped_frames; f--)
+				{
+					if ( ! stack.empty() )
+					{
+						stack += ';';
+					}
+					stack += name(sample.frames[f], f > skipped_frames);
+				}
+				counts[stack]++;
+			}
+
+			std::ostringstream out;
+			for (auto& entry : counts)
+			{
+				out << entry.first << " " << entry.second << std::endl;
+			}
+			return out.str();
+		}
+
+		// Write folded_stacks() to a file; false on failure.
+		bool write_folded(const std::string& path) const
+		{
+			std::ofstream file(path);
+			if ( ! file )
+			{
+				std::cout << "Failed to open profile output " << path << std::endl;
+				return false;
+			}
+			file << folded_stacks();
+			return bool(file);
+		}
+
+		// Demangled function name for a code address, without its parameter
+		// list; module+offset when there is no symbol.
+		static std::string frame_name(void* address)
+		{
+			Dl_info info;
+			if ( ! dladdr(address, &info) )
+			{
+				std::ostringstream out;
+				out << "0x" << std::hex << uintptr_t(address);
+				return out.str();
+			}
+			if ( ! info.dli_sname )
+			{
+				const char* module = info.dli_fname ? info.dli_fname : "?";
+				const char* slash = std::strrchr(module, '/');
+				std::ostringstream out;
+				out << (slash ? slash + 1 : module) << "+0x" << std::hex << (uintptr_t(address) - uintptr_t(info.dli_fbase));
+				return out.str();
+			}
+
+			int status = 0;
+			char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			std::string name = (status == 0 && demangled) ? demangled : info.dli_sname;
+			std::free(demangled);
+			return strip_parameters(name);
+		}
+
+	//
+	private:
+
+		// backtrace() from the handler starts with the handler and the signal trampoline.
+		static const int skipped_frames = 2;
+
+		struct Sample
+		{
+			std::atomic<bool> ready{false};
+			int depth = 0;
+			void* frames[max_depth];
+		};
+
+		// Drop a trailing " const" and the outermost parenthesized parameter list.
+		static std::string strip_parameters(std::string name)
+		{
+			const std::string suffix = " const";
+			if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+			{
+				name.resize(name.size() - suffix.size());
+			}
+			if (name.empty() || name.back() != ')')
+			{
+				return name;
+			}
+			int depth = 0;
+			for (size_t i = name.size(); i > 0; i--)
+			{
+				char c = name[i - 1];
+				depth += (c == ')') - (c == '(');
+				if (depth == 0)
+				{
+					return name.substr(0, i - 1);
+				}
+			}
+			return name;
+		}
+
+		// Runs in the signal handler: one atomic increment, then plain stores.
+		void capture()
+		{
+			size_t slot = _next.fetch_add(1, std::memory_order_relaxed);
+			if (slot >= _capacity)
+			{
+				_next.store(_capacity, std::memory_order_relaxed);
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			Sample& sample = _samples[slot];
+			sample.depth = backtrace(sample.frames, max_depth);
+			sample.ready.store(true, std::memory_order_release);
+		}
+
+		static void handle(int)
+		{
+			int saved_errno = errno;
+			in_flight().fetch_add(1);
+			SamplingProfiler* profiler = active().load();
+			if (profiler)
+			{
+				profiler->capture();
+			}
+			in_flight().fetch_sub(1);
+			errno = saved_errno;
+		}
+
+		// The handler stays installed once set, so a signal still pending after
+		// stop() is ignored rather than killing the process.
+		static void install_handler()
+		{
+			static bool installed = false;
+			if (installed)
+			{
+				return;
+			}
+			struct sigaction action;
+			std::memset(&action, 0, sizeof(action));
+			action.sa_handler = handle;
+			action.sa_flags = SA_RESTART;
+			sigemptyset(&action.sa_mask);
+			sigaction(SIGPROF, &action, nullptr);
+			installed = true;
+		}
+
+		static std::atomic<SamplingProfiler*>& active()
+		{
+			static std::atomic<SamplingProfiler*> profiler{nullptr};
+			return profiler;
+		}
+
+		// Handlers between their load of active() and the end of capture().
+		static std::atomic<int>& in_flight()
+		{
+			static std::atomic<int> count{0};
+			return count;
+		}
+
+		size_t _capacity;
+		std::unique_ptr<Sample[]> _samples;
+		std::atomic<size_t> _next{0};
+		std::atomic<size_t> _dropped{0};
+		timer_t _timer;
+		bool _running = false;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// profiler.hh
+///////////////////////////////////////////////////////////////////////////////
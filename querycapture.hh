@@ -0,0 +1,343 @@
+///////////////////////////////////////////////////////////////////////////////
+// querycapture.hh
+//
+// Record the queries a solver answers to a compact binary capture file, so a
+// production slowdown can be replayed later (see loadgen_main.cc).
+//
+// A query is the filter_armor_vector parameters plus a gold budget. Each
+// record also holds a fingerprint of the catalog it ran against, its arrival
+// time relative to the start of the capture, and how long it took. Records
+// are appended as queries finish, so concurrent queries may appear out of
+// arrival order; a replay sorts them by arrival first.
+//
+// File layout, all little-endian:
+//
+//    header   8-byte magic "MDQCAP01", uint32 version, uint32 record size
+//    records  double min_defense, double max_defense, int32 total_size,
+//             int32 budget, uint64 fingerprint, uint64 arrival_ns,
+//             uint64 latency_ns                                  (48 bytes)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "maxdefense.hh"
+
+
+// One query against a catalog: filter_armor_vector(catalog, min_defense,
+// max_defense, total_size), then solve for the best armor within budget gold.
+struct DefenseQuery
+{
+	double min_defense = 0;
+	double max_defense = 0;
+	int32_t total_size = 0;
+	int32_t budget = 0;
+};
+
+
+// Order queries field by field, so identical ones can be looked up together.
+bool operator<(const DefenseQuery& a, const DefenseQuery& b)
+{
+	if (a.min_defense != b.min_defense)
+	{
+		return a.min_defense < b.min_defense;
+	}
+	if (a.max_defense != b.max_defense)
+	{
+		return a.max_defense < b.max_defense;
+	}
+	if (a.total_size != b.total_size)
+	{
+		return a.total_size < b.total_size;
+	}
+	return a.budget < b.budget;
+}
+
+
+// One record of a capture file.
+struct CapturedQuery
+{
+	DefenseQuery query;
+
+	// catalog_fingerprint of the catalog the query ran against.
+	uint64_t fingerprint = 0;
+
+	// Nanoseconds from the start of the capture to the query's arrival.
+	uint64_t arrival_ns = 0;
+
+	// Nanoseconds the query took to answer.
+	uint64_t latency_ns = 0;
+};
+
+
+namespace query_capture
+{
+	const char magic[8] = { 'M', 'D', 'Q', 'C', 'A', 'P', '0', '1' };
+	const uint32_t version = 1;
+	const uint32_t record_size = 48;
+	const size_t header_size = 16;
+}
+
+
+// FNV-1a over every item's cost, defense bits and description, so a replay
+// can tell whether it runs against the catalog that was captured.
+uint64_t catalog_fingerprint(const ArmorColumns& catalog)
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*) data;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	};
+	for (size_t i = 0; i < catalog.size(); i++)
+	{
+		int32_t cost = catalog.cost(i);
+		double defense = catalog.defense(i);
+		std::string description = catalog.description(i);
+		mix(&cost, sizeof(cost));
+		mix(&defense, sizeof(defense));
+		mix(description.data(), description.size() + 1);
+	}
+	return hash;
+}
+
+
+//
+uint64_t catalog_fingerprint(const ArmorVector& catalog)
+{
+	return catalog_fingerprint(ArmorColumns(catalog));
+}
+
+
+// Encode one record into query_capture::record_size bytes.
+void encode_captured_query(const CapturedQuery& record, char* out)
+{
+	std::memcpy(out + 0, &record.query.min_defense, 8);
+	std::memcpy(out + 8, &record.query.max_defense, 8);
+	std::memcpy(out + 16, &record.query.total_size, 4);
+	std::memcpy(out + 20, &record.query.budget, 4);
+	std::memcpy(out + 24, &record.fingerprint, 8);
+	std::memcpy(out + 32, &record.arrival_ns, 8);
+	std::memcpy(out + 40, &record.latency_ns, 8);
+}
+
+
+//
+CapturedQuery decode_captured_query(const char* in)
+{
+	CapturedQuery record;
+	std::memcpy(&record.query.min_defense, in + 0, 8);
+	std::memcpy(&record.query.max_defense, in + 8, 8);
+	std::memcpy(&record.query.total_size, in + 16, 4);
+	std::memcpy(&record.query.budget, in + 20, 4);
+	std::memcpy(&record.fingerprint, in + 24, 8);
+	std::memcpy(&record.arrival_ns, in + 32, 8);
+	std::memcpy(&record.latency_ns, in + 40, 8);
+	return record;
+}
+
+
+// Appends records to an open capture file. Safe to share between threads.
+class QueryCapture
+{
+	//
+	public:
+
+		//
+		explicit QueryCapture(std::ofstream&& file)
+			:
+			_file(std::move(file)),
+			_opened(std::chrono::steady_clock::now())
+		{}
+
+		~QueryCapture()
+		{
+			flush();
+		}
+
+		QueryCapture(const QueryCapture&) = delete;
+		QueryCapture& operator=(const QueryCapture&) = delete;
+
+		// When the capture started; arrival times count from here.
+		std::chrono::steady_clock::time_point opened() const { return _opened; }
+
+		//
+		void record(const CapturedQuery& record)
+		{
+			char bytes[query_capture::record_size];
+			encode_captured_query(record, bytes);
+			std::lock_guard<std::mutex> lock(_mutex);
+			_file.write(bytes, sizeof(bytes));
+			_recorded++;
+		}
+
+		// Record a query that arrived at start and finished at end.
+		void record
+		(
+			const DefenseQuery& query,
+			uint64_t fingerprint,
+			std::chrono::steady_clock::time_point start,
+			std::chrono::steady_clock::time_point end
+		)
+		{
+			CapturedQuery captured;
+			captured.query = query;
+			captured.fingerprint = fingerprint;
+			captured.arrival_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - _opened).count();
+			captured.latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+			record(captured);
+		}
+
+		// Fingerprint of catalog, remembered while queries keep using the same
+		// catalog object. Call forget_catalog() after changing it in place.
+		uint64_t fingerprint_for(const ArmorVector& catalog)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (&catalog != _catalog || catalog.size() != _catalog_size)
+			{
+				_fingerprint = catalog_fingerprint(catalog);
+				_catalog = &catalog;
+				_catalog_size = catalog.size();
+			}
+			return _fingerprint;
+		}
+
+		//
+		void forget_catalog()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_catalog = nullptr;
+		}
+
+		// Records written so far.
+		size_t recorded() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _recorded;
+		}
+
+		// Push buffered records to the file; false if writing failed.
+		bool flush()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_file.flush();
+			return bool(_file);
+		}
+
+	//
+	private:
+
+		mutable std::mutex _mutex;
+		std::ofstream _file;
+		std::chrono::steady_clock::time_point _opened;
+		size_t _recorded = 0;
+
+		const ArmorVector* _catalog = nullptr;
+		size_t _catalog_size = 0;
+		uint64_t _fingerprint = 0;
+};
+
+
+// Start a new capture file at path, replacing any old one. Returns nullptr on failure.
+std::unique_ptr<QueryCapture> open_query_capture(const std::string& path)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if ( ! file )
+	{
+		std::cout << "Failed to open query capture " << path << std::endl;
+		return nullptr;
+	}
+	file.write(query_capture::magic, sizeof(query_capture::magic));
+	file.write((const char*) &query_capture::version, 4);
+	file.write((const char*) &query_capture::record_size, 4);
+	return std::unique_ptr<QueryCapture>(new QueryCapture(std::move(file)));
+}
+
+
+// Write a whole capture at once, e.g. a synthesized one; false on failure.
+bool save_query_capture(const std::string& path, const std::vector<CapturedQuery>& records)
+{
+	auto capture = open_query_capture(path);
+	if ( ! capture )
+	{
+		return false;
+	}
+	for (auto& record : records)
+	{
+		capture->record(record);
+	}
+	return capture->flush();
+}
+
+
+// Read every record of a capture file. Returns nullptr if the file cannot be
+// read or is not a capture; a truncated last record is dropped.
+std::unique_ptr<std::vector<CapturedQuery>> load_query_capture(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if ( ! file )
+	{
+		std::cout << "Failed to open query capture " << path << std::endl;
+		return nullptr;
+	}
+
+	char header[query_capture::header_size];
+	uint32_t version = 0, record_size = 0;
+	file.read(header, sizeof(header));
+	std::memcpy(&version, header + 8, 4);
+	std::memcpy(&record_size, header + 12, 4);
+	if ( ! file || std::memcmp(header, query_capture::magic, sizeof(query_capture::magic)) != 0
+		|| version != query_capture::version || record_size != query_capture::record_size )
+	{
+		std::cout << "Not a query capture: " << path << std::endl;
+		return nullptr;
+	}
+
+	std::unique_ptr<std::vector<CapturedQuery>> records(new std::vector<CapturedQuery>);
+	char bytes[query_capture::record_size];
+	while (file.read(bytes, sizeof(bytes)))
+	{
+		records->push_back(decode_captured_query(bytes));
+	}
+	return records;
+}
+
+
+// Solver entry point for one DefenseQuery; records it to capture when given.
+std::unique_ptr<ArmorVector> answer_defense_query
+(
+	const ArmorVector& catalog,
+	const DefenseQuery& query,
+	const DynamicOptions& options = DynamicOptions(),
+	QueryCapture* capture = nullptr
+)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto subset = filter_armor_vector(catalog, query.min_defense, query.max_defense, query.total_size);
+	auto result = dynamic_max_defense(*subset, query.budget, options);
+	if (capture)
+	{
+		capture->record(query, capture->fingerprint_for(catalog), start, std::chrono::steady_clock::now());
+	}
+	return result;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// querycapture.hh
+///////////////////////////////////////////////////////////////////////////////
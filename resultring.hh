@@ -0,0 +1,503 @@
+///////////////////////////////////////////////////////////////////////////////
+// resultring.hh
+//
+// Result transport for clients on the same host. Each client gets its own
+// POSIX shared-memory ring of fixed-size slots; the solver writes one record
+// per answer: the request id, status, totals, and the chosen items as indices
+// into the shared catalog (armorshm.hh). Nothing is serialized: the client
+// reads records in place and looks descriptions up in its own read-only
+// mapping of that catalog, which the ring header names by catalog version.
+//
+// One writer and one reader per ring. head and tail count records ever
+// written and consumed; a slot is reused once the reader has moved past it.
+// A reader with nothing to read sleeps on a futex word in the segment, which
+// the writer bumps and wakes only while someone is waiting.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "armorshm.hh"
+#include "maxdefense.hh"
+#include "querycapture.hh"
+
+
+namespace result_ring
+{
+	const char magic[8] = { 'M', 'D', 'R', 'E', 'S', 'R', 'N', 'G' };
+	const uint32_t layout_version = 1;
+
+	// Record status for an answer with more indices than a slot holds: the
+	// totals are kept, count is 0. Negative statuses are reserved for the ring.
+	const int32_t too_many_items = -1;
+
+	// Start of every ring segment; slots follow at header_bytes.
+	struct Header
+	{
+		char magic[8];
+		uint32_t layout_version;
+		uint32_t header_size;
+		uint64_t catalog_version;
+		uint64_t slot_count;
+		uint64_t slot_bytes;
+		uint64_t max_items;
+		std::atomic<uint32_t> ready;
+
+		// Written by the writer / the reader only, each on its own cache line.
+		alignas(64) std::atomic<uint64_t> head;
+		alignas(64) std::atomic<uint64_t> tail;
+
+		// Futex word bumped on every record, and readers currently asleep on it.
+		alignas(64) std::atomic<uint32_t> signal;
+		std::atomic<uint32_t> waiters;
+	};
+
+	const size_t header_bytes = armor_shm::align(sizeof(Header));
+
+	//
+	size_t slot_bytes(size_t max_items);
+
+	//
+	long futex(std::atomic<uint32_t>* word, int op, uint32_t value, const timespec* timeout)
+	{
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32-bit int");
+		return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+	}
+}
+
+
+// One answer in the ring, followed in its slot by count int32 catalog indices.
+struct ResultRecord
+{
+	uint64_t request_id;
+
+	// 0 when solved, result_ring::too_many_items when the indices did not
+	// fit; other non-negative values are the writer's own status codes.
+	int32_t status;
+	int32_t total_cost;
+	double total_defense;
+	uint32_t count;
+	uint32_t reserved;
+
+	//
+	const int32_t* indices() const { return reinterpret_cast<const int32_t*>(this + 1); }
+};
+
+
+//
+size_t result_ring::slot_bytes(size_t max_items)
+{
+	return armor_shm::align(sizeof(ResultRecord) + max_items * sizeof(int32_t));
+}
+
+
+// A mapped ring segment, shared by the writer and reader classes.
+class ResultRingMapping
+{
+	//
+	public:
+
+		//
+		ResultRingMapping(void* base, size_t bytes)
+			:
+			_base(static_cast<char*>(base)),
+			_bytes(bytes)
+		{}
+
+		~ResultRingMapping()
+		{
+			munmap(_base, _bytes);
+		}
+
+		ResultRingMapping(const ResultRingMapping&) = delete;
+		ResultRingMapping& operator=(const ResultRingMapping&) = delete;
+
+		//
+		result_ring::Header& header() const { return *reinterpret_cast<result_ring::Header*>(_base); }
+
+		// The slot record sequence number seq lands in.
+		ResultRecord* slot(uint64_t seq) const
+		{
+			const result_ring::Header& h = header();
+			return reinterpret_cast<ResultRecord*>(_base + result_ring::header_bytes + (seq % h.slot_count) * h.slot_bytes);
+		}
+
+	//
+	private:
+
+		char* _base;
+		size_t _bytes;
+};
+
+
+// The solver's end of one client's ring.
+class ResultRingWriter
+{
+	//
+	public:
+
+		//
+		explicit ResultRingWriter(std::unique_ptr<ResultRingMapping> mapping)
+			:
+			_mapping(std::move(mapping))
+		{}
+
+		//
+		size_t slot_count() const { return _mapping->header().slot_count; }
+		size_t max_items() const { return _mapping->header().max_items; }
+		uint64_t catalog_version() const { return _mapping->header().catalog_version; }
+
+		// Records written and not yet consumed.
+		size_t pending() const
+		{
+			const result_ring::Header& h = _mapping->header();
+			return h.head.load(std::memory_order_relaxed) - h.tail.load(std::memory_order_acquire);
+		}
+
+		// Append one record and wake the reader if it sleeps. False, writing
+		// nothing, only when the ring is full. An answer with more than
+		// max_items indices is recorded without them, as too_many_items, so a
+		// caller that retries on false never retries it forever.
+		bool push
+		(
+			uint64_t request_id,
+			int32_t status,
+			const std::vector<size_t>& indices,
+			int total_cost,
+			double total_defense
+		)
+		{
+			result_ring::Header& h = _mapping->header();
+			uint64_t head = h.head.load(std::memory_order_relaxed);
+			if (head - h.tail.load(std::memory_order_acquire) >= h.slot_count)
+			{
+				return false;
+			}
+			bool fits = indices.size() <= h.max_items;
+
+			ResultRecord* record = _mapping->slot(head);
+			record->request_id = request_id;
+			record->status = fits ? status : result_ring::too_many_items;
+			record->total_cost = total_cost;
+			record->total_defense = total_defense;
+			record->count = fits ? indices.size() : 0;
+			record->reserved = 0;
+			int32_t* out = reinterpret_cast<int32_t*>(record + 1);
+			for (size_t i = 0; i < record->count; i++)
+			{
+				out[i] = indices[i];
+			}
+			h.head.store(head + 1, std::memory_order_seq_cst);
+
+			// Pairs with the reader's waiters increment before it re-checks head.
+			h.signal.fetch_add(1, std::memory_order_seq_cst);
+			if (h.waiters.load(std::memory_order_seq_cst) != 0)
+			{
+				result_ring::futex(&h.signal, FUTEX_WAKE, INT_MAX, nullptr);
+			}
+			return true;
+		}
+
+	//
+	private:
+
+		std::unique_ptr<ResultRingMapping> _mapping;
+};
+
+
+// A client's end of its ring.
+class ResultRingReader
+{
+	//
+	public:
+
+		//
+		explicit ResultRingReader(std::unique_ptr<ResultRingMapping> mapping)
+			:
+			_mapping(std::move(mapping))
+		{}
+
+		// Version of the shared catalog the indices refer to.
+		uint64_t catalog_version() const { return _mapping->header().catalog_version; }
+
+		// The oldest unconsumed record, in place; nullptr if there is none. It
+		// stays valid until pop().
+		const ResultRecord* front() const
+		{
+			const result_ring::Header& h = _mapping->header();
+			uint64_t tail = h.tail.load(std::memory_order_relaxed);
+			if (h.head.load(std::memory_order_acquire) == tail)
+			{
+				return nullptr;
+			}
+			return _mapping->slot(tail);
+		}
+
+		// Hand the front record's slot back to the writer.
+		void pop()
+		{
+			result_ring::Header& h = _mapping->header();
+			uint64_t tail = h.tail.load(std::memory_order_relaxed);
+			assert(h.head.load(std::memory_order_acquire) != tail);
+			h.tail.store(tail + 1, std::memory_order_release);
+		}
+
+		// Sleep until a record is available or timeout_ms passes (negative:
+		// no limit). Returns whether one is available.
+		bool wait(int timeout_ms = -1)
+		{
+			result_ring::Header& h = _mapping->header();
+			timespec deadline;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += timeout_ms / 1000;
+			deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L)
+			{
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+
+			while (true)
+			{
+				uint32_t seen = h.signal.load(std::memory_order_seq_cst);
+				h.waiters.fetch_add(1, std::memory_order_seq_cst);
+				if (front())
+				{
+					h.waiters.fetch_sub(1, std::memory_order_relaxed);
+					return true;
+				}
+
+				timespec remaining = { 0, 0 };
+				if (timeout_ms >= 0)
+				{
+					timespec now;
+					clock_gettime(CLOCK_MONOTONIC, &now);
+					remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+					remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+					if (remaining.tv_nsec < 0)
+					{
+						remaining.tv_sec--;
+						remaining.tv_nsec += 1000000000L;
+					}
+					if (remaining.tv_sec < 0)
+					{
+						h.waiters.fetch_sub(1, std::memory_order_relaxed);
+						return false;
+					}
+				}
+				// A futex on shared memory: no FUTEX_PRIVATE_FLAG.
+				result_ring::futex(&h.signal, FUTEX_WAIT, seen, timeout_ms >= 0 ? &remaining : nullptr);
+				h.waiters.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+
+	//
+	private:
+
+		std::unique_ptr<ResultRingMapping> _mapping;
+};
+
+
+// Create the ring called name for one client, with slot_count slots of up to
+// max_items indices each, replacing any ring of that name. catalog_version
+// names the shared catalog its indices refer to. Returns nullptr, after
+// printing the reason, on failure.
+std::unique_ptr<ResultRingWriter> create_result_ring
+(
+	const std::string& name,
+	size_t slot_count,
+	size_t max_items,
+	uint64_t catalog_version
+)
+{
+	using namespace result_ring;
+	assert(slot_count > 0);
+
+	size_t slot_size = result_ring::slot_bytes(max_items);
+	size_t bytes = header_bytes + slot_count * slot_size;
+
+	std::string segment = armor_shm::segment_name(name);
+	shm_unlink(segment.c_str());
+	int fd = shm_open(segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+	{
+		std::cout << "Failed to create result ring " << segment << std::endl;
+		return nullptr;
+	}
+	if (ftruncate(fd, bytes) != 0)
+	{
+		std::cout << "Failed to size result ring " << segment << std::endl;
+		close(fd);
+		shm_unlink(segment.c_str());
+		return nullptr;
+	}
+	void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		std::cout << "Failed to map result ring " << segment << std::endl;
+		shm_unlink(segment.c_str());
+		return nullptr;
+	}
+
+	Header* header = new (mapped) Header;
+	std::memcpy(header->magic, magic, sizeof(magic));
+	header->layout_version = layout_version;
+	header->header_size = sizeof(Header);
+	header->catalog_version = catalog_version;
+	header->slot_count = slot_count;
+	header->slot_bytes = slot_size;
+	header->max_items = max_items;
+	header->head.store(0, std::memory_order_relaxed);
+	header->tail.store(0, std::memory_order_relaxed);
+	header->signal.store(0, std::memory_order_relaxed);
+	header->waiters.store(0, std::memory_order_relaxed);
+	header->ready.store(1, std::memory_order_release);
+
+	return std::unique_ptr<ResultRingWriter>(new ResultRingWriter(
+		std::unique_ptr<ResultRingMapping>(new ResultRingMapping(mapped, bytes))
+	));
+}
+
+
+// Attach to the ring called name as its reader. The reader writes tail and
+// the futex words, so the mapping is read-write. Returns nullptr, after
+// printing the reason, if there is no complete ring of this layout version.
+std::unique_ptr<ResultRingReader> attach_result_ring(const std::string& name)
+{
+	using namespace result_ring;
+
+	std::string segment = armor_shm::segment_name(name);
+	auto fail = [&](const std::string& reason)
+	{
+		std::cout << "Failed to attach result ring " << segment << ": " << reason << std::endl;
+		return std::unique_ptr<ResultRingReader>(nullptr);
+	};
+
+	int fd = shm_open(segment.c_str(), O_RDWR, 0);
+	if (fd < 0)
+	{
+		return fail("no such segment");
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || size_t(info.st_size) < header_bytes)
+	{
+		close(fd);
+		return fail("segment too small");
+	}
+	size_t bytes = info.st_size;
+	void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		return fail("mmap failed");
+	}
+	std::unique_ptr<ResultRingMapping> mapping(new ResultRingMapping(mapped, bytes));
+
+	const Header& header = mapping->header();
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+	{
+		return fail("not a result ring");
+	}
+	if (header.layout_version != layout_version || header.header_size != sizeof(Header))
+	{
+		return fail("unsupported layout version");
+	}
+	if ( ! header.ready.load(std::memory_order_acquire) )
+	{
+		return fail("still being created");
+	}
+	if (header.slot_count == 0 || header.slot_bytes != slot_bytes(header.max_items)
+		|| header_bytes + header.slot_count * header.slot_bytes != bytes)
+	{
+		return fail("truncated segment");
+	}
+	return std::unique_ptr<ResultRingReader>(new ResultRingReader(std::move(mapping)));
+}
+
+
+// Remove the name; both ends keep their mapping. False if there was none.
+bool unlink_result_ring(const std::string& name)
+{
+	return shm_unlink(armor_shm::segment_name(name).c_str()) == 0;
+}
+
+
+// Description i of catalog, pointing into the catalog's own memory.
+std::string_view description_view(const ArmorColumns& catalog, size_t i)
+{
+	assert(i < catalog.size());
+	const char* begin = catalog.description_bytes() + catalog.description_offsets()[i];
+	if (catalog.layout() == DescriptionLayout::delimited)
+	{
+		return std::string_view(begin, static_cast<const char*>(std::strchr(begin, '^')) - begin);
+	}
+	return std::string_view(begin, catalog.description_offsets()[i + 1] - catalog.description_offsets()[i]);
+}
+
+
+// Solve query against a columnar catalog and push the answer to ring as
+// catalog indices, tagged request_id. False if the ring was full; an answer
+// too long for a slot arrives as a too_many_items record instead.
+bool solve_into_result_ring
+(
+	const ArmorColumns& catalog,
+	const DefenseQuery& query,
+	uint64_t request_id,
+	ResultRingWriter& ring,
+	const DynamicOptions& options = DynamicOptions()
+)
+{
+	// The filter_armor_vector rules, remembering where each row came from.
+	std::vector<size_t> rows;
+	std::vector<int32_t> costs;
+	std::vector<double> defenses;
+	for (size_t i = 0; i < catalog.size() && rows.size() < size_t(std::max(query.total_size, 0)); i++)
+	{
+		double defense = catalog.defense(i);
+		if (defense > 0 && query.min_defense < defense && defense <= query.max_defense)
+		{
+			rows.push_back(i);
+			costs.push_back(catalog.cost(i));
+			defenses.push_back(defense);
+		}
+	}
+
+	std::vector<size_t> chosen = dynamic_max_defense_indices(costs.data(), defenses.data(), rows.size(), query.budget, options);
+	int total_cost = 0;
+	double total_defense = 0;
+	for (size_t& index : chosen)
+	{
+		total_cost += costs[index];
+		total_defense += defenses[index];
+		index = rows[index];
+	}
+	return ring.push(request_id, 0, chosen, total_cost, total_defense);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// resultring.hh
+///////////////////////////////////////////////////////////////////////////////
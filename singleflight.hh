@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////
+// singleflight.hh
+//
+// Coalesce identical in-flight work. The first caller for a key becomes its
+// leader and computes the value; callers that ask for the same key before it
+// is done get the leader's shared future instead of starting again. Nothing is
+// kept once the value is delivered, so this is not a cache: it only removes
+// duplicate work during a burst.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <cassert>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <utility>
+
+
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class SingleFlight
+{
+	//
+	public:
+
+		//
+		SingleFlight() {}
+
+		SingleFlight(const SingleFlight&) = delete;
+		SingleFlight& operator=(const SingleFlight&) = delete;
+
+		// The shared future for key, and whether the caller is its leader. A
+		// leader must later call complete() or fail() for the key; until then
+		// every join() for it returns the same future as a follower.
+		std::pair<std::shared_future<Value>, bool> join(const Key& key)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto found = _flights.find(key);
+			if (found != _flights.end())
+			{
+				_coalesced++;
+				return std::make_pair(found->second.future, false);
+			}
+			Flight& flight = _flights[key];
+			flight.future = flight.promise.get_future().share();
+			return std::make_pair(flight.future, true);
+		}
+
+		// Deliver the leader's value to everyone waiting on key, and forget key.
+		void complete(const Key& key, const Value& value)
+		{
+			std::promise<Value> promise = finish(key);
+			promise.set_value(value);
+		}
+
+		// Deliver an exception instead.
+		void fail(const Key& key, std::exception_ptr error)
+		{
+			std::promise<Value> promise = finish(key);
+			promise.set_exception(error);
+		}
+
+		// Compute on the calling thread unless an identical call is in flight,
+		// and return the shared value either way.
+		Value run(const Key& key, const std::function<Value()>& compute)
+		{
+			auto joined = join(key);
+			if (joined.second)
+			{
+				try
+				{
+					complete(key, compute());
+				}
+				catch (...)
+				{
+					fail(key, std::current_exception());
+				}
+			}
+			return joined.first.get();
+		}
+
+		// Keys being computed right now.
+		size_t in_flight() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _flights.size();
+		}
+
+		// join() calls that found their key already in flight.
+		size_t coalesced() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _coalesced;
+		}
+
+	//
+	private:
+
+		struct Flight
+		{
+			std::promise<Value> promise;
+			std::shared_future<Value> future;
+		};
+
+		// Remove key and hand back its promise, to be fulfilled outside the lock.
+		std::promise<Value> finish(const Key& key)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto found = _flights.find(key);
+			assert(found != _flights.end());
+			std::promise<Value> promise = std::move(found->second.promise);
+			_flights.erase(found);
+			return promise;
+		}
+
+		mutable std::mutex _mutex;
+		std::map<Key, Flight, Compare> _flights;
+		size_t _coalesced = 0;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// singleflight.hh
+///////////////////////////////////////////////////////////////////////////////
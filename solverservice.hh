@@ -0,0 +1,702 @@
+///////////////////////////////////////////////////////////////////////////////
+// solverservice.hh
+//
+// A shared solver service: a pool of worker threads answering DefenseQuery
+// requests against one catalog.
+//
+// Each query is sized up front. It is filtered, items that cannot fit the
+// budget are pruned, and the budget is capped at what the rest costs. That
+// gives DP cells (n x budget) and bytes for each reconstruction strategy. The
+// fastest strategy that fits the per-query memory limit is used. Queries that
+// fit no strategy, or exceed the cell limit, are rejected at once, or with
+// ServiceOptions::greedy_fallback answered at once by the O(n) greedy
+// 1/2-approximation. Admitted queries wait until their bytes fit in the
+// service's remaining memory headroom. The scratch memory each worker keeps
+// between queries counts against the same headroom; workers hand it back
+// while a query is waiting for memory.
+//
+// Waiting queries run shortest-job-first by estimated cells, with aging:
+// a job's effective size shrinks the longer it waits, so big jobs reach the
+// front eventually. Once a job is at the front, smaller jobs stop overtaking
+// it until there is headroom for it.
+//
+// Identical queries submitted while one is still queued or running are
+// coalesced: they share its future and its result instead of solving again.
+//
+// With ServiceOptions::speculate, the service counts filter windows in a
+// count-min sketch, and an idle-priority thread builds the all-budget DP table
+// of the hottest windows whenever no query is queued or running (see
+// speculation.hh). It stops at the next item row as soon as a query arrives.
+// Queries on a window with a finished table are answered from it directly.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "maxdefense.hh"
+#include "metrics.hh"
+#include "querycapture.hh"
+#include "singleflight.hh"
+#include "speculation.hh"
+
+
+// How a query submitted to SolverService ended.
+enum class QueryStatus
+{
+	solved,
+
+	// Too big for the service's limits; nothing was computed.
+	rejected,
+
+	// Too big for the service's limits; answered by greedy_half_max_defense,
+	// which has at least half the optimal defense.
+	approximated
+};
+
+
+// Answer to one DefenseQuery.
+struct QueryResult
+{
+	QueryStatus status = QueryStatus::rejected;
+
+	// Chosen items, as dynamic_max_defense returns them; empty when rejected.
+	std::shared_ptr<const ArmorVector> armors = std::make_shared<ArmorVector>();
+	int total_cost = 0;
+	double total_defense = 0;
+
+	// The admission estimate the query was scheduled by.
+	size_t estimated_cells = 0;
+	size_t estimated_bytes = 0;
+	ReconstructionStrategy strategy = ReconstructionStrategy::full_table;
+
+	// Time between submission and the start of the solve.
+	double queue_seconds = 0;
+};
+
+
+// Work and memory a query needs once its catalog is pruned.
+struct QueryEstimate
+{
+	// Items left after filtering and dropping those over budget.
+	size_t items = 0;
+
+	// Budget capped at the total cost of those items.
+	int budget = 0;
+
+	size_t cells = 0;
+	size_t bytes = 0;
+	ReconstructionStrategy strategy = ReconstructionStrategy::full_table;
+};
+
+
+// DP cells and bytes for n items and a budget under one strategy, following
+// the buffers each engine takes from its SolverWorkspace.
+void estimate_strategy(size_t n, int budget, ReconstructionStrategy strategy, size_t& cells, size_t& bytes)
+{
+	size_t width = std::max(budget, 0) + 1;
+	size_t items = n * (sizeof(int32_t) + sizeof(double));
+	switch (strategy)
+	{
+		case ReconstructionStrategy::checkpointed:
+		{
+			size_t segment = std::max<size_t>(1, std::ceil(std::sqrt(double(n))));
+			cells = 2 * n * (width - 1);
+			bytes = ((n + segment - 1) / segment + std::max<size_t>(2, segment + 1)) * width * sizeof(double) + items;
+			break;
+		}
+
+		case ReconstructionStrategy::divide_and_conquer:
+			cells = 2 * n * (width - 1);
+			bytes = 3 * width * sizeof(double) + items;
+			break;
+
+		case ReconstructionStrategy::full_table:
+		default:
+			cells = n * (width - 1);
+			bytes = (n + 1) * width * sizeof(double) + items;
+			break;
+	}
+}
+
+
+// Pick the fastest strategy whose memory fits max_bytes for the pruned items;
+// estimate.bytes exceeds max_bytes when none does.
+QueryEstimate estimate_query(const ArmorVector& pruned, int budget, size_t max_bytes)
+{
+	QueryEstimate estimate;
+	estimate.items = pruned.size();
+	int64_t total = 0;
+	for (auto& armor : pruned)
+	{
+		total += armor->cost();
+	}
+	estimate.budget = std::min<int64_t>(budget, total);
+
+	for (auto strategy : { ReconstructionStrategy::full_table, ReconstructionStrategy::checkpointed, ReconstructionStrategy::divide_and_conquer })
+	{
+		estimate.strategy = strategy;
+		estimate_strategy(estimate.items, estimate.budget, strategy, estimate.cells, estimate.bytes);
+		if (estimate.bytes <= max_bytes)
+		{
+			break;
+		}
+	}
+	return estimate;
+}
+
+
+// Limits and knobs for SolverService.
+struct ServiceOptions
+{
+	// Worker threads; 0 means one per hardware thread.
+	unsigned threads = 0;
+
+	// DP memory all running queries and the workers' retained scratch memory
+	// may hold together.
+	size_t memory_budget_bytes = size_t(1) << 30;
+
+	// Most DP memory one query may use; 0 means memory_budget_bytes.
+	size_t max_query_bytes = 0;
+
+	// Most DP cells one query may compute; 0 means no limit.
+	size_t max_cells = 0;
+
+	// Waiting this long halves a query's effective size for scheduling.
+	double aging_seconds = 0.05;
+
+	// Answer queries over the limits approximately instead of rejecting them.
+	bool greedy_fallback = false;
+
+	// Optional; receives solver and queue latencies, the rejection count, and
+	// coalesced and precomputed answers as cache hits.
+	SolverMetrics* metrics = nullptr;
+
+	// Precompute DP tables of hot filter windows while idle.
+	bool speculate = false;
+
+	// How many of the most frequent windows get tables.
+	size_t hot_windows = 8;
+
+	// Memory all precomputed tables may hold together, on top of memory_budget_bytes.
+	size_t speculation_bytes = size_t(64) << 20;
+};
+
+
+// Counters of a SolverService, as of one moment.
+struct ServiceStats
+{
+	size_t queued = 0;
+	size_t running = 0;
+	size_t bytes_in_use = 0;
+
+	// Part of bytes_in_use that workers keep between queries.
+	size_t workspace_bytes = 0;
+	size_t solved = 0;
+	size_t rejected = 0;
+
+	// Admitted queries that had to wait for memory headroom.
+	size_t deferred = 0;
+
+	// Queries that joined an identical one already in flight.
+	size_t coalesced = 0;
+
+	// Queries answered from a precomputed table.
+	size_t speculative_hits = 0;
+
+	// Tables finished, and times a table build stopped for real traffic.
+	size_t speculated_windows = 0;
+	size_t preemptions = 0;
+};
+
+
+// Worker pool answering DefenseQuery requests against one catalog; see the top of this file.
+class SolverService
+{
+	//
+	public:
+
+		//
+		SolverService(std::shared_ptr<const ArmorVector> catalog, const ServiceOptions& options = ServiceOptions())
+			:
+			_catalog(catalog),
+			_options(options)
+		{
+			assert(_catalog);
+			if (_options.threads == 0)
+			{
+				_options.threads = std::max(1u, std::thread::hardware_concurrency());
+			}
+			if (_options.max_query_bytes == 0 || _options.max_query_bytes > _options.memory_budget_bytes)
+			{
+				_options.max_query_bytes = _options.memory_budget_bytes;
+			}
+			for (unsigned t = 0; t < _options.threads; t++)
+			{
+				_workers.emplace_back(&SolverService::work, this);
+			}
+			if (_options.speculate)
+			{
+				_speculator = std::thread(&SolverService::speculate, this);
+			}
+		}
+
+		// Finishes every query already submitted.
+		~SolverService()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stopping = true;
+			}
+			_changed.notify_all();
+			_idle.notify_all();
+			for (auto& worker : _workers)
+			{
+				worker.join();
+			}
+			if (_speculator.joinable())
+			{
+				_speculator.join();
+			}
+		}
+
+		SolverService(const SolverService&) = delete;
+		SolverService& operator=(const SolverService&) = delete;
+
+		//
+		const ServiceOptions& options() const { return _options; }
+
+		// Filter, prune and size the query, then queue it or reject it; or join
+		// an identical query already in flight. If that fails, the future
+		// carries the exception to the caller and every follower.
+		std::shared_future<QueryResult> submit(const DefenseQuery& query)
+		{
+			auto flight = _flights.join(query);
+			if ( ! flight.second )
+			{
+				if (_options.metrics)
+				{
+					_options.metrics->cache_hits.add();
+				}
+				return flight.first;
+			}
+			_active++;
+
+			// Whatever throws before the job is queued or answered must still
+			// end the flight, or its followers wait forever.
+			try
+			{
+				if (_options.speculate && answer_precomputed(query))
+				{
+					return flight.first;
+				}
+
+				std::unique_ptr<Job> job(new Job);
+				job->query = query;
+				job->submitted = std::chrono::steady_clock::now();
+
+				auto subset = filter_armor_vector(*_catalog, query.min_defense, query.max_defense, query.total_size);
+				for (auto& armor : *subset)
+				{
+					if (armor->cost() <= query.budget)
+					{
+						job->pruned.push_back(armor);
+					}
+				}
+				job->estimate = estimate_query(job->pruned, query.budget, _options.max_query_bytes);
+
+				if (query.budget < 0 || ! admissible(job->estimate))
+				{
+					reject(*job);
+					return flight.first;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					_queue.push_back(std::move(job));
+				}
+				_changed.notify_one();
+				return flight.first;
+			}
+			catch (...)
+			{
+				fail(query, std::current_exception());
+			}
+			return flight.first;
+		}
+
+		// Submit and wait.
+		QueryResult solve(const DefenseQuery& query)
+		{
+			return submit(query).get();
+		}
+
+		//
+		ServiceStats stats() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			ServiceStats stats = _stats;
+			stats.queued = _queue.size();
+			stats.bytes_in_use = _bytes_in_use;
+			stats.workspace_bytes = _workspace_bytes;
+			stats.coalesced = _flights.coalesced();
+			return stats;
+		}
+
+	//
+	private:
+
+		struct Job
+		{
+			DefenseQuery query;
+			std::vector<std::shared_ptr<ArmorItem>> pruned;
+			QueryEstimate estimate;
+			std::chrono::steady_clock::time_point submitted;
+			bool deferred = false;
+		};
+
+		//
+		bool admissible(const QueryEstimate& estimate) const
+		{
+			return estimate.bytes <= _options.max_query_bytes
+				&& (_options.max_cells == 0 || estimate.cells <= _options.max_cells);
+		}
+
+		//
+		void reject(Job& job)
+		{
+			QueryResult result;
+			result.status = QueryStatus::rejected;
+			if (_options.greedy_fallback && job.query.budget >= 0)
+			{
+				std::shared_ptr<ArmorVector> armors = greedy_half_max_defense(job.pruned, job.query.budget);
+				sum_armor_vector(*armors, result.total_cost, result.total_defense);
+				result.armors = armors;
+				result.status = QueryStatus::approximated;
+			}
+			result.estimated_cells = job.estimate.cells;
+			result.estimated_bytes = job.estimate.bytes;
+			result.strategy = job.estimate.strategy;
+			if (_options.metrics)
+			{
+				_options.metrics->rejected_queries.add();
+			}
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stats.rejected++;
+			}
+			finish(job.query, result);
+		}
+
+		// Deliver a leader's result, and wake the speculator if that left the
+		// service idle.
+		void finish(const DefenseQuery& query, const QueryResult& result)
+		{
+			_flights.complete(query, result);
+			if (_active.fetch_sub(1) == 1)
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_idle.notify_all();
+			}
+		}
+
+		// Deliver an exception to a leader's followers instead.
+		void fail(const DefenseQuery& query, std::exception_ptr error)
+		{
+			_flights.fail(query, error);
+			if (_active.fetch_sub(1) == 1)
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_idle.notify_all();
+			}
+		}
+
+		// Count query's window, and answer it from a finished table of that
+		// window if there is one; false if it must be solved.
+		bool answer_precomputed(const DefenseQuery& query)
+		{
+			std::shared_ptr<const SpeculativeTable> table;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_hot.record(query);
+				auto found = _tables.find(window_of(query));
+				if (found != _tables.end() && found->second->covers(query.budget))
+				{
+					table = found->second;
+					_stats.speculative_hits++;
+				}
+			}
+			if ( ! table )
+			{
+				return false;
+			}
+
+			QueryResult result;
+			result.status = QueryStatus::solved;
+			std::shared_ptr<ArmorVector> armors = table->answer(query.budget);
+			sum_armor_vector(*armors, result.total_cost, result.total_defense);
+			result.armors = armors;
+			if (_options.metrics)
+			{
+				_options.metrics->cache_hits.add();
+			}
+			finish(query, result);
+			return true;
+		}
+
+		// The hottest window whose table is missing or was built for a smaller
+		// budget, and the bytes a new table for it may take; false if there is
+		// none. Drops tables of windows that are no longer hot, and the smaller
+		// table of the window chosen, so the rebuild and the table it replaces
+		// never both count against speculation_bytes. Called with _mutex held.
+		bool next_speculation(HotWindow& wanted, size_t& room)
+		{
+			size_t used = 0;
+			for (auto it = _tables.begin(); it != _tables.end(); )
+			{
+				if (_hot.is_hot(it->first))
+				{
+					used += it->second->bytes();
+					++it;
+				}
+				else
+				{
+					it = _tables.erase(it);
+				}
+			}
+
+			for (auto& hot : _hot.hottest())
+			{
+				auto found = _tables.find(hot.window);
+				if (found != _tables.end() && found->second->requested_budget() >= hot.max_budget)
+				{
+					continue;
+				}
+				size_t others = used - (found != _tables.end() ? found->second->bytes() : 0);
+				if (others < _options.speculation_bytes)
+				{
+					if (found != _tables.end())
+					{
+						_tables.erase(found);
+					}
+					wanted = hot;
+					room = _options.speculation_bytes - others;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Speculator thread: while no query is active, build one table at a
+		// time, hottest window first. A build interrupted by traffic resumes
+		// where it stopped, unless its window has cooled off meanwhile.
+		void speculate()
+		{
+			lower_thread_priority();
+			std::shared_ptr<SpeculativeTable> building;
+			std::unique_lock<std::mutex> lock(_mutex);
+			while ( ! _stopping )
+			{
+				HotWindow wanted;
+				size_t room = 0;
+				bool ready = false;
+				if (_active.load() == 0)
+				{
+					if (building && ! _hot.is_hot(building->window()))
+					{
+						building.reset();
+					}
+					ready = building || next_speculation(wanted, room);
+				}
+				if ( ! ready )
+				{
+					_idle.wait(lock);
+					continue;
+				}
+
+				lock.unlock();
+				if ( ! building )
+				{
+					building = std::make_shared<SpeculativeTable>(*_catalog, wanted.window, wanted.max_budget, room);
+				}
+				bool done = building->advance([this]()
+				{
+					return _active.load(std::memory_order_relaxed) != 0 || _stopping.load(std::memory_order_relaxed);
+				});
+				lock.lock();
+
+				if (done)
+				{
+					_tables[building->window()] = building;
+					_stats.speculated_windows++;
+					building.reset();
+				}
+				else
+				{
+					_stats.preemptions++;
+				}
+			}
+		}
+
+		// Queue position of the job to run next: smallest cells after aging.
+		// Called with _mutex held and a non-empty queue.
+		size_t next_job(std::chrono::steady_clock::time_point now) const
+		{
+			size_t best = 0;
+			double best_size = 0;
+			for (size_t i = 0; i < _queue.size(); i++)
+			{
+				double waited = std::chrono::duration<double>(now - _queue[i]->submitted).count();
+				double size = _queue[i]->estimate.cells / (1 + waited / _options.aging_seconds);
+				if (i == 0 || size < best_size)
+				{
+					best = i;
+					best_size = size;
+				}
+			}
+			return best;
+		}
+
+		// Take the next job once there is headroom for it; nullptr when stopping
+		// with nothing left to do. held is what the calling worker's workspace
+		// holds and is counted in _bytes_in_use; it is released while the next
+		// job waits for memory, so idle workers never block it.
+		std::unique_ptr<Job> take(SolverWorkspace& workspace, size_t& held)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (true)
+			{
+				if ( ! _queue.empty() )
+				{
+					size_t i = next_job(std::chrono::steady_clock::now());
+					Job& job = *_queue[i];
+					if (_bytes_in_use + job.estimate.bytes <= _options.memory_budget_bytes)
+					{
+						std::unique_ptr<Job> taken = std::move(_queue[i]);
+						_queue[i] = std::move(_queue.back());
+						_queue.pop_back();
+						_bytes_in_use += taken->estimate.bytes;
+						_stats.running++;
+						return taken;
+					}
+					if (held)
+					{
+						workspace.release();
+						_bytes_in_use -= held;
+						_workspace_bytes -= held;
+						held = 0;
+						_changed.notify_all();
+						continue;
+					}
+					if ( ! job.deferred )
+					{
+						job.deferred = true;
+						_stats.deferred++;
+						_changed.notify_all();
+					}
+				}
+				else if (_stopping)
+				{
+					return nullptr;
+				}
+
+				// Either idle or the front job is waiting for memory; both end with a notify.
+				_changed.wait(lock);
+			}
+		}
+
+		//
+		void work()
+		{
+			SolverWorkspace workspace;
+			size_t fair_share = _options.memory_budget_bytes / _options.threads;
+			size_t held = 0;
+
+			while (std::unique_ptr<Job> job = take(workspace, held))
+			{
+				auto started = std::chrono::steady_clock::now();
+				QueryResult result;
+				result.status = QueryStatus::solved;
+				result.estimated_cells = job->estimate.cells;
+				result.estimated_bytes = job->estimate.bytes;
+				result.strategy = job->estimate.strategy;
+				result.queue_seconds = std::chrono::duration<double>(started - job->submitted).count();
+				if (_options.metrics)
+				{
+					_options.metrics->histogram("service", "queue").record_since(job->submitted);
+				}
+
+				DynamicOptions options;
+				options.reconstruction = job->estimate.strategy;
+				options.workspace = &workspace;
+				options.metrics = _options.metrics;
+				std::shared_ptr<ArmorVector> armors = dynamic_max_defense(job->pruned, job->estimate.budget, options);
+				sum_armor_vector(*armors, result.total_cost, result.total_defense);
+				result.armors = armors;
+
+				// Keep this worker's idle memory within its share of the budget,
+				// and account for what it keeps.
+				if (workspace.capacity_bytes() > fair_share)
+				{
+					workspace.release();
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					size_t retained = workspace.capacity_bytes();
+					_bytes_in_use = _bytes_in_use - job->estimate.bytes - held + retained;
+					_workspace_bytes = _workspace_bytes - held + retained;
+					held = retained;
+					_stats.running--;
+					_stats.solved++;
+				}
+				_changed.notify_all();
+				finish(job->query, result);
+			}
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			_bytes_in_use -= held;
+			_workspace_bytes -= held;
+		}
+
+		std::shared_ptr<const ArmorVector> _catalog;
+		ServiceOptions _options;
+
+		mutable std::mutex _mutex;
+		std::condition_variable _changed;
+		std::vector<std::unique_ptr<Job>> _queue;
+		size_t _bytes_in_use = 0;
+		size_t _workspace_bytes = 0;
+		ServiceStats _stats;
+		std::atomic<bool> _stopping{false};
+
+		SingleFlight<DefenseQuery, QueryResult> _flights;
+		std::vector<std::thread> _workers;
+
+		// Queries submitted as leaders and not yet finished; speculation only
+		// runs while this is zero.
+		std::atomic<size_t> _active{0};
+		std::condition_variable _idle;
+		HotWindowTracker _hot{std::max<size_t>(1, _options.hot_windows)};
+		std::map<FilterWindow, std::shared_ptr<const SpeculativeTable>> _tables;
+		std::thread _speculator;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// solverservice.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,400 @@
+///////////////////////////////////////////////////////////////////////////////
+// speculation.hh
+//
+// Pieces for precomputing answers before they are asked for. Query traffic is
+// skewed toward a few filter windows (the min_defense, max_defense, total_size
+// part of a DefenseQuery), so a resident solver can count windows in a
+// count-min sketch and, while it has nothing else to do, build the full DP
+// table of the hottest ones. One table covers every budget up to its width:
+// any later query on that window is answered by backtracking alone.
+//
+// Building a table is resumable one item row at a time, so it can stop the
+// moment real work arrives and carry on from the same row later.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "maxdefense.hh"
+#include "querycapture.hh"
+
+
+// Approximate counts of 64-bit keys in fixed memory. Estimates never undercount;
+// they overcount by at most total() * e / width with probability 1 - e^-depth.
+class CountMinSketch
+{
+	//
+	public:
+
+		//
+		CountMinSketch(size_t width = 1024, size_t depth = 4)
+			:
+			_width(width),
+			_depth(depth),
+			_counts(width * depth, 0)
+		{
+			assert(width > 0 && depth > 0);
+		}
+
+		// Count key count more times; returns its new estimate.
+		uint32_t add(uint64_t key, uint32_t count = 1)
+		{
+			uint32_t estimate = UINT32_MAX;
+			for (size_t d = 0; d < _depth; d++)
+			{
+				uint32_t& cell = _counts[d * _width + index(key, d)];
+				cell += count;
+				estimate = std::min(estimate, cell);
+			}
+			_total += count;
+			return estimate;
+		}
+
+		//
+		uint32_t estimate(uint64_t key) const
+		{
+			uint32_t estimate = UINT32_MAX;
+			for (size_t d = 0; d < _depth; d++)
+			{
+				estimate = std::min(estimate, _counts[d * _width + index(key, d)]);
+			}
+			return estimate;
+		}
+
+		// Halve every count, so old traffic fades out.
+		void halve()
+		{
+			for (auto& count : _counts)
+			{
+				count /= 2;
+			}
+			_total /= 2;
+		}
+
+		// Sum of all counts added, after halving.
+		uint64_t total() const { return _total; }
+
+	//
+	private:
+
+		// splitmix64 finalizer, seeded differently for each row.
+		size_t index(uint64_t key, size_t row) const
+		{
+			uint64_t x = key + (row + 1) * 0x9e3779b97f4a7c15ull;
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+			x ^= x >> 31;
+			return x % _width;
+		}
+
+		size_t _width;
+		size_t _depth;
+		std::vector<uint32_t> _counts;
+		uint64_t _total = 0;
+};
+
+
+// The filter_armor_vector part of a DefenseQuery.
+struct FilterWindow
+{
+	double min_defense = 0;
+	double max_defense = 0;
+	int32_t total_size = 0;
+};
+
+
+//
+FilterWindow window_of(const DefenseQuery& query)
+{
+	FilterWindow window;
+	window.min_defense = query.min_defense;
+	window.max_defense = query.max_defense;
+	window.total_size = query.total_size;
+	return window;
+}
+
+
+//
+bool operator<(const FilterWindow& a, const FilterWindow& b)
+{
+	if (a.min_defense != b.min_defense)
+	{
+		return a.min_defense < b.min_defense;
+	}
+	if (a.max_defense != b.max_defense)
+	{
+		return a.max_defense < b.max_defense;
+	}
+	return a.total_size < b.total_size;
+}
+
+
+// FNV-1a over the window's fields, as the sketch key.
+uint64_t window_key(const FilterWindow& window)
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*) data;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	};
+	mix(&window.min_defense, sizeof(window.min_defense));
+	mix(&window.max_defense, sizeof(window.max_defense));
+	mix(&window.total_size, sizeof(window.total_size));
+	return hash;
+}
+
+
+// A frequently queried window and the largest budget asked of it.
+struct HotWindow
+{
+	FilterWindow window;
+	uint32_t frequency = 0;
+	int max_budget = 0;
+};
+
+
+// Keeps the capacity most frequent windows seen, by count-min estimate: a new
+// window displaces the coldest one kept once its estimate is higher.
+class HotWindowTracker
+{
+	//
+	public:
+
+		// Every decay_every queries, all counts are halved.
+		HotWindowTracker(size_t capacity = 8, size_t decay_every = size_t(1) << 16)
+			:
+			_capacity(capacity),
+			_decay_every(decay_every)
+		{
+			assert(capacity > 0 && decay_every > 0);
+		}
+
+		//
+		void record(const DefenseQuery& query)
+		{
+			FilterWindow window = window_of(query);
+			uint32_t frequency = _sketch.add(window_key(window));
+
+			auto found = _hot.find(window);
+			if (found != _hot.end())
+			{
+				found->second.frequency = frequency;
+				found->second.max_budget = std::max(found->second.max_budget, int(query.budget));
+			}
+			else
+			{
+				auto coldest = std::min_element(_hot.begin(), _hot.end(), [](const auto& a, const auto& b)
+				{
+					return a.second.frequency < b.second.frequency;
+				});
+				if (_hot.size() < _capacity || frequency > coldest->second.frequency)
+				{
+					if (_hot.size() >= _capacity)
+					{
+						_hot.erase(coldest);
+					}
+					HotWindow& hot = _hot[window];
+					hot.window = window;
+					hot.frequency = frequency;
+					hot.max_budget = query.budget;
+				}
+			}
+
+			if (++_recorded % _decay_every == 0)
+			{
+				_sketch.halve();
+				for (auto& entry : _hot)
+				{
+					entry.second.frequency /= 2;
+				}
+			}
+		}
+
+		// Kept windows, most frequent first.
+		std::vector<HotWindow> hottest() const
+		{
+			std::vector<HotWindow> result;
+			for (auto& entry : _hot)
+			{
+				result.push_back(entry.second);
+			}
+			std::sort(result.begin(), result.end(), [](const HotWindow& a, const HotWindow& b)
+			{
+				return a.frequency > b.frequency;
+			});
+			return result;
+		}
+
+		//
+		bool is_hot(const FilterWindow& window) const
+		{
+			return _hot.count(window) != 0;
+		}
+
+		//
+		const CountMinSketch& sketch() const { return _sketch; }
+
+	//
+	private:
+
+		size_t _capacity;
+		size_t _decay_every;
+		size_t _recorded = 0;
+		CountMinSketch _sketch;
+		std::map<FilterWindow, HotWindow> _hot;
+};
+
+
+// The full DP table of one filter window, for every budget up to max_budget.
+// Rows are filled by advance(), which may stop between any two of them.
+class SpeculativeTable
+{
+	//
+	public:
+
+		// Filters catalog to window; max_budget is capped at the subset's total
+		// cost, or lower so the table fits in max_bytes. The table itself is
+		// allocated by the first advance(), so covers() can be asked first.
+		SpeculativeTable(const ArmorVector& catalog, const FilterWindow& window, int max_budget, size_t max_bytes)
+			:
+			_window(window),
+			_items(filter_armor_vector(catalog, window.min_defense, window.max_defense, window.total_size)),
+			_requested_budget(max_budget)
+		{
+			size_t n = _items->size();
+			int64_t total = 0;
+			_costs.resize(n);
+			_defenses.resize(n);
+			for (size_t i = 0; i < n; i++)
+			{
+				_costs[i] = (*_items)[i]->cost();
+				_defenses[i] = (*_items)[i]->defense();
+				total += _costs[i];
+			}
+
+			int64_t fits = int64_t(max_bytes / ((n + 1) * sizeof(double))) - 1;
+			_total_cost = std::min<int64_t>(total, INT32_MAX);
+			_max_budget = std::max<int64_t>(0, std::min<int64_t>({ max_budget, total, fits }));
+			_width = _max_budget + 1;
+		}
+
+		//
+		const FilterWindow& window() const { return _window; }
+
+		// Largest budget the table has a column for.
+		int max_budget() const { return _max_budget; }
+
+		// The max_budget it was built for, before capping.
+		int requested_budget() const { return _requested_budget; }
+
+		// Whether answer() works for budget: it has a column, or buys everything.
+		bool covers(int budget) const
+		{
+			return budget >= 0 && (budget <= _max_budget || _max_budget == _total_cost);
+		}
+
+		//
+		size_t bytes() const
+		{
+			return (_costs.size() + 1) * _width * sizeof(double) + _costs.size() * (sizeof(int32_t) + sizeof(double));
+		}
+
+		//
+		bool complete() const { return _rows_done == _items->size(); }
+
+		// Item rows filled so far.
+		size_t rows_done() const { return _rows_done; }
+
+		// Fill rows until the table is complete or preempted() returns true,
+		// which is asked before every row. Returns complete().
+		template <typename Preempted>
+		bool advance(Preempted preempted)
+		{
+			if (_table.empty())
+			{
+				_table.resize((_items->size() + 1) * _width);
+			}
+			while ( ! complete() )
+			{
+				if (preempted())
+				{
+					return false;
+				}
+				size_t i = ++_rows_done;
+				dynamic_fill_row(&_table[(i - 1) * _width], &_table[i * _width], _max_budget, _costs[i - 1], _defenses[i - 1]);
+			}
+			return true;
+		}
+
+		// What dynamic_max_defense on the filtered window would return for budget.
+		std::unique_ptr<ArmorVector> answer(int budget) const
+		{
+			assert(complete() && covers(budget));
+			std::vector<size_t> choice;
+			int horz = std::min(budget, _max_budget);
+			dynamic_backtrack(_table.data(), _width, _costs.data(), 0, _items->size(), horz, choice);
+
+			std::unique_ptr<ArmorVector> armors(new ArmorVector);
+			for (size_t i : choice)
+			{
+				armors->push_back((*_items)[i]);
+			}
+			return armors;
+		}
+
+	//
+	private:
+
+		FilterWindow _window;
+		std::unique_ptr<ArmorVector> _items;
+		std::vector<int32_t> _costs;
+		std::vector<double> _defenses;
+		int _requested_budget = 0;
+		int _total_cost = 0;
+		int _max_budget = 0;
+		size_t _width = 1;
+		std::vector<double> _table;
+		size_t _rows_done = 0;
+};
+
+
+// Let the calling thread run only when a CPU would otherwise be idle:
+// SCHED_IDLE where the kernel allows it, else the weakest nice value.
+void lower_thread_priority()
+{
+#ifdef SCHED_IDLE
+	sched_param param;
+	std::memset(&param, 0, sizeof(param));
+	if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0)
+	{
+		return;
+	}
+#endif
+	// On Linux the nice value is per thread.
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// speculation.hh
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,425 @@
+///////////////////////////////////////////////////////////////////////////////
+// tenants.hh
+//
+// Many merchant catalogs in one process. Each tenant has a loader for its
+// catalog and, once it has been queried, DP state: one SpeculativeTable per
+// filter window it was asked about, reused for any budget the table covers.
+//
+// The registry accounts the bytes of every resident catalog and table against
+// one memory cap. Over the cap it evicts by GreedyDual-Size: each entry's
+// priority is the running inflation value plus its rebuild time per byte, set
+// when it is built or used; the lowest priority goes first, and the inflation
+// value rises to it. DP tables are evicted before any catalog, since a catalog
+// is needed to rebuild its tables. An evicted catalog is loaded again, and an
+// evicted table rebuilt, on the tenant's next query.
+//
+// Entries evicted while a query still holds them stay alive until it is done;
+// the accounting only covers what the registry itself keeps.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+
+#pragma once
+
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "maxdefense.hh"
+#include "querycapture.hh"
+#include "singleflight.hh"
+#include "speculation.hh"
+
+
+// Loads one tenant's catalog; returns nullptr on failure.
+typedef std::function<std::unique_ptr<ArmorVector>()> CatalogLoader;
+
+
+// Approximate heap bytes of an ArmorVector and the items it holds.
+size_t armor_vector_bytes(const ArmorVector& armors)
+{
+	// shared_ptr, its control block (make_shared or not), the item and its string.
+	size_t bytes = armors.capacity() * sizeof(std::shared_ptr<ArmorItem>);
+	for (auto& armor : armors)
+	{
+		bytes += 2 * sizeof(void*) + sizeof(ArmorItem) + armor->description().capacity();
+	}
+	return bytes;
+}
+
+
+// Limits for TenantRegistry.
+struct TenantOptions
+{
+	// Bytes all resident catalogs and DP tables may hold together.
+	size_t memory_cap_bytes = size_t(256) << 20;
+
+	// Most bytes one DP table may take. Queries whose table would not fit are
+	// solved directly and leave no DP state behind.
+	size_t max_table_bytes = size_t(64) << 20;
+};
+
+
+// Counters of a TenantRegistry, as of one moment.
+struct TenantStats
+{
+	size_t tenants = 0;
+	size_t resident_catalogs = 0;
+	size_t resident_tables = 0;
+	size_t bytes_in_use = 0;
+
+	size_t catalog_loads = 0;
+	size_t table_builds = 0;
+
+	// Queries answered from a resident table.
+	size_t table_hits = 0;
+
+	size_t evicted_tables = 0;
+	size_t evicted_catalogs = 0;
+};
+
+
+// Catalogs and DP state of many tenants under one memory cap; see the top of this file.
+class TenantRegistry
+{
+	//
+	public:
+
+		//
+		explicit TenantRegistry(const TenantOptions& options = TenantOptions())
+			:
+			_options(options)
+		{}
+
+		TenantRegistry(const TenantRegistry&) = delete;
+		TenantRegistry& operator=(const TenantRegistry&) = delete;
+
+		//
+		const TenantOptions& options() const { return _options; }
+
+		// Register a tenant; nothing is loaded until its first query. Replaces
+		// any tenant of the same name, dropping its resident state.
+		void add_tenant(const std::string& name, CatalogLoader loader)
+		{
+			assert(loader);
+			std::lock_guard<std::mutex> lock(_mutex);
+			drop(name);
+			_tenants[name].loader = loader;
+		}
+
+		// A tenant whose catalog is the armor CSV at path.
+		void add_tenant_csv(const std::string& name, const std::string& path)
+		{
+			add_tenant(name, [path]() { return load_armor_database(path); });
+		}
+
+		// Forget a tenant and free its state; false if there was none.
+		bool remove_tenant(const std::string& name)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if ( ! drop(name) )
+			{
+				return false;
+			}
+			_tenants.erase(name);
+			return true;
+		}
+
+		//
+		bool has_tenant(const std::string& name) const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _tenants.count(name) != 0;
+		}
+
+		// The tenant's catalog, loading it if it is not resident. nullptr if
+		// there is no such tenant or its loader failed.
+		std::shared_ptr<const ArmorVector> catalog(const std::string& name)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto found = _tenants.find(name);
+				if (found == _tenants.end())
+				{
+					return nullptr;
+				}
+				Tenant& tenant = found->second;
+				if (tenant.catalog)
+				{
+					touch(tenant.catalog_entry);
+					return tenant.catalog;
+				}
+			}
+
+			// Concurrent first queries for one tenant share a single load.
+			return _loads.run(name, [&]() { return load(name); });
+		}
+
+		// Answer query against the tenant's catalog, from its DP state when a
+		// resident table covers the budget. nullptr if the catalog is unavailable.
+		std::unique_ptr<ArmorVector> solve(const std::string& name, const DefenseQuery& query)
+		{
+			assert(query.budget >= 0);
+			std::shared_ptr<const ArmorVector> armors = catalog(name);
+			if ( ! armors )
+			{
+				return nullptr;
+			}
+
+			FilterWindow window = window_of(query);
+			std::shared_ptr<const SpeculativeTable> table;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto found = _tenants.find(name);
+				if (found != _tenants.end())
+				{
+					auto resident = found->second.tables.find(window);
+					if (resident != found->second.tables.end() && resident->second.table->covers(query.budget))
+					{
+						touch(resident->second.entry);
+						table = resident->second.table;
+						_stats.table_hits++;
+					}
+				}
+			}
+			if (table)
+			{
+				return table->answer(query.budget);
+			}
+
+			// A table capped by max_table_bytes below the budget is never filled.
+			auto start = std::chrono::steady_clock::now();
+			auto built = std::make_shared<SpeculativeTable>(*armors, window, query.budget, _options.max_table_bytes);
+			if ( ! built->covers(query.budget) )
+			{
+				auto subset = filter_armor_vector(*armors, query.min_defense, query.max_defense, query.total_size);
+				return dynamic_max_defense(*subset, query.budget);
+			}
+			built->advance([]() { return false; });
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto found = _tenants.find(name);
+				if (found != _tenants.end() && found->second.catalog == armors)
+				{
+					Tenant& tenant = found->second;
+					auto replaced = tenant.tables.find(window);
+					if (replaced != tenant.tables.end())
+					{
+						_bytes_in_use -= replaced->second.entry.bytes;
+					}
+					Resident& resident = tenant.tables[window];
+					resident.table = built;
+					resident.entry.bytes = built->bytes();
+					resident.entry.rebuild_seconds = seconds;
+					touch(resident.entry);
+					_bytes_in_use += resident.entry.bytes;
+					_stats.table_builds++;
+					evict_over_cap();
+				}
+			}
+			return built->answer(query.budget);
+		}
+
+		// Bytes the registry holds for one tenant: its catalog and tables.
+		size_t tenant_bytes(const std::string& name) const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto found = _tenants.find(name);
+			if (found == _tenants.end())
+			{
+				return 0;
+			}
+			const Tenant& tenant = found->second;
+			size_t bytes = tenant.catalog ? tenant.catalog_entry.bytes : 0;
+			for (auto& resident : tenant.tables)
+			{
+				bytes += resident.second.entry.bytes;
+			}
+			return bytes;
+		}
+
+		//
+		TenantStats stats() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			TenantStats stats = _stats;
+			stats.tenants = _tenants.size();
+			stats.resident_catalogs = 0;
+			stats.resident_tables = 0;
+			for (auto& entry : _tenants)
+			{
+				stats.resident_catalogs += entry.second.catalog ? 1 : 0;
+				stats.resident_tables += entry.second.tables.size();
+			}
+			stats.bytes_in_use = _bytes_in_use;
+			return stats;
+		}
+
+	//
+	private:
+
+		// Accounting of one evictable thing.
+		struct Entry
+		{
+			size_t bytes = 0;
+			double rebuild_seconds = 0;
+
+			// GreedyDual-Size H value.
+			double priority = 0;
+		};
+
+		struct Resident
+		{
+			std::shared_ptr<const SpeculativeTable> table;
+			Entry entry;
+		};
+
+		struct Tenant
+		{
+			CatalogLoader loader;
+			std::shared_ptr<const ArmorVector> catalog;
+			Entry catalog_entry;
+			std::map<FilterWindow, Resident> tables;
+		};
+
+		// Raise entry's priority to the current inflation value plus its
+		// rebuild time per byte. Called with _mutex held.
+		void touch(Entry& entry)
+		{
+			entry.priority = _inflation + entry.rebuild_seconds / std::max<size_t>(1, entry.bytes);
+		}
+
+		// Run the tenant's loader and make its catalog resident.
+		std::shared_ptr<const ArmorVector> load(const std::string& name)
+		{
+			CatalogLoader loader;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto found = _tenants.find(name);
+				if (found == _tenants.end())
+				{
+					return nullptr;
+				}
+				if (found->second.catalog)
+				{
+					return found->second.catalog;
+				}
+				loader = found->second.loader;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			std::shared_ptr<const ArmorVector> loaded = loader();
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if ( ! loaded )
+			{
+				return nullptr;
+			}
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto found = _tenants.find(name);
+			if (found == _tenants.end())
+			{
+				return loaded;
+			}
+			Tenant& tenant = found->second;
+			tenant.catalog = loaded;
+			tenant.catalog_entry.bytes = armor_vector_bytes(*loaded);
+			tenant.catalog_entry.rebuild_seconds = seconds;
+			touch(tenant.catalog_entry);
+			_bytes_in_use += tenant.catalog_entry.bytes;
+			_stats.catalog_loads++;
+			evict_over_cap();
+			return loaded;
+		}
+
+		// Free a tenant's catalog and tables, keeping its loader; false if
+		// there is no such tenant. Called with _mutex held.
+		bool drop(const std::string& name)
+		{
+			auto found = _tenants.find(name);
+			if (found == _tenants.end())
+			{
+				return false;
+			}
+			Tenant& tenant = found->second;
+			for (auto& resident : tenant.tables)
+			{
+				_bytes_in_use -= resident.second.entry.bytes;
+			}
+			tenant.tables.clear();
+			if (tenant.catalog)
+			{
+				_bytes_in_use -= tenant.catalog_entry.bytes;
+				tenant.catalog.reset();
+			}
+			return true;
+		}
+
+		// Evict lowest-priority entries until under the cap: DP tables while
+		// there are any, then catalogs. Called with _mutex held.
+		void evict_over_cap()
+		{
+			while (_bytes_in_use > _options.memory_cap_bytes)
+			{
+				Tenant* owner = nullptr;
+				std::map<FilterWindow, Resident>::iterator coldest;
+				for (auto& entry : _tenants)
+				{
+					for (auto it = entry.second.tables.begin(); it != entry.second.tables.end(); ++it)
+					{
+						if ( ! owner || it->second.entry.priority < coldest->second.entry.priority)
+						{
+							owner = &entry.second;
+							coldest = it;
+						}
+					}
+				}
+				if (owner)
+				{
+					_inflation = coldest->second.entry.priority;
+					_bytes_in_use -= coldest->second.entry.bytes;
+					owner->tables.erase(coldest);
+					_stats.evicted_tables++;
+					continue;
+				}
+
+				Tenant* victim = nullptr;
+				for (auto& entry : _tenants)
+				{
+					if (entry.second.catalog && ( ! victim || entry.second.catalog_entry.priority < victim->catalog_entry.priority))
+					{
+						victim = &entry.second;
+					}
+				}
+				if ( ! victim )
+				{
+					break;
+				}
+				_inflation = victim->catalog_entry.priority;
+				_bytes_in_use -= victim->catalog_entry.bytes;
+				victim->catalog.reset();
+				_stats.evicted_catalogs++;
+			}
+		}
+
+		TenantOptions _options;
+
+		mutable std::mutex _mutex;
+		std::map<std::string, Tenant> _tenants;
+		size_t _bytes_in_use = 0;
+		double _inflation = 0;
+		TenantStats _stats;
+
+		SingleFlight<std::string, std::shared_ptr<const ArmorVector>> _loads;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// tenants.hh
+///////////////////////////////////////////////////////////////////////////////